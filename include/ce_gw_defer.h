@@ -0,0 +1,89 @@
+/**
+ * @file ce_gw_defer.h
+ * @brief Control Area Network - Ethernet - Gateway - Deferred Processing Header
+ * @author Fabian Raab (fabian.raab@tum.de)
+ * @date May, 2013
+ * @copyright GNU Public License v3 or higher
+ * @ingroup files
+ * @{
+ */
+
+/*****************************************************************************
+ * (C) Copyright 2013 Fabian Raab, Stefan Smarzly
+ *
+ * This file is part of CAN-Eth-GW.
+ *
+ * CAN-Eth-GW is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CAN-Eth-GW is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CAN-Eth-GW.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef __CE_GW_DEFER_H__
+#define __CE_GW_DEFER_H__
+
+#include <linux/skbuff.h>
+
+struct ce_gw_job;
+
+/**
+ * @fn int ce_gw_defer_route(struct ce_gw_job *gwj, int cpu)
+ * @brief Prepares deferred processing of a route with the
+ *        #CE_GW_F_DEFER flag
+ * @param gwj The route
+ * @param cpu CPU whose worker processes the frames of the route, -1 for the
+ *        CPU which receives the frame
+ * @retval 0 on success
+ * @retval -EINVAL if param cpu is not online
+ * @retval -EOPNOTSUPP before Linux 4.12
+ * @retval <0 if the workers could not be started
+ * @details Starts the workers on all online CPUs with the first deferred
+ *          route. CPUs which come online later get their worker from a CPU
+ *          hotplug callback.
+ * @ingroup defer
+ */
+extern int ce_gw_defer_route(struct ce_gw_job *gwj, int cpu);
+
+/**
+ * @fn int ce_gw_defer(struct sk_buff *skb, struct ce_gw_job *gwj)
+ * @brief Puts a received frame of a deferred route on the ring of its worker
+ * @param skb The received CAN or ETH frame, it is not consumed
+ * @param gwj The route
+ * @retval 0 if the frame was queued or processed
+ * @retval -ENOBUFS if the ring is full or the clone failed
+ * @details The worker calls ce_gw_job_rcv() for the frame. If the CPU has
+ *          no worker, the frame is processed at once.
+ * @pre rcu_read_lock() must be held
+ * @ingroup defer
+ */
+extern int ce_gw_defer(struct sk_buff *skb, struct ce_gw_job *gwj);
+
+/**
+ * @fn void ce_gw_defer_wait(struct ce_gw_job *gwj)
+ * @brief Waits until the workers processed all queued frames of a route
+ * @param gwj The route
+ * @pre The route was removed from all receive lists and synchronize_rcu()
+ *      was called, so no new frames are queued.
+ * @ingroup defer
+ */
+extern void ce_gw_defer_wait(struct ce_gw_job *gwj);
+
+/**
+ * @fn void ce_gw_defer_exit(void)
+ * @brief Stops the workers
+ * @pre All routes are removed
+ * @ingroup defer
+ */
+extern void ce_gw_defer_exit(void);
+
+#endif
+
+/**@}*/
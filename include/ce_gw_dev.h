@@ -36,6 +36,7 @@
 
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
+#include <linux/hrtimer.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,7,0)
 # include <uapi/linux/can.h>
 # else
@@ -45,6 +46,11 @@
 #   error Only Linux Kernel 3.6 and above are supported
 #  endif
 #endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,11,0) && IS_ENABLED(CONFIG_BPF_SYSCALL)
+#define CE_GW_DEV_XDP		/* XDP programs on the receive path */
+#include <linux/filter.h>
+#include <net/xdp.h>
+#endif
 #include "ce_gw_main.h"
 
 enum ce_gw_type;
@@ -59,10 +65,23 @@ struct ce_gw_job;
  *          dev is part of it. So there exist a Pointer from the
  *          struct ce_gw_job to the net_device and from struct ce_gw_job_info
  *          back to the same struct ce_gw_job.
+ *          If a CAN device of a job in job_src is busy, the TX queues of the
+ *          device are stopped and wake_timer polls until all CAN devices can
+ *          send again (not in #CE_GW_F_NO_QUEUE mode).
+ *          xdp_prog is the XDP program attached to the device, it sees the
+ *          translated frames of CAN -> ETH routes before they are passed to
+ *          the OS.
  */
 struct ce_gw_job_info {
 	struct hlist_head job_src; /**< List where the dev is the src in job */
 	struct hlist_head job_dst; /**< List where the dev is the dst in job */
+	struct net_device *dev;	   /**< The device this private field belongs */
+	u32 flags;		   /**< Device flags e.g. #CE_GW_F_NO_QUEUE */
+	struct hrtimer wake_timer; /**< Wakes stopped TX queues */
+#ifdef CE_GW_DEV_XDP
+	struct bpf_prog __rcu *xdp_prog; /**< attached XDP program or NULL */
+	struct xdp_rxq_info xdp_rxq;	 /**< RX queue info of the xdp_buff */
+#endif
 };
 
 /**
@@ -163,12 +182,57 @@ extern int ce_gw_dev_job_add(struct net_device *eth_dev, struct ce_gw_job *job);
 
 extern void ce_gw_dev_job_remove(struct ce_gw_job *job);
 
+/**
+ * @fn int ce_gw_dev_xdp(struct net_device *dev, struct sk_buff **eth_skb)
+ * @brief Runs the XDP program of the device on a frame of a CAN -> ETH route
+ * @param dev The gateway device, destination of the route
+ * @param eth_skb The translated frame after the modifications and the BPF
+ *        program of the route
+ * @details The frame is copied into a per CPU page for the program. Must be
+ *          called in softirq context under rcu_read_lock().
+ * @retval 0 No program is attached or it returned XDP_PASS. param eth_skb
+ *         has to be passed on, it is replaced by a sk_buff built around the
+ *         page with the frame as the program left it.
+ * @retval 1 The frame was redirected (XDP_REDIRECT), ce_gw_dev_xdp_flush()
+ *         has to be called before the softirq ends
+ * @retval -EPERM The program dropped the frame
+ * @retval -ENOMEM No page for the frame, it was dropped
+ * @warning param eth_skb is consumed unless 0 is returned
+ * @ingroup dev
+ */
+#ifdef CE_GW_DEV_XDP
+extern int ce_gw_dev_xdp(struct net_device *dev, struct sk_buff **eth_skb);
+#else
+static inline int ce_gw_dev_xdp(struct net_device *dev,
+                                struct sk_buff **eth_skb)
+{
+	return 0;
+}
+#endif
+
+/**
+ * @fn void ce_gw_dev_xdp_flush(void)
+ * @brief Sends the frames ce_gw_dev_xdp() redirected
+ * @details Called once per received CAN frame after all of its routes, not
+ *          once per redirected frame.
+ * @ingroup dev
+ */
+#ifdef CE_GW_DEV_XDP
+extern void ce_gw_dev_xdp_flush(void);
+#else
+static inline void ce_gw_dev_xdp_flush(void)
+{
+}
+#endif
+
 /**
  * @fn struct net_device *ce_gw_dev_alloc(void)
  * @brief Allocates a Ethernet Device for the Gateway.
  * @param dev_name the name of the new allocated device
  * @details Allocates a Ethernet Device with struct ce_gw_job_info as private
- *          data. ce_gw_dev_setup() should be called after this function.
+ *          data and one TX/RX queue per online CPU (limited by the module
+ *          parameter max_queues). ce_gw_dev_setup() should be called after
+ *          this function.
  *          ce_gw_dev_free() musst be called for freeing the memory.
  * @retval NULL If an error has occured.
  * @return A pointer to the allocated device.
@@ -192,7 +256,9 @@ extern void ce_gw_dev_free(struct net_device *eth_dev);
  * @param type Type of the Gateway wich will be linked to the device. A
  * sensible MTU will be set. Use CE_GW_TYPE_NONE for default ethernet MTU.
  * @param flags If CE_GW_F_CAN_FD Flag is set the MTU will be set to the
- *              CAN-FD size else to the normal CAN size.
+ *              CAN-FD size else to the normal CAN size. If CE_GW_F_NO_QUEUE
+ *              is set the device has no queue and frames are dropped if the
+ *              CAN device is busy (drop-tail) instead of stopping the queue.
  * @param dev the ethernet device which should be set up
  * @details Sets the default attributes for the Gateway Ethernet device. Also
  *          links the net_device operations to the net_dev structure.
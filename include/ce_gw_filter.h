@@ -0,0 +1,208 @@
+/**
+ * @file ce_gw_filter.h
+ * @brief Control Area Network - Ethernet - Gateway - Per ID Filter Header
+ * @author Fabian Raab (fabian.raab@tum.de)
+ * @date May, 2013
+ * @copyright GNU Public License v3 or higher
+ * @ingroup files
+ * @details struct ce_gw_throttle_id is shared with user space, this header
+ *          can be included by cegwctl.
+ * @{
+ */
+
+/*****************************************************************************
+ * (C) Copyright 2013 Fabian Raab, Stefan Smarzly
+ *
+ * This file is part of CAN-Eth-GW.
+ *
+ * CAN-Eth-GW is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CAN-Eth-GW is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CAN-Eth-GW.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef __CE_GW_FILTER_H__
+#define __CE_GW_FILTER_H__
+
+#include <linux/types.h>
+#include <linux/can.h>
+
+/**
+ * @struct ce_gw_throttle_id
+ * @brief Interval of one CAN ID of a route with #CE_GW_F_THROTTLE, an
+ *        array of it is the netlink attribute CE_GW_A_THROTTLE_IDS
+ */
+struct ce_gw_throttle_id {
+	__u32 can_id;		/**< CAN ID, with CAN_EFF_FLAG for EFF IDs */
+	__u32 interval_ms;	/**< Minimum interval, 0 to forward all frames */
+};
+
+#ifdef __KERNEL__
+
+#include <linux/spinlock.h>
+#include <linux/skbuff.h>
+#include <linux/list.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+
+struct ce_gw_job;
+
+/**
+ * @struct ce_gw_idtab_ent
+ * @brief Head of every entry of a struct ce_gw_idtab
+ */
+struct ce_gw_idtab_ent {
+	canid_t id;		/**< CAN ID (with CAN_EFF_FLAG) of the entry */
+	u32 used;		/**< The entry holds the state of id */
+};
+
+/** Called before an used entry is given to another ID */
+typedef void (*ce_gw_idtab_evict_fn)(struct ce_gw_idtab_ent *ent);
+
+/**
+ * @struct ce_gw_idtab
+ * @brief Table with a state per CAN ID
+ * @details The 2048 SFF IDs have one entry each (direct-mapped). The EFF IDs
+ *          share a hashed part of eff_mask + 1 entries, an ID replaces the
+ *          state of another ID with the same hash. The entries start with a
+ *          struct ce_gw_idtab_ent.
+ */
+struct ce_gw_idtab {
+	void *ents;		/**< SFF entries followed by the EFF entries */
+	size_t ent_size;	/**< Size of an entry in bytes */
+	u32 eff_mask;		/**< Number of EFF entries - 1 */
+	spinlock_t lock;	/**< Serializes the receivers */
+	ce_gw_idtab_evict_fn evict;	/**< Releases an entry or NULL */
+};
+
+/**
+ * @struct ce_gw_change
+ * @brief Change-only forwarding of a CAN -> ETH route (#CE_GW_F_ON_CHANGE)
+ * @details A frame is only forwarded if its DLC or a data byte under mask
+ *          differs from the last forwarded frame of its ID, or if refresh
+ *          passed since then.
+ */
+struct ce_gw_change {
+	struct ce_gw_idtab tab;	/**< Last forwarded frame per ID */
+	unsigned long refresh;	/**< Forced refresh in jiffies, 0 = never */
+	u8 data_len;		/**< Compared data bytes (8 or CAN FD 64) */
+	u8 mask[CANFD_MAX_DLEN]; /**< Compared bits of the data bytes */
+};
+
+/**
+ * @fn struct ce_gw_change *ce_gw_change_create(bool fd, const u8 *mask,
+ *                                              unsigned int mask_len,
+ *                                              u32 refresh_ms)
+ * @brief Allocates the change-only filter of a route
+ * @param fd true if the route forwards CAN FD frames
+ * @param mask Compared bits of the data bytes, NULL to compare all bits
+ * @param mask_len Length of param mask, missing bytes are 0xff
+ * @param refresh_ms A frame is forwarded at least this often per ID, 0 for
+ *        never
+ * @retval NULL if the allocation failed
+ * @ingroup alloc
+ */
+extern struct ce_gw_change *ce_gw_change_create(bool fd, const u8 *mask,
+                                                unsigned int mask_len,
+                                                u32 refresh_ms);
+
+/**
+ * @fn void ce_gw_change_destroy(struct ce_gw_change *chg)
+ * @brief Frees the change-only filter of a route
+ * @param chg The filter, may be NULL
+ * @pre No receiver may use the filter anymore (synchronize_rcu())
+ * @ingroup alloc
+ */
+extern void ce_gw_change_destroy(struct ce_gw_change *chg);
+
+/**
+ * @fn bool ce_gw_change_pass(struct ce_gw_change *chg,
+ *                            const struct sk_buff *can_skb)
+ * @brief Checks if a received frame changed and remembers it if it did
+ * @param chg The filter of the route
+ * @param can_skb The received CAN or CAN FD frame
+ * @retval true forward the frame
+ * @retval false the frame did not change, drop it
+ * @ingroup proc
+ */
+extern bool ce_gw_change_pass(struct ce_gw_change *chg,
+                              const struct sk_buff *can_skb);
+
+/**
+ * @struct ce_gw_throttle
+ * @brief Per ID rate limit of a CAN -> ETH route (#CE_GW_F_THROTTLE)
+ * @details A route forwards at most one frame per interval and ID. With
+ *          #CE_GW_F_TRAILING the latest suppressed frame of an interval is
+ *          kept and forwarded when the interval ends.
+ */
+struct ce_gw_throttle {
+	struct ce_gw_idtab tab;	/**< Time of the last forwarded frame per ID */
+	struct ce_gw_job *job;	/**< The route */
+	unsigned long interval;	/**< Default interval in jiffies */
+	struct ce_gw_throttle_id *ids; /**< Intervals of single IDs in ms,
+				        * sorted by can_id */
+	unsigned int n_ids;	/**< Number of ids */
+	bool trailing;		/**< Keep and flush the latest frame */
+	bool dead;		/**< The route is removed, no new timer */
+	struct list_head pending; /**< Entries with a kept frame */
+	struct hrtimer timer;	/**< End of the earliest pending interval */
+	struct tasklet_struct tasklet; /**< Forwards the kept frames */
+};
+
+/**
+ * @fn struct ce_gw_throttle *ce_gw_throttle_create(struct ce_gw_job *job,
+ *                                                  u32 interval_ms,
+ *                                                  const struct
+ *                                                  ce_gw_throttle_id *ids,
+ *                                                  unsigned int n_ids,
+ *                                                  bool trailing)
+ * @brief Allocates the rate limit of a route
+ * @param job The route, its frames are forwarded with ce_gw_job_rcv()
+ * @param interval_ms Default minimum interval between two frames of an ID
+ * @param ids Intervals of single IDs, may be NULL
+ * @param n_ids Number of param ids
+ * @param trailing Forward the latest suppressed frame at the end of the
+ *        interval
+ * @retval NULL if the allocation failed
+ * @ingroup alloc
+ */
+extern struct ce_gw_throttle *ce_gw_throttle_create(struct ce_gw_job *job,
+        u32 interval_ms, const struct ce_gw_throttle_id *ids,
+        unsigned int n_ids, bool trailing);
+
+/**
+ * @fn void ce_gw_throttle_destroy(struct ce_gw_throttle *thr)
+ * @brief Stops the timer and frees the rate limit and its kept frames
+ * @param thr The rate limit, may be NULL
+ * @pre No receiver may use the rate limit anymore (synchronize_rcu())
+ * @ingroup alloc
+ */
+extern void ce_gw_throttle_destroy(struct ce_gw_throttle *thr);
+
+/**
+ * @fn bool ce_gw_throttle_pass(struct ce_gw_throttle *thr,
+ *                              const struct sk_buff *can_skb)
+ * @brief Checks if the interval of the ID of a received frame passed
+ * @param thr The rate limit of the route
+ * @param can_skb The received CAN or CAN FD frame, it is not consumed
+ * @retval true forward the frame
+ * @retval false drop the frame, with #CE_GW_F_TRAILING a clone of it is
+ *         kept for the end of the interval
+ * @ingroup proc
+ */
+extern bool ce_gw_throttle_pass(struct ce_gw_throttle *thr,
+                                const struct sk_buff *can_skb);
+
+#endif /* __KERNEL__ */
+
+#endif
+
+/**@}*/
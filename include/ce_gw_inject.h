@@ -0,0 +1,93 @@
+/**
+ * @file ce_gw_inject.h
+ * @brief Control Area Network - Ethernet - Gateway - Frame Injection Header
+ * @author Fabian Raab (fabian.raab@tum.de)
+ * @date May, 2013
+ * @copyright GNU Public License v3 or higher
+ * @ingroup files
+ * @details The ioctl interface of /dev/cegw is shared with user space, this
+ *          header can be included by injecting tools.
+ * @{
+ */
+
+/*****************************************************************************
+ * (C) Copyright 2013 Fabian Raab, Stefan Smarzly
+ *
+ * This file is part of CAN-Eth-GW.
+ *
+ * CAN-Eth-GW is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CAN-Eth-GW is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CAN-Eth-GW.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef __CE_GW_INJECT_H__
+#define __CE_GW_INJECT_H__
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#include <linux/can.h>
+
+/** ce_gw_inject_rec.flags: the record holds a CAN FD frame */
+#define CE_GW_INJECT_FD 0x00000001
+
+/**
+ * @struct ce_gw_inject_rec
+ * @brief A CAN or CAN FD frame to inject
+ */
+struct ce_gw_inject_rec {
+	__u32 flags;		/**< #CE_GW_INJECT_FD */
+	__u32 reserved;		/**< Must be 0 */
+	struct canfd_frame frame; /**< The frame, a can_frame uses only the
+				   * first CAN_MTU bytes */
+};
+
+/**
+ * @struct ce_gw_inject
+ * @brief Argument of #CE_GW_IOC_INJECT
+ * @details The status of every record is 0 if it was sent, 1 if it was
+ *          queued by the route and a negative errno if it was dropped.
+ */
+struct ce_gw_inject {
+	__u32 id;		/**< ID of an ETH -> CAN route */
+	__u32 count;		/**< Number of records */
+	__u64 recs;		/**< Pointer to count struct ce_gw_inject_rec */
+	__u64 status;		/**< Pointer to count __s32, may be 0 */
+	__u32 done;		/**< Returns the number of processed records */
+	__u32 reserved;		/**< Must be 0 */
+};
+
+/** Sends a batch of frames over a route, see struct ce_gw_inject */
+#define CE_GW_IOC_INJECT _IOWR('G', 0x01, struct ce_gw_inject)
+
+#ifdef __KERNEL__
+
+/**
+ * @fn int ce_gw_inject_init(void)
+ * @brief Registers the character device /dev/cegw
+ * @retval 0 on success
+ * @retval <0 if the registration failed
+ * @ingroup alloc
+ */
+extern int ce_gw_inject_init(void);
+
+/**
+ * @fn void ce_gw_inject_exit(void)
+ * @brief Unregisters the character device /dev/cegw
+ * @ingroup alloc
+ */
+extern void ce_gw_inject_exit(void);
+
+#endif /* __KERNEL__ */
+
+#endif
+
+/**@}*/
@@ -37,6 +37,13 @@
 #include <linux/skbuff.h>	/* sk_buff for receive */
 #include "ce_gw_dev.h"
 #include "ce_gw_netlink.h"
+#include "ce_gw_tx.h"
+#include "ce_gw_skb.h"
+#include "ce_gw_defer.h"
+#include "ce_gw_ring.h"
+#include "ce_gw_mod.h"
+#include "ce_gw_filter.h"
+#include "ce_gw_snap.h"
 #include <uapi/linux/can.h>	/* since kernel 3.7 in uapi/linux/ */
 #include <uapi/linux/if_arp.h>	/* Net_device types */
 #include <linux/can/core.h>	/* for can_rx_register and can_send */
@@ -44,9 +51,53 @@
 #include <linux/slab.h>		/* for using kmalloc/kfree */
 #include <linux/if_ether.h>
 #include <linux/netdevice.h>
+#include <linux/percpu.h>
+#include <linux/cache.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,15,0) && IS_ENABLED(CONFIG_BPF_SYSCALL)
+#define CE_GW_BPF		/* BPF programs of routes */
+#include <linux/filter.h>
+#endif
 
 /** ce_gw_job.flags: is Gateway CANfd compatible */
 #define CE_GW_F_CAN_FD 0x00000001 
+/** ce_gw_job_info.flags: drop frames if CAN is busy instead of flow control */
+#define CE_GW_F_NO_QUEUE 0x00000002
+/** ce_gw_job.flags: queue frames if the CAN destination is busy */
+#define CE_GW_F_TX_QUEUE 0x00000004
+/** ce_gw_job.flags: loop frames sent to CAN back to local CAN sockets */
+#define CE_GW_F_LOOPBACK 0x00000008
+/** ce_gw_job.flags: translate frames on a worker thread, see ce_gw_defer.h */
+#define CE_GW_F_DEFER 0x00000010
+/** ce_gw_job.flags: CAN -> ETH route writes frames into a capture ring
+ *  instead of translating them, see ce_gw_ring.h */
+#define CE_GW_F_RING 0x00000020
+/** ce_gw_job.flags: CAN -> ETH route forwards a frame only if it differs
+ *  from the last forwarded frame of its ID, see struct ce_gw_change */
+#define CE_GW_F_ON_CHANGE 0x00000040
+/** ce_gw_job.flags: CAN -> ETH route forwards at most one frame per interval
+ *  and ID, see struct ce_gw_throttle */
+#define CE_GW_F_THROTTLE 0x00000080
+/** ce_gw_job.flags: with #CE_GW_F_THROTTLE the latest suppressed frame of an
+ *  interval is forwarded when the interval ends */
+#define CE_GW_F_TRAILING 0x00000100
+/** ce_gw_job.flags: CAN -> ETH route stores the last frame of every ID in
+ *  the snapshot table of its source device, see ce_gw_snap.h */
+#define CE_GW_F_SNAPSHOT 0x00000200
+
+/**
+ * @name Verdicts of the BPF program of a route
+ * @brief Return values of a BPF_PROG_TYPE_SCHED_CLS program attached to a
+ *        route. All other values (e.g. TC_ACT_REDIRECT, TC_ACT_STOLEN) drop
+ *        the frame like #CE_GW_BPF_DROP.
+ * @{
+ */
+#define CE_GW_BPF_PASS 0	/**< forward by the route (TC_ACT_OK) */
+#define CE_GW_BPF_DROP 2	/**< drop the frame (TC_ACT_SHOT) */
+#define CE_GW_BPF_ROUTE_MASK 0xc0000000 /**< selects the redirect verdict */
+/** forward by the route with the given id in the same direction instead */
+#define CE_GW_BPF_ROUTE(id) (0x40000000 | (id))
+/**@}*/
 
 /**
  * @enum ce_gw_type
@@ -64,184 +115,330 @@ enum ce_gw_type {
 };
 #define CE_GW_TYPE_MAX (__CE_GW_TYPE_MAX - 1) /**< Maximum Type Number */
 
+struct ce_gw_job;
+struct bpf_prog;
+
+/**
+ * @brief Translation of a route, selected by ce_gw_create_route() for the
+ *        translation type, the #CE_GW_F_CAN_FD flag and the direction
+ * @param skb The received frame, it is not consumed
+ * @param gwj The route
+ * @retval NULL if the frame could not be translated
+ * @return the translated frame
+ */
+typedef struct sk_buff *(*ce_gw_xlat_fn)(struct sk_buff *skb,
+                                         struct ce_gw_job *gwj);
+
+/**
+ * @struct ce_gw_job_stats
+ * @brief Frame counters of a route, one instance per CPU
+ */
+struct ce_gw_job_stats {
+	u32 handled_frames;	/**< counter for handles frames */
+	u32 dropped_frames;	/**< counter for dropped_frames */
+	u32 loop_frames;	/**< counter for suppressed gateway frames */
+	u32 filtered_frames;	/**< counter for frames suppressed by the per ID
+				 * filters (e.g. #CE_GW_F_ON_CHANGE) */
+};
+
 /**
  * @struct ce_jw_job
  * @brief Mapping and statistics for CAN <-> ETH gateway jobs
  * (Based on can/gw.c, rev 20101209)
+ * @details The fields read for every frame come first and share the first
+ *          cache line, the counters are per CPU. Fields of the control path
+ *          and the transmission state follow on separate cache lines.
  */
 struct ce_gw_job {
-	struct hlist_node list;	/**< List entry for ce_gw_job_list main list */
-	struct rcu_head rcu;	/**< Lock monitor */
+	ce_gw_xlat_fn xlat;	/**< Translation of the route */
+	struct ce_gw_job_stats __percpu *stats; /**< Counters of the route */
 	struct hlist_node list_dev;	/**< List entry from the ETH device */
-	u32 id;			/**< Unique Identifier of Gateway */
-	enum ce_gw_type type;	/**< Translation type of the Gateway */
+	struct hlist_node list_grp;	/**< List entry of ce_gw_group.jobs */
+	union {
+		struct net_device *dev;
+	} dst;		/**< CAN / ETH frame data destination */
+	struct ce_gw_tx *tx;	/**< Transmission state of CAN dst (ETH -> CAN) */
+	struct ce_gw_ring *ring;	/**< Capture ring (#CE_GW_F_RING) */
+	struct ce_gw_mod *mod;	/**< Modifications of the route or NULL */
+	struct ce_gw_change *change;	/**< #CE_GW_F_ON_CHANGE filter */
+	struct ce_gw_throttle *throttle; /**< #CE_GW_F_THROTTLE rate limit */
+	struct ce_gw_snap *snap;	/**< #CE_GW_F_SNAPSHOT table */
+	struct bpf_prog *prog;	/**< BPF program of the route or NULL */
 	u32 flags;		/**< Flags with settings of the Gateway */
-	u32 handled_frames;	/**< counter for handles frames */
-	u32 dropped_frames;	/**< counter for dropped_frames */
+	u8 hop_limit;		/**< Max gateway hops of a forwarded frame */
 
+	struct hlist_node list ____cacheline_aligned_in_smp;
+				/**< List entry for ce_gw_job_list main list */
+	struct rcu_head rcu;	/**< Lock monitor */
+	struct ce_gw_group *grp;	/**< Fan-out group (CAN -> ETH) */
+	struct ce_gw_eth_src *eth_src;	/**< Physical ethernet source or NULL
+					 * for a cegw source (ETH -> CAN) */
+	u32 id;			/**< Unique Identifier of Gateway */
+	enum ce_gw_type type;	/**< Translation type of the Gateway */
 	union {
 		struct net_device *dev;
 	} src; 		/**< CAN / ETH frame data source */
-	union {
-		struct net_device *dev;
-	} dst;		/**< CAN / ETH frame data destination */
 	union {
 		struct can_filter can_rcv_filter;
 		/* TODO: Add ethernet receive filter (eth_rcv_filter) */
 	}; /**< Filter incoming packet */
+	struct ce_gw_skb_reserve reserve; /**< sk_buffs for memory pressure */
+	int defer_cpu;		/**< CPU of the worker (#CE_GW_F_DEFER), -1 for
+				 * the CPU which receives the frame */
+	atomic_t deferred;	/**< Frames of the route on worker rings */
+
+	struct ce_gw_tx_route txr ____cacheline_aligned_in_smp;
+				/**< State of the route in tx */
 };
 
+/** Counts a frame in the counters of the current CPU, e.g.
+ *  ce_gw_job_inc(gwj, dropped_frames) */
+#define ce_gw_job_inc(gwj, field) this_cpu_inc((gwj)->stats->field)
+
 /**
- * @fn struct hlist_head *ce_gw_get_job_list(void);
- * @brief getter for HLIST_HEAD(ce_gw_job_list)
- * @returns Pointer to ce_gw_job_list.
+ * @fn void ce_gw_job_get_stats(const struct ce_gw_job *gwj,
+ *                              struct ce_gw_job_stats *sum)
+ * @brief Sums the counters of all CPUs of a route
+ * @param gwj The route
+ * @param sum Returns the sums
  */
-struct hlist_head *ce_gw_get_job_list(void);
+void ce_gw_job_get_stats(const struct ce_gw_job *gwj,
+                         struct ce_gw_job_stats *sum);
 
 /**
- * @fn struct can_frame *ce_gw_alloc_can_frame(void)
- * @brief allocates memory for the can frame
- * @return pointer to the memory allocated
- * @ingroup alloc
- * @todo not tested yet
+ * @struct ce_gw_group
+ * @brief Fan-out group of all CAN -> ETH routes with the same CAN source,
+ *        receive filter and translation
+ * @details Only one receiver per group is registered at the CAN device. A
+ *          received frame is translated once and every further destination
+ *          gets an skb_clone() of it with only the device changed.
  */
-extern struct can_frame *ce_gw_alloc_can_frame(void);
+struct ce_gw_group {
+	struct hlist_node list;	/**< List entry of ce_gw_group_list */
+	struct rcu_head rcu;	/**< Lock monitor */
+	struct net_device *dev;	/**< CAN source device */
+	struct can_filter filter; /**< Filter of the CAN receiver */
+	ce_gw_xlat_fn xlat;	/**< Translation of all routes */
+	struct hlist_head jobs;	/**< Routes of the group (ce_gw_job.list_grp) */
+};
 
 /**
- * @fn void ce_gw_free_can_frame(struct can_frame *memory)
- * @brief frees memory allocated for can_frame
- * @param memory can frame that should be freed
- * @ingroup alloc
- * @todo not tested yet
+ * @struct ce_gw_eth_src
+ * @brief All ETH -> CAN routes of one physical ethernet device
+ * @details The CAN over ethernet frames (ETH_P_CAN, ETH_P_CANFD) of the
+ *          device are received with a packet_type handler directly from the
+ *          receive path of the NIC, no cegw device is needed in between.
  */
-extern void ce_gw_free_can_frame(struct can_frame *memory);
+struct ce_gw_eth_src {
+	struct hlist_node list;	/**< List entry of ce_gw_eth_src_list */
+	struct rcu_head rcu;	/**< Lock monitor */
+	struct net_device *dev;	/**< ethernet source device */
+	struct packet_type pt_can;   /**< receiver of ETH_P_CAN frames */
+	struct packet_type pt_canfd; /**< receiver of ETH_P_CANFD frames */
+	struct hlist_head jobs;	/**< Routes of the device (ce_gw_job.list_dev) */
+};
 
 /**
- * @fn struct canfd_frame *ce_gw_alloc_canfd_frame(void)
- * @brief allocates memory for a canfd frame
- * @return pointer to the memory allocated
- * @ingroup alloc
- * @todo not tested yet
+ * @struct ce_gw_job_cfg
+ * @brief Optional settings of a route for ce_gw_create_route()
+ * @details Fields which are 0 keep their default value.
  */
-extern struct canfd_frame *ce_gw_alloc_canfd_frame(void);
+struct ce_gw_job_cfg {
+	u32 tx_weight;		/**< Share of a CAN bus, see ce_gw_tx_route */
+	u8 hop_limit;		/**< Frames which already passed the gateway
+				 * this often are not forwarded (default 1) */
+	u32 reserve;		/**< Reserved sk_buffs of the route, used if
+				 * an allocation fails (default 0 = off) */
+	int defer_cpu;		/**< CPU of the worker of a route with the
+				 * #CE_GW_F_DEFER flag. Must be set, -1 for the
+				 * CPU which receives the frame */
+	u32 ring_records;	/**< Records of the capture ring of a route with
+				 * the #CE_GW_F_RING flag (default 0 = module
+				 * parameter ring_records) */
+	int bpf_fd;		/**< fd of a BPF_PROG_TYPE_SCHED_CLS program
+				 * run on every frame of the route. Must be
+				 * set, -1 for none */
+	struct ce_gw_mod *mod;	/**< Modifications of every frame, owned by
+				 * the route if it was created (default NULL) */
+	const u8 *change_mask;	/**< Compared bits of the data bytes with
+				 * #CE_GW_F_ON_CHANGE (default NULL = all) */
+	u32 change_mask_len;	/**< Length of change_mask */
+	u32 change_refresh;	/**< Forward unchanged frames of an ID at
+				 * least every change_refresh ms (default 0 =
+				 * never) */
+	u32 throttle_ms;	/**< Minimum interval between two frames of an
+				 * ID with #CE_GW_F_THROTTLE (default 0 = only
+				 * the IDs of throttle_ids are limited) */
+	const struct ce_gw_throttle_id *throttle_ids;
+				/**< Intervals of single IDs (default NULL) */
+	u32 n_throttle_ids;	/**< Number of throttle_ids */
+};
 
 /**
- * @fn void ce_gw_free_canfd_frame(struct canfd_frame *memory)
- * @brief frees memory allocated for can_frame
- * @param memory canfd_frame that should be freed
- * @ingroup alloc
- * @todo not tested yet
+ * @fn struct hlist_head *ce_gw_get_job_list(void);
+ * @brief getter for HLIST_HEAD(ce_gw_job_list)
+ * @returns Pointer to ce_gw_job_list.
  */
-extern void ce_gw_free_canfd_frame(struct canfd_frame *memory);
+struct hlist_head *ce_gw_get_job_list(void);
 
 /**
- * @fn struct can_frame *ce_gw_get_header_can(canid_t can_id, __u8 can_dlc,
- * __u8 *payload)
- * @brief builds a can header in SFF (standart frame format) or EFF
+ * @fn void ce_gw_get_header_can(struct can_frame *cf, canid_t can_id,
+ * __u8 can_dlc, const __u8 *payload)
+ * @brief builds a can frame in SFF (standart frame format) or EFF
  * (extended frame formate) with the given information
- * @param can_id_t identifier (11/29 bits) + error flag (0=data, 1= error) +
+ * @param cf The frame which is written, e.g. on the stack or in an sk_buff
+ * @param can_id identifier (11/29 bits) + error flag (0=data, 1= error) +
  *  remote transmission flag (1=rtr frame) + frame format flag (0=SFF, 1=EFF)
- * @param can_dlc data length code
- * @param payload data (maximum 64 bit in an 8*8 array)
+ * @param can_dlc data length code, at most 8
+ * @param payload data with at least param can_dlc bytes
  * @see include/linux/can.h
- * @retval can frame if successful
- * @retval NULL if unsuccessful
- * @todo not tested yet
  * @ingroup get
  */
-extern struct can_frame *ce_gw_get_header_can(canid_t can_id, __u8 can_dlc,
-  __u8 *payload);
+extern void ce_gw_get_header_can(struct can_frame *cf, canid_t can_id,
+                                 __u8 can_dlc, const __u8 *payload);
 
 /**
- * @fn struct canfd_frame *ce_gw_get_header_canfd(canid_t id, __u8 len, __u8
- * flags, __u8 res0, __u8 res1, __u8 *data)
+ * @fn void ce_gw_get_header_canfd(struct canfd_frame *cfd, canid_t id,
+ * __u8 len, __u8 flags, const __u8 *data)
  * @brief builds canfd_frame with the given information
+ * @param cfd The frame which is written, e.g. on the stack or in an sk_buff
  * @param id identifier: 32 bit (CAN_ID + EFF + RTR + ERR flag)
- * @param len frame payload length in byte
+ * @param len frame payload length in byte, at most 64
  * @param flags additional flags for CAN FD
- * @param res0 reserved / padding
- * @param res1 reserved / padding
- * @param data payload
- * @retval canfd frame if successful
- * @retval NULL if unsuccessful
- * @todo not tested yet
+ * @param data payload with at least param len bytes
  * @ingroup get
  */
-extern struct canfd_frame *ce_gw_get_header_canfd(canid_t id, __u8 len,
-  __u8 flags, __u8 res0, __u8 res1, __u8 *data);
+extern void ce_gw_get_header_canfd(struct canfd_frame *cfd, canid_t id,
+                                   __u8 len, __u8 flags, const __u8 *data);
 
 /**
  * @fn struct sk_buff *ce_gw_can_to_eth(unsigned char *dest, unsigned char
- * *source, __be16 type, struct sk_buff *can_buffer, struct net_device *dev)
+ * *source, __be16 type, struct sk_buff *can_buffer, struct net_device *dev,
+ * unsigned int headroom)
  * @brief converts sk buffer including can frame into sk buffer including
- * ethernet_frame
+ * ethernet_frame with the CAN data as payload
  * @param dest MAC address of destination
  * @param source MAC address of source
  * @param type type of layer3 message (example: ipv4 or ipv6 ...)
  * @param can_buffer sk buffer including a can frame
  * @param dev device of destination
+ * @param headroom additional headroom in front of the ethernet header
  * @retval sk_buffer on success including ethernet frame
  * @retval NULL if unsuccessful
+ * @details The returned sk_buff is the only allocation.
  * @ingroup trans
- * @todo not tested yet
  */
 extern struct sk_buff *ce_gw_can_to_eth(unsigned char *dest,
   unsigned char *source, __be16 type, struct sk_buff *can_buffer,
-  struct net_device *net);
+  struct net_device *dev, unsigned int headroom);
 
 /**
  * @fn struct sk_buff *ce_gw_canfd_to_eth(unsigned char *dest, unsigned char
- * *scource, __be16 type, struct sk_buff *canfd_skb, struct net_device *dev)
+ * *scource, __be16 type, struct sk_buff *canfd_skb, struct net_device *dev,
+ * unsigned int headroom)
  * @brief converts sk buffer including canfd frame into sk buffer including
- * ethernet frame
+ * ethernet frame with the CAN FD data as payload
  * @param dest MAC address of destination
  * @param source MAC address of source
  * @param type type of layer3 message (example: ipv4 or ipv6 ...)
  * @param canfd_skb sk buffer including a canfd_frame
  * @param dev device of the destination
+ * @param headroom additional headroom in front of the ethernet header
  * @retval sk_buff including ethernet frame if successful
  * @retval NULL if unsuccessful
+ * @details The returned sk_buff is the only allocation.
  * @ingroup trans
- * @todo not tested yet
  */
-extern struct sk_buff *ce_gw_canfd_to_eth(unsigned char *dest, unsigned char *source,
-                                   __be16 type, struct sk_buff *canfd_skb,
-                                   struct net_device *net);
+extern struct sk_buff *ce_gw_canfd_to_eth(unsigned char *dest,
+  unsigned char *source, __be16 type, struct sk_buff *canfd_skb,
+  struct net_device *dev, unsigned int headroom);
 
 /**
  * @fn struct sk_buff *ce_gw_eth_to_can(canid_t id, struct sk_buff *eth_buff,
- * struct net_device *dev)
+ * struct net_device *dev, unsigned int len)
  * @brief converst sk_buffer including an ethernet frame to sk_buffer
- * including a can_frame
- * @param id identifier of can_frame (see ce_gw_get_header for more information
- * @param eth_buff sk_buffer including an ethernet frame
+ * including a can_frame with the ethernet payload as data
+ * @param id identifier of can_frame (see ce_gw_get_header_can())
+ * @param eth_buff sk_buffer including an ethernet frame at skb->data
  * @param dev device of the destination
+ * @param len bytes of ethernet payload to copy, limited to 8 and to the
+ *        payload of param eth_buff
+ * @retval NULL if the allocation failed or eth_buff is too short
  * @return sk_buffer including a can frame
+ * @details The data is copied directly into the allocated CAN sk_buff.
  * @ingroup trans
- * @todo not tested yet
  */
-extern struct sk_buff *ce_gw_eth_to_can(canid_t id, struct sk_buff *eth_buff, struct
-                                 net_device *net);
+extern struct sk_buff *ce_gw_eth_to_can(canid_t id, struct sk_buff *eth_buff,
+                                        struct net_device *dev,
+                                        unsigned int len);
 
 /**
- * @fn struct sk_buff *ce_gw_eth_to_canfd(canid_t id, __u8 flags, __u8 res0,
- * __u8 res1, struct sk_buff *eth_skb, struct net_device *dev)
+ * @fn struct sk_buff *ce_gw_eth_to_canfd(canid_t id, __u8 flags,
+ * struct sk_buff *eth_skb, struct net_device *dev, unsigned int len)
  * @brief converst sk buffer including an ethernet frame to sk buffer
- * including a canfd frame
- * @param id identifier of canfd (see ce_gw_get_canfd_header for more
- * information)
+ * including a canfd frame with the ethernet payload as data
+ * @param id identifier of canfd (see ce_gw_get_header_canfd())
  * @param flags additional flags for CAN FD
- * @param res0 reserved / padding
- * @param res1 reserved / padding
- * @param eth_skb sk buffer including ethernet frame
+ * @param eth_skb sk buffer including ethernet frame at skb->data
  * @param dev device of the destination
+ * @param len bytes of ethernet payload to copy, limited to 64 and to the
+ *        payload of param eth_skb
+ * @retval NULL if the allocation failed or eth_skb is too short
  * @return sk buffer including canfd frame
+ * @details The data is copied directly into the allocated CAN FD sk_buff.
  * @ingroup trans
- * @todo not tested yet
  */
-extern struct sk_buff *ce_gw_eth_to_canfd(canid_t id, __u8 flags, __u8 res0, 
-  __u8 res1, struct sk_buff *eth_skb,
-  struct net_device *net);
+extern struct sk_buff *ce_gw_eth_to_canfd(canid_t id, __u8 flags,
+                                          struct sk_buff *eth_skb,
+                                          struct net_device *dev,
+                                          unsigned int len);
+
+/**
+ * @fn u8 ce_gw_skb_hops(struct sk_buff *skb)
+ * @brief Returns how often a frame was already forwarded by the gateway
+ * @param skb A CAN or ethernet frame
+ * @retval 0 the frame does not come from the gateway
+ * @ingroup trans
+ */
+extern u8 ce_gw_skb_hops(struct sk_buff *skb);
+
+/**
+ * @fn void ce_gw_job_rcv(struct sk_buff *skb, struct ce_gw_job *gwj)
+ * @brief Translates and forwards a frame of a single route, used by the
+ *        workers of routes with the #CE_GW_F_DEFER flag
+ * @param skb The received CAN or ETH frame, it is not consumed
+ * @param gwj The route
+ * @pre rcu_read_lock() must be held and bottom halves disabled
+ * @ingroup proc
+ */
+extern void ce_gw_job_rcv(struct sk_buff *skb, struct ce_gw_job *gwj);
+
+/**
+ * @fn struct ce_gw_job *ce_gw_job_find_rcu(u32 id)
+ * @brief Searches a route by its ID
+ * @param id ID of the route
+ * @retval NULL if there is no route with param id
+ * @pre rcu_read_lock() must be held as long as the route is used
+ * @ingroup get
+ */
+extern struct ce_gw_job *ce_gw_job_find_rcu(u32 id);
+
+/**
+ * @fn int ce_gw_job_inject(struct ce_gw_job *gwj,
+ *                          const struct canfd_frame *cfd, bool fd)
+ * @brief Sends a CAN frame from user space over an ETH -> CAN route like a
+ *        translated frame, through the queue and shaper of the route
+ * @param gwj The route
+ * @param cfd The frame, only the first CAN_MTU bytes if param fd is false
+ * @param fd true for a CAN FD frame, needs the #CE_GW_F_CAN_FD flag
+ * @return result of ce_gw_tx_send()
+ * @retval -EINVAL if the route has no CAN destination or the frame is invalid
+ * @retval -ENOMEM if the allocation failed
+ * @pre rcu_read_lock() must be held and bottom halves disabled
+ * @ingroup proc
+ */
+extern int ce_gw_job_inject(struct ce_gw_job *gwj,
+                            const struct canfd_frame *cfd, bool fd);
 
 /**
  * @fn void ce_gw_can_rcv(struct sk_buff *can_skb, void *data)
@@ -249,12 +446,10 @@ extern struct sk_buff *ce_gw_eth_to_canfd(canid_t id, __u8 flags, __u8 res0,
  *        Receive CAN frame --> process --> send to ETH dev
  *        (skbuffer, struct receiver->data)
  * @param can_skb CAN sk buffer which should be translated to an ETH packet
- * @param data gwjob which is responsible for triggering this function
+ * @param data struct ce_gw_group with the routes of the frame. The frame is
+ *        translated once with ce_gw_group.xlat and cloned for every further
+ *        route.
  * @ingroup proc
- * @todo check also for canfd flag not only Type and call function. You must
- * also check then if the message then is really a canfd-frame or not.
- * @todo call other translation functions. check for canfd-frame or only use
- * canfd-frame casts.
  */
 extern void ce_gw_can_rcv(struct sk_buff *can_skb, void *data);
 
@@ -264,21 +459,48 @@ extern void ce_gw_can_rcv(struct sk_buff *can_skb, void *data);
  *        Receive skb from ETH dev --> process --> send to CAN bus
  * @param eth_skb ETH sk buffer with CAN frame as payload. Exact location of CAN
  *        frame depends on translation type (see enum ce_gw_type)
- * @param data gwjob which is responsible for triggering this function
+ * @param data struct hlist_head with all routes of the ETH device
+ *        (ce_gw_job_info.job_src). The frame is translated once with
+ *        ce_gw_job.xlat and copied for every further route with the same
+ *        translation.
+ * @warning param eth_skb is not freed
+ * @pre rcu_read_lock() must be held
  * @ingroup proc
- * @todo check for canfd-frame or only use canfd-frame casts.
  */
 extern void ce_gw_eth_rcv(struct sk_buff *eth_skb, void *data);
 
+/**
+ * @fn int ce_gw_eth_rcv_buf(const u8 *data, unsigned int len, void *data)
+ * @brief The gateway function for ETH frames without sk_buff, e.g. from
+ *        XDP. Only for #CE_GW_TYPE_NET routes.
+ * @param data Ethernet frame with a CAN or CAN FD frame as payload
+ * @param len Length of param data
+ * @param jobs_data struct hlist_head with all routes of the ETH device
+ * @retval 0 if the frame was passed to the routes
+ * @retval -EPROTONOSUPPORT if the frame has no CAN or CAN FD frame
+ * @details The CAN frame is copied directly from param data into a CAN
+ *          sk_buff. Routes of other types are skipped. The hop limit is
+ *          checked like in ce_gw_eth_rcv(), the hops come from the
+ *          CAN -> ETH route whose frame was redirected with XDP. Routes with
+ *          the #CE_GW_F_DEFER flag get a copy of the ethernet frame in a
+ *          sk_buff for their worker.
+ * @pre rcu_read_lock() must be held
+ * @ingroup proc
+ */
+extern int ce_gw_eth_rcv_buf(const u8 *data, unsigned int len,
+                             void *jobs_data);
+
 /**
  * @fn static int ce_gw_create_route(void)
  * @brief ce_gw_create_route - adds new route from CAN <-> ETH
+ * @param cfg Optional settings of the route. NULL for default settings.
  * @ingroup alloc
  * @retval TODO
  * @todo: add some more params: @param ce_gw_type
  */
 extern int ce_gw_create_route(int src_ifindex, int dst_ifindex,
-                              enum ce_gw_type rt_type, u32 flags);
+                              enum ce_gw_type rt_type, u32 flags,
+                              const struct ce_gw_job_cfg *cfg);
 
 /**
  * @fn static int ce_gw_remove_route(int id)
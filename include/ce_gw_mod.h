@@ -0,0 +1,157 @@
+/**
+ * @file ce_gw_mod.h
+ * @brief Control Area Network - Ethernet - Gateway - Frame Modification Header
+ * @author Fabian Raab (fabian.raab@tum.de)
+ * @date May, 2013
+ * @copyright GNU Public License v3 or higher
+ * @ingroup files
+ * @details The netlink attributes and structs of the modifications are shared
+ *          with user space, this header can be included by cegwctl.
+ * @{
+ */
+
+/*****************************************************************************
+ * (C) Copyright 2013 Fabian Raab, Stefan Smarzly
+ *
+ * This file is part of CAN-Eth-GW.
+ *
+ * CAN-Eth-GW is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CAN-Eth-GW is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CAN-Eth-GW.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef __CE_GW_MOD_H__
+#define __CE_GW_MOD_H__
+
+#include <linux/types.h>
+#include <linux/can.h>
+
+/** ce_gw_mod_op.fields: modify the CAN ID (including the EFF/RTR/ERR flags) */
+#define CE_GW_MOD_ID 0x01
+/** ce_gw_mod_op.fields: modify the DLC (can_dlc / len) */
+#define CE_GW_MOD_DLC 0x02
+/** ce_gw_mod_op.fields: modify the data bytes */
+#define CE_GW_MOD_DATA 0x04
+
+/**
+ * @brief Netlink attributes nested in CE_GW_A_MOD
+ * @details The operations are applied in the order of the attributes. The
+ *          checksums are calculated after all operations.
+ */
+enum {
+	CE_GW_MOD_A_UNSPEC,	/**< Only a Dummy to skip index 0. */
+	CE_GW_MOD_A_AND,	/**< struct ce_gw_mod_op: field &= value */
+	CE_GW_MOD_A_OR,		/**< struct ce_gw_mod_op: field |= value */
+	CE_GW_MOD_A_XOR,	/**< struct ce_gw_mod_op: field ^= value */
+	CE_GW_MOD_A_SET,	/**< struct ce_gw_mod_op: field = value */
+	CE_GW_MOD_A_CSUM_XOR,	/**< struct ce_gw_mod_csum_xor */
+	CE_GW_MOD_A_CSUM_CRC8,	/**< struct ce_gw_mod_csum_crc8 */
+	__CE_GW_MOD_A_MAX,	/**< Maximum Number of Attribute + 1 */
+};
+#define CE_GW_MOD_A_MAX (__CE_GW_MOD_A_MAX - 1) /**< Maximum Number of Attr. */
+
+/**
+ * @struct ce_gw_mod_op
+ * @brief One AND/OR/XOR/SET operation
+ */
+struct ce_gw_mod_op {
+	struct canfd_frame cf;	/**< The values, only the fields are used */
+	__u8 fields;		/**< #CE_GW_MOD_ID, #CE_GW_MOD_DLC,
+				 * #CE_GW_MOD_DATA */
+};
+
+/**
+ * @struct ce_gw_mod_csum_xor
+ * @brief XOR of the data bytes from_idx to to_idx (including) and init_val
+ *        is written to the data byte result_idx
+ */
+struct ce_gw_mod_csum_xor {
+	__u8 from_idx;		/**< First data byte */
+	__u8 to_idx;		/**< Last data byte */
+	__u8 result_idx;	/**< Data byte of the checksum */
+	__u8 init_val;		/**< Start value */
+};
+
+/**
+ * @struct ce_gw_mod_csum_crc8
+ * @brief CRC8 (MSB first) of the data bytes from_idx to to_idx (including),
+ *        XORed with final_xor, is written to the data byte result_idx
+ */
+struct ce_gw_mod_csum_crc8 {
+	__u8 from_idx;		/**< First data byte */
+	__u8 to_idx;		/**< Last data byte */
+	__u8 result_idx;	/**< Data byte of the checksum */
+	__u8 init_val;		/**< Start value of the CRC */
+	__u8 final_xor;		/**< XORed with the CRC at the end */
+	__u8 poly;		/**< Polynomial, e.g. 0x1d for SAE J1850 */
+};
+
+#ifdef __KERNEL__
+
+#include <linux/skbuff.h>
+#include <linux/crc8.h>
+#include <net/netlink.h>
+
+/** Number of 64 bit words of a struct canfd_frame */
+#define CE_GW_MOD_WORDS (sizeof(struct canfd_frame) / sizeof(u64))
+
+/**
+ * @struct ce_gw_mod
+ * @brief The modifications of a route, compiled for ce_gw_mod_skb()
+ * @details All operations together are one AND and one XOR per 64 bit word of
+ *          the frame: frame = (frame & and) ^ xor. Only the words first to
+ *          last are changed by them.
+ */
+struct ce_gw_mod {
+	u64 and[CE_GW_MOD_WORDS];	/**< AND mask per word */
+	u64 xor[CE_GW_MOD_WORDS];	/**< XOR value per word */
+	u8 first;		/**< First changed word */
+	u8 last;		/**< Last changed word, < first if none */
+	u8 data_len;		/**< Data bytes the checksums need */
+	bool csum_xor;		/**< xor_csum is valid */
+	bool csum_crc8;		/**< crc8 is valid */
+	struct ce_gw_mod_csum_xor xor_csum;	/**< XOR checksum */
+	struct ce_gw_mod_csum_crc8 crc8;	/**< CRC8 checksum */
+	u8 crc8_table[CRC8_TABLE_SIZE];		/**< Table of crc8.poly */
+};
+
+/**
+ * @fn struct ce_gw_mod *ce_gw_mod_parse(const struct nlattr *nla, int *err)
+ * @brief Compiles the nested attributes of CE_GW_A_MOD
+ * @param nla The CE_GW_A_MOD attribute
+ * @param err Returns the error if NULL is returned
+ * @retval NULL on failure, -EINVAL for invalid attributes or -ENOMEM
+ * @return The modifications, to be freed with kfree()
+ * @ingroup trans
+ */
+extern struct ce_gw_mod *ce_gw_mod_parse(const struct nlattr *nla, int *err);
+
+/**
+ * @fn int ce_gw_mod_skb(const struct ce_gw_mod *mod, struct sk_buff *skb,
+ *                       unsigned int hlen)
+ * @brief Applies the modifications to a translated frame
+ * @param mod The modifications of the route
+ * @param skb The frame, a clone is copied first
+ * @param hlen Length of the header before the CAN frame
+ * @retval 0 on success
+ * @retval -ENOMEM if the clone could not be copied
+ * @retval -EINVAL if the frame is too short for the checksums
+ * @ingroup trans
+ */
+extern int ce_gw_mod_skb(const struct ce_gw_mod *mod, struct sk_buff *skb,
+                         unsigned int hlen);
+
+#endif /* __KERNEL__ */
+
+#endif
+
+/**@}*/
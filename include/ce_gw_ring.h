@@ -0,0 +1,162 @@
+/**
+ * @file ce_gw_ring.h
+ * @brief Control Area Network - Ethernet - Gateway - Capture Ring Header
+ * @author Fabian Raab (fabian.raab@tum.de)
+ * @date May, 2013
+ * @copyright GNU Public License v3 or higher
+ * @ingroup files
+ * @details The layout of the ring is shared with user space, this header
+ *          can be included by consumers.
+ * @{
+ */
+
+/*****************************************************************************
+ * (C) Copyright 2013 Fabian Raab, Stefan Smarzly
+ *
+ * This file is part of CAN-Eth-GW.
+ *
+ * CAN-Eth-GW is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CAN-Eth-GW is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CAN-Eth-GW.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef __CE_GW_RING_H__
+#define __CE_GW_RING_H__
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#include <linux/can.h>
+
+/** ce_gw_ring_hdr.version of this layout */
+#define CE_GW_RING_VERSION 1
+
+/** ce_gw_ring_rec.flags: the record holds a CAN FD frame */
+#define CE_GW_RING_REC_FD 0x00000001
+
+/**
+ * @struct ce_gw_ring_hdr
+ * @brief First page of the mmap()ed ring of a route
+ * @details The records start at data_offset. The record with the sequence
+ *          number n is at data_offset + (n % records) * rec_size. The
+ *          kernel writes the records and then head, a consumer reads the
+ *          records up to head and then writes tail. Both use
+ *          acquire/release ordering. If the ring is full the kernel drops
+ *          the frame and counts it in dropped. The kernel keeps its own
+ *          copy of head and dropped, writes of a consumer to them are
+ *          overwritten.
+ */
+struct ce_gw_ring_hdr {
+	__u32 version;		/**< #CE_GW_RING_VERSION */
+	__u32 records;		/**< Number of records, a power of 2 */
+	__u32 rec_size;		/**< Size of a record in bytes */
+	__u32 data_offset;	/**< Offset of the first record in bytes */
+	__u64 head;		/**< Sequence number of the next record, kernel */
+	__u64 dropped;		/**< Frames dropped because the ring was full */
+	__u64 tail __attribute__((aligned(64)));
+				/**< Sequence number of the next record the
+				 * consumer reads, written by the consumer */
+};
+
+/**
+ * @struct ce_gw_ring_rec
+ * @brief A received CAN or CAN FD frame in the ring
+ */
+struct ce_gw_ring_rec {
+	__u64 tstamp;		/**< Receive time in ns since the epoch */
+	__u32 ifindex;		/**< Index of the CAN source device */
+	__u32 flags;		/**< #CE_GW_RING_REC_FD */
+	struct canfd_frame frame; /**< The frame, a can_frame uses only the
+				   * first CAN_MTU bytes */
+};
+
+/**
+ * Signals an eventfd (__s32 file descriptor, -1 to remove it) when records
+ * arrive, see #CE_GW_RING_IOC_WAKEUP
+ */
+#define CE_GW_RING_IOC_EVENTFD _IOW('G', 0x10, __s32)
+
+/**
+ * Wakes a consumer only when at least this many records (__u32, 1 to
+ * records, default 1) are unread. poll() reports POLLIN from this number on
+ * and the eventfd is signalled at most once per this number of records.
+ */
+#define CE_GW_RING_IOC_WAKEUP _IOW('G', 0x11, __u32)
+
+#ifdef __KERNEL__
+
+#include <linux/skbuff.h>
+#include <linux/miscdevice.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/kref.h>
+
+/**
+ * @struct ce_gw_ring
+ * @brief Capture ring of a CAN -> ETH route with the #CE_GW_F_RING flag
+ * @details The ring is a character device /dev/cegw_ring<route id>. It is
+ *          freed when the route is removed and the last file is closed.
+ */
+struct ce_gw_ring {
+	struct ce_gw_ring_hdr *hdr; /**< vmalloc_user() memory of the ring */
+	void *data;		/**< First record */
+	size_t size;		/**< Size of the memory in bytes */
+	u32 mask;		/**< records - 1 */
+	u64 head;		/**< Next record, published in hdr->head */
+	u64 dropped;		/**< Published in hdr->dropped */
+	spinlock_t lock;	/**< Serializes the producers */
+	wait_queue_head_t wait;	/**< Consumers in poll() */
+	struct eventfd_ctx *efd; /**< Eventfd of the consumer, under lock */
+	u64 efd_head;		/**< head of the last eventfd signal */
+	u32 wakeup;		/**< Unread records which wake a consumer */
+	bool dead;		/**< The route was removed */
+	struct kref ref;	/**< Route and open files */
+	struct miscdevice misc;	/**< The character device */
+	char name[32];		/**< Name of the character device */
+};
+
+/**
+ * @fn struct ce_gw_ring *ce_gw_ring_create(u32 id, u32 records)
+ * @brief Allocates a ring and registers its character device
+ * @param id ID of the route, part of the device name
+ * @param records Number of records, rounded up to a power of 2. 0 for the
+ *        default of the module parameter ring_records.
+ * @retval NULL if the allocation or registration failed
+ * @ingroup alloc
+ */
+extern struct ce_gw_ring *ce_gw_ring_create(u32 id, u32 records);
+
+/**
+ * @fn void ce_gw_ring_destroy(struct ce_gw_ring *ring)
+ * @brief Unregisters the character device and drops the reference of the
+ *        route. Consumers get POLLHUP.
+ * @param ring The ring, may be NULL
+ * @pre No receiver may use the ring anymore (synchronize_rcu())
+ * @ingroup alloc
+ */
+extern void ce_gw_ring_destroy(struct ce_gw_ring *ring);
+
+/**
+ * @fn int ce_gw_ring_put(struct ce_gw_ring *ring, struct sk_buff *can_skb)
+ * @brief Copies a received CAN or CAN FD frame into the ring
+ * @param ring The ring of the route
+ * @param can_skb The received frame, it is not consumed
+ * @retval 0 on success
+ * @retval -ENOBUFS if the ring is full
+ * @ingroup proc
+ */
+extern int ce_gw_ring_put(struct ce_gw_ring *ring, struct sk_buff *can_skb);
+
+#endif /* __KERNEL__ */
+
+#endif
+
+/**@}*/
@@ -0,0 +1,155 @@
+/**
+ * @file ce_gw_skb.h
+ * @brief Control Area Network - Ethernet - Gateway - Frame Allocation Header
+ * @author Fabian Raab (fabian.raab@tum.de)
+ * @date May, 2013
+ * @copyright GNU Public License v3 or higher
+ * @ingroup files
+ * @{
+ */
+
+/*****************************************************************************
+ * (C) Copyright 2013 Fabian Raab, Stefan Smarzly
+ *
+ * This file is part of CAN-Eth-GW.
+ *
+ * CAN-Eth-GW is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CAN-Eth-GW is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CAN-Eth-GW.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef __CE_GW_SKB_H__
+#define __CE_GW_SKB_H__
+
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/mempool.h>
+#include <linux/workqueue.h>
+#include <linux/can.h>
+
+/**
+ * @struct ce_gw_skb_reserve
+ * @brief Reserve of sk_buffs of a route for allocations under memory
+ *        pressure
+ * @details The reserve is a mempool of sk_buffs large enough for every
+ *          translated frame. Frames taken from it are consumed by the stack
+ *          like any other frame, so the pool is refilled by a work item with
+ *          GFP_KERNEL allocations.
+ */
+struct ce_gw_skb_reserve {
+	mempool_t *pool;	/**< sk_buffs of the reserve, NULL if off */
+	struct work_struct refill; /**< Refills the pool in process context */
+	u32 hits;		/**< Frames allocated from the reserve */
+	u32 empty;		/**< Frames dropped with an empty reserve */
+};
+
+/**
+ * @fn int ce_gw_skb_init(void)
+ * @brief Creates the per CPU page pools of the frame allocator
+ * @retval 0 on success
+ * @retval -ENOMEM if a page pool could not be created
+ * @ingroup alloc
+ */
+extern int ce_gw_skb_init(void);
+
+/**
+ * @fn void ce_gw_skb_exit(void)
+ * @brief Destroys the per CPU page pools. Pages of frames which are still
+ *        in use are released when the frames are freed.
+ * @ingroup alloc
+ */
+extern void ce_gw_skb_exit(void);
+
+/**
+ * @fn struct sk_buff *ce_gw_skb_alloc(struct net_device *dev,
+ *                                     unsigned int len)
+ * @brief Allocates a small sk_buff for a translated frame, a replacement of
+ *        netdev_alloc_skb()
+ * @param dev The device which will receive or send the frame
+ * @param len Bytes of data the sk_buff must hold
+ * @retval NULL if the allocation failed
+ * @return empty sk_buff with at least param len bytes of tailroom
+ * @details In softirq context the data is taken from a page pool of the
+ *          current CPU with napi_build_skb(). The sk_buff is marked for
+ *          recycling, so its page fragment goes back into the pool when the
+ *          stack frees the frame. Otherwise, before Linux 5.15 or with the
+ *          module parameter skb_cache=0 netdev_alloc_skb() is used.
+ * @ingroup alloc
+ */
+extern struct sk_buff *ce_gw_skb_alloc(struct net_device *dev,
+                                       unsigned int len);
+
+/**
+ * @fn void ce_gw_skb_reserve_init(struct ce_gw_skb_reserve *res)
+ * @brief Initializes a disabled reserve
+ * @param res The reserve
+ * @ingroup alloc
+ */
+extern void ce_gw_skb_reserve_init(struct ce_gw_skb_reserve *res);
+
+/**
+ * @fn int ce_gw_skb_reserve_create(struct ce_gw_skb_reserve *res,
+ *                                  unsigned int frames)
+ * @brief Fills the reserve with param frames sk_buffs
+ * @param res The reserve, initialized by ce_gw_skb_reserve_init()
+ * @param frames Size of the reserve, 0 keeps it disabled
+ * @retval 0 on success
+ * @retval -ENOMEM if the reserve could not be filled
+ * @ingroup alloc
+ */
+extern int ce_gw_skb_reserve_create(struct ce_gw_skb_reserve *res,
+                                    unsigned int frames);
+
+/**
+ * @fn void ce_gw_skb_reserve_destroy(struct ce_gw_skb_reserve *res)
+ * @brief Stops the refill and frees all sk_buffs of the reserve
+ * @param res The reserve
+ * @pre No receiver may use the reserve anymore (synchronize_rcu())
+ * @ingroup alloc
+ */
+extern void ce_gw_skb_reserve_destroy(struct ce_gw_skb_reserve *res);
+
+/**
+ * @fn struct sk_buff *ce_gw_skb_reserve_alloc(struct ce_gw_skb_reserve *res,
+ *                                            struct net_device *dev,
+ *                                            unsigned int len)
+ * @brief Fallback of ce_gw_skb_alloc() if the normal allocation failed
+ * @param res The reserve of the route, may be disabled
+ * @param dev The device of the frame
+ * @param len Bytes of data the sk_buff must hold
+ * @retval NULL if the reserve is disabled or empty
+ * @return empty sk_buff like netdev_alloc_skb()
+ * @ingroup alloc
+ */
+extern struct sk_buff *ce_gw_skb_reserve_alloc(struct ce_gw_skb_reserve *res,
+                                               struct net_device *dev,
+                                               unsigned int len);
+
+/**
+ * @fn struct sk_buff *ce_gw_skb_reserve_can(struct ce_gw_skb_reserve *res,
+ *                                          struct net_device *dev,
+ *                                          struct can_frame **cf)
+ * @brief Fallback of alloc_can_skb() if the normal allocation failed
+ * @param res The reserve of the route, may be disabled
+ * @param dev The CAN device of the frame
+ * @param cf Returns the zeroed CAN frame in the sk_buff
+ * @retval NULL if the reserve is disabled or empty
+ * @return sk_buff prepared like by alloc_can_skb()
+ * @ingroup alloc
+ */
+extern struct sk_buff *ce_gw_skb_reserve_can(struct ce_gw_skb_reserve *res,
+                                             struct net_device *dev,
+                                             struct can_frame **cf);
+
+#endif
+
+/**@}*/
@@ -0,0 +1,163 @@
+/**
+ * @file ce_gw_snap.h
+ * @brief Control Area Network - Ethernet - Gateway - Last Value Snapshot Header
+ * @author Fabian Raab (fabian.raab@tum.de)
+ * @date May, 2013
+ * @copyright GNU Public License v3 or higher
+ * @ingroup files
+ * @details The layout of the table is shared with user space, this header
+ *          can be included by readers.
+ * @{
+ */
+
+/*****************************************************************************
+ * (C) Copyright 2013 Fabian Raab, Stefan Smarzly
+ *
+ * This file is part of CAN-Eth-GW.
+ *
+ * CAN-Eth-GW is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CAN-Eth-GW is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CAN-Eth-GW.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef __CE_GW_SNAP_H__
+#define __CE_GW_SNAP_H__
+
+#include <linux/types.h>
+#include <linux/can.h>
+
+/** ce_gw_snap_hdr.version of this layout */
+#define CE_GW_SNAP_VERSION 1
+
+/** ce_gw_snap_ent.flags: the entry holds a CAN FD frame */
+#define CE_GW_SNAP_ENT_FD 0x00000001
+
+/**
+ * @struct ce_gw_snap_hdr
+ * @brief First page of the mmap()ed snapshot table of a CAN device
+ * @details The entries start at data_offset, each is ent_size bytes. The SFF
+ *          ID n is the entry n. The EFF IDs share the entries sff_entries up
+ *          to entries - 1 (jhash_1word(id, 0) modulo their number), the ID
+ *          of such an entry is in its frame.
+ */
+struct ce_gw_snap_hdr {
+	__u32 version;		/**< #CE_GW_SNAP_VERSION */
+	__u32 entries;		/**< Number of entries */
+	__u32 sff_entries;	/**< Number of SFF entries (2048) */
+	__u32 ent_size;		/**< Size of an entry in bytes */
+	__u32 data_offset;	/**< Offset of the first entry in bytes */
+	__u32 ifindex;		/**< Index of the CAN device */
+	__u64 updates;		/**< Number of received frames */
+};
+
+/**
+ * @struct ce_gw_snap_ent
+ * @brief The last received frame of a CAN ID
+ * @details seq is odd while the kernel writes the entry and 0 if the ID was
+ *          never received. A reader copies the entry between two reads of an
+ *          even seq with acquire ordering and retries if seq changed.
+ */
+struct ce_gw_snap_ent {
+	__u32 seq;		/**< Sequence count of the entry */
+	__u32 flags;		/**< #CE_GW_SNAP_ENT_FD */
+	__u64 tstamp;		/**< Receive time in ns since the epoch */
+	__u64 count;		/**< Updates of the entry */
+	struct canfd_frame frame; /**< The frame, a can_frame uses only the
+				   * first CAN_MTU bytes */
+};
+
+#ifdef __KERNEL__
+
+#include <linux/skbuff.h>
+#include <linux/miscdevice.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/kref.h>
+#include <linux/netdevice.h>
+
+/**
+ * @struct ce_gw_snap
+ * @brief Last value table of a CAN source device
+ * @details All routes of a device with the #CE_GW_F_SNAPSHOT flag share the
+ *          table. It has its own CAN receiver for all frames of the device,
+ *          so each frame updates it once. It is a character device
+ *          /dev/cegw_snap_<device name> and can be read with CE_GW_C_SNAP
+ *          over netlink. It is freed when the last route is removed and the
+ *          last file is closed.
+ */
+struct ce_gw_snap {
+	struct list_head list;	/**< Entry of the list of all tables */
+	int ifindex;		/**< Index of the CAN device */
+	struct net_device *dev;	/**< The CAN device of the receiver */
+	unsigned int routes;	/**< Routes which use the table */
+	struct ce_gw_snap_hdr *hdr; /**< vmalloc_user() memory of the table */
+	void *data;		/**< First entry */
+	size_t size;		/**< Size of the memory in bytes */
+	u32 eff_mask;		/**< Number of EFF entries - 1 */
+	spinlock_t lock;	/**< Serializes the writers */
+	struct kref ref;	/**< Routes and open files */
+	struct miscdevice misc;	/**< The character device */
+	char name[32];		/**< Name of the character device */
+};
+
+/**
+ * @fn struct ce_gw_snap *ce_gw_snap_get(struct net_device *dev)
+ * @brief Returns the table of a CAN device, which is created with its
+ *        character device for the first route
+ * @param dev The CAN source device of the route
+ * @retval NULL if the allocation or registration failed
+ * @pre Serialized with ce_gw_snap_put() and ce_gw_snap_find() (genl_mutex)
+ * @ingroup alloc
+ */
+extern struct ce_gw_snap *ce_gw_snap_get(struct net_device *dev);
+
+/**
+ * @fn void ce_gw_snap_put(struct ce_gw_snap *snap)
+ * @brief Drops the reference of a route. The receiver and the character
+ *        device are removed with the last route.
+ * @param snap The table, may be NULL
+ * @pre The route still holds its reference of the CAN device
+ * @ingroup alloc
+ */
+extern void ce_gw_snap_put(struct ce_gw_snap *snap);
+
+/**
+ * @fn struct ce_gw_snap *ce_gw_snap_find(int ifindex)
+ * @brief Searches the table of a CAN device
+ * @param ifindex Index of the device
+ * @retval NULL if no route of the device has the #CE_GW_F_SNAPSHOT flag
+ * @ingroup proc
+ */
+extern struct ce_gw_snap *ce_gw_snap_find(int ifindex);
+
+/**
+ * @fn unsigned int ce_gw_snap_read(struct ce_gw_snap *snap, u32 *pos,
+ *                                  struct ce_gw_snap_ent *ents,
+ *                                  unsigned int n)
+ * @brief Copies consistent received entries of the table
+ * @param snap The table
+ * @param pos First entry to look at, returns the entry after the last copy
+ * @param ents Buffer for the entries
+ * @param n Size of param ents in entries
+ * @return Number of copied entries, 0 at the end of the table
+ * @details Entries of IDs which were never received are skipped.
+ * @ingroup proc
+ */
+extern unsigned int ce_gw_snap_read(struct ce_gw_snap *snap, u32 *pos,
+                                    struct ce_gw_snap_ent *ents,
+                                    unsigned int n);
+
+#endif /* __KERNEL__ */
+
+#endif
+
+/**@}*/
@@ -0,0 +1,313 @@
+/**
+ * @file ce_gw_tx.h
+ * @brief Control Area Network - Ethernet - Gateway - CAN Transmission Header
+ * @author Fabian Raab (fabian.raab@tum.de)
+ * @date May, 2013
+ * @copyright GNU Public License v3 or higher
+ * @ingroup files
+ * @{
+ */
+
+/*****************************************************************************
+ * (C) Copyright 2013 Fabian Raab, Stefan Smarzly
+ *
+ * This file is part of CAN-Eth-GW.
+ *
+ * CAN-Eth-GW is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CAN-Eth-GW is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CAN-Eth-GW.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef __CE_GW_TX_H__
+#define __CE_GW_TX_H__
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/spinlock.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>	/* tasklet */
+#include <linux/atomic.h>
+
+struct ce_gw_job;
+
+/** ce_gw_tx_send(): the frame was queued and will be sent later */
+#define CE_GW_TX_QUEUED 1
+
+/**
+ * @enum ce_gw_tx_policy
+ * @brief What happens with a frame if the queue of struct ce_gw_tx is full
+ */
+enum ce_gw_tx_policy {
+	CE_GW_TX_DROP_NEWEST, /**< Drop the new frame (tail drop) */
+	CE_GW_TX_DROP_OLDEST, /**< Drop the oldest queued frame (head drop) */
+	__CE_GW_TX_DROP_MAX,  /**< Maximum Policy Number + 1 */
+};
+#define CE_GW_TX_DROP_MAX (__CE_GW_TX_DROP_MAX - 1) /**< Maximum Policy */
+
+/**
+ * @enum ce_gw_tx_sched
+ * @brief In which order queued frames are sent to the CAN device
+ */
+enum ce_gw_tx_sched {
+	CE_GW_TX_SCHED_FIFO,	/**< Arrival order */
+	CE_GW_TX_SCHED_PRIO_ID,	/**< Lowest CAN ID first, like CAN arbitration.
+				 * Frames of all routes are queued. */
+	CE_GW_TX_SCHED_PRIO_SKB, /**< Highest skb->priority first, arrival order
+				  * within one priority. Frames of all routes
+				  * are queued. */
+	CE_GW_TX_SCHED_DRR,	/**< Deficit round robin over the routes, see
+				 * struct ce_gw_tx_route. Frames of all routes
+				 * are queued. */
+	__CE_GW_TX_SCHED_MAX,	/**< Maximum Scheduler Number + 1 */
+};
+#define CE_GW_TX_SCHED_MAX (__CE_GW_TX_SCHED_MAX - 1) /**< Maximum Scheduler */
+
+/** Number of priority bands of struct ce_gw_tx */
+#define CE_GW_TX_BANDS 16
+
+/** ce_gw_tx_cfg.valid: max_frames is set */
+#define CE_GW_TX_CFG_LEN	0x01
+/** ce_gw_tx_cfg.valid: max_bytes is set */
+#define CE_GW_TX_CFG_MEM	0x02
+/** ce_gw_tx_cfg.valid: policy is set */
+#define CE_GW_TX_CFG_POLICY	0x04
+/** ce_gw_tx_cfg.valid: sched is set */
+#define CE_GW_TX_CFG_SCHED	0x08
+/** ce_gw_tx_cfg.valid: quantum is set */
+#define CE_GW_TX_CFG_QUANTUM	0x10
+/** ce_gw_tx_cfg.valid: load_max is set */
+#define CE_GW_TX_CFG_LOAD	0x20
+/** ce_gw_tx_cfg.valid: bitrate is set */
+#define CE_GW_TX_CFG_BITRATE	0x40
+/** ce_gw_tx_cfg.valid: dbitrate is set */
+#define CE_GW_TX_CFG_DBITRATE	0x80
+
+/**
+ * @struct ce_gw_tx_cfg
+ * @brief Settings of a CAN destination for ce_gw_tx_configure()
+ */
+struct ce_gw_tx_cfg {
+	u32 valid;		/**< Which fields are set (CE_GW_TX_CFG_*) */
+	u32 max_frames;		/**< Maximum number of queued frames */
+	u32 max_bytes;		/**< Maximum memory of queued frames */
+	enum ce_gw_tx_policy policy; /**< Overflow policy */
+	enum ce_gw_tx_sched sched;   /**< Order of queued frames */
+	u32 quantum;		/**< Bytes per round of #CE_GW_TX_SCHED_DRR */
+	u32 load_max;		/**< Maximum bus load in percent, 0 = off */
+	u32 bitrate;		/**< Nominal bitrate, 0 = from the CAN device */
+	u32 dbitrate;		/**< CAN FD data bitrate, 0 = like bitrate */
+};
+
+/**
+ * @struct ce_gw_tx_route
+ * @brief Transmission state of one route in struct ce_gw_tx
+ * @details With #CE_GW_TX_SCHED_DRR every route has its own queue. Each round
+ *          a route with queued frames gets quantum * weight bytes of credit
+ *          (deficit) and may send frames as long as the credit lasts. So all
+ *          routes to a busy CAN device get a share of the bus according to
+ *          their weight, independent of how many frames they produce.
+ *          The statistics are kept with every scheduler.
+ */
+struct ce_gw_tx_route {
+	struct sk_buff_head queue; /**< Frames of the route (only DRR) */
+	struct list_head active; /**< Entry of ce_gw_tx.active (only DRR) */
+	u32 weight;		/**< Share of the route, multiplies quantum */
+	u32 deficit;		/**< Bytes the route may still send this round */
+
+	u32 queue_frames;	/**< Currently queued frames of the route */
+	u32 queue_frames_max;	/**< Maximum of queue_frames */
+	u64 wait_ns;		/**< Sum of the time queued frames waited */
+	u32 wait_frames;	/**< Number of frames in wait_ns */
+	u32 wait_max_ns;	/**< Maximum time a frame waited */
+};
+
+/**
+ * @struct ce_gw_tx
+ * @brief Transmission state of one CAN destination device
+ * @details All routes from a cegw device to the same CAN device share one
+ *          struct ce_gw_tx. Routes with the #CE_GW_F_TX_QUEUE flag don't drop
+ *          frames if the CAN device is busy, but hold them in queue. The queue
+ *          is drained in the tasklet as soon as the CAN device can send again.
+ *          Because there is no notification when the CAN driver wakes its
+ *          queue, the hrtimer polls the device while frames are pending.
+ *          The queue consists of #CE_GW_TX_BANDS bands, lower bands are sent
+ *          first. With #CE_GW_TX_SCHED_FIFO only band 0 is used. With FIFO
+ *          and #CE_GW_TX_SCHED_PRIO_ID frames with the same CAN ID stay in
+ *          the same band in arrival order, so their order is kept. With
+ *          #CE_GW_TX_SCHED_PRIO_SKB the order is only kept for the same CAN
+ *          ID and skb->priority, with #CE_GW_TX_SCHED_DRR only for the same
+ *          CAN ID and route.
+ *          Every frame costs bus time depending on its bits on the wire and
+ *          the bitrates of the CAN device. With load_max set, a token bucket
+ *          of bus time limits the frames passed to the CAN device to this
+ *          share of the bus and all other frames are queued.
+ */
+struct ce_gw_tx {
+	struct hlist_node list;	/**< List entry of ce_gw_tx_list */
+	struct net_device *dev;	/**< CAN destination device */
+	unsigned int users;	/**< Number of routes using this struct */
+
+	spinlock_t lock;	/**< Protects queue and serializes can_send() */
+	struct sk_buff_head bands[CE_GW_TX_BANDS]; /**< Frames waiting for the
+						    * CAN device */
+	unsigned long bands_used; /**< Bitmap of non empty bands */
+	u32 queue_frames;	/**< Number of frames in all bands */
+	u32 queue_bytes;	/**< Sum of truesize of all frames in all bands */
+	u32 max_frames;		/**< Maximum number of frames in queue */
+	u32 max_bytes;		/**< Maximum memory of all frames in queue */
+	enum ce_gw_tx_policy policy; /**< Overflow policy of queue */
+	enum ce_gw_tx_sched sched;   /**< Order of queued frames */
+	struct list_head active; /**< Routes with queued frames (only DRR) */
+	u32 quantum;		/**< Bytes per round and weight (only DRR) */
+
+	bool has_bittiming;	/**< dev has a struct can_priv with bitrates */
+	u32 bitrate;		/**< Configured nominal bitrate, 0 = from dev */
+	u32 dbitrate;		/**< Configured data bitrate, 0 = from dev */
+	u32 load_max;		/**< Maximum bus load in percent, 0 = no shaper */
+	s64 tokens;		/**< Bus time in ns the shaper may still use */
+	u64 tokens_ts;		/**< Time of the last refill of tokens in ns */
+	atomic64_t load_busy_ns; /**< Bus time of the frames sent in the
+				  * current load window in ns */
+	atomic64_t load_ts;	/**< Start of the current load window in ns */
+	u32 load;		/**< Bus load in percent of the last window */
+
+	unsigned int gw_rcv;	/**< CAN receivers of the gateway on dev */
+	u8 gw_hop_limit;	/**< Highest hop limit of their routes */
+
+	struct hrtimer timer;	/**< Polls the CAN device while queue is used */
+	struct tasklet_struct tasklet; /**< Drains queue into the CAN device */
+
+	u32 queued_frames;	/**< counter for frames which had to wait */
+	u32 overflow_frames;	/**< counter for frames dropped by a full queue */
+};
+
+/**
+ * @fn struct ce_gw_tx *ce_gw_tx_get(struct net_device *can_dev)
+ * @brief Returns the transmission state of a CAN device and allocates it if
+ *        it not exists.
+ * @param can_dev CAN destination device of a route
+ * @retval NULL if allocation failed
+ * @return the struct ce_gw_tx of param can_dev with one more user
+ * @see ce_gw_tx_put() must be called if the route is removed.
+ * @ingroup tx
+ */
+extern struct ce_gw_tx *ce_gw_tx_get(struct net_device *can_dev);
+
+/**
+ * @fn void ce_gw_tx_route_init(struct ce_gw_tx_route *txr, u32 weight)
+ * @brief Initialises the transmission state of a route
+ * @param txr The transmission state in struct ce_gw_job
+ * @param weight Share of the route with #CE_GW_TX_SCHED_DRR (0 = default 1)
+ * @ingroup tx
+ */
+extern void ce_gw_tx_route_init(struct ce_gw_tx_route *txr, u32 weight);
+
+/**
+ * @fn void ce_gw_tx_route_stats(struct ce_gw_job *job, u32 *depth,
+ *                               u32 *wait_avg_us, u32 *wait_max_us)
+ * @brief Reads the queue statistics of a route
+ * @param job The route. job->tx must be set.
+ * @param depth Returns the number of currently queued frames
+ * @param wait_avg_us Returns the average time queued frames waited
+ * @param wait_max_us Returns the maximum time a queued frame waited
+ * @ingroup tx
+ */
+extern void ce_gw_tx_route_stats(struct ce_gw_job *job, u32 *depth,
+                                 u32 *wait_avg_us, u32 *wait_max_us);
+
+/**
+ * @fn u32 ce_gw_tx_load(struct ce_gw_tx *tx)
+ * @brief Returns the bus load the gateway puts on a CAN device
+ * @param tx The transmission state of the CAN device
+ * @return bus load in percent of the last window of 100 ms the sent frames
+ *         closed, or of the current window if no frame closed it for longer
+ *         than a window. 0 if the bitrate of the CAN device is unknown.
+ * @details Only frames sent by the gateway are counted, not the frames of
+ *          other nodes on the bus. The load is maintained in the transmit
+ *          path, reading it does not change it.
+ * @ingroup tx
+ */
+extern u32 ce_gw_tx_load(struct ce_gw_tx *tx);
+
+/**
+ * @fn void ce_gw_tx_gw_rcv(struct net_device *can_dev, unsigned int rcv,
+ *                          u8 hop_limit)
+ * @brief Tells the transmission state of a CAN device about the CAN -> ETH
+ *        routes of the gateway which receive from it
+ * @param can_dev The CAN device
+ * @param rcv Number of can_rx_register() receivers of the gateway on it
+ * @param hop_limit Highest hop limit of the routes of these receivers
+ * @details Nothing happens if no route sends to the device.
+ * @pre Serialized with ce_gw_tx_get() and ce_gw_tx_put() (genl_mutex)
+ * @ingroup tx
+ */
+extern void ce_gw_tx_gw_rcv(struct net_device *can_dev, unsigned int rcv,
+                            u8 hop_limit);
+
+/**
+ * @fn void ce_gw_tx_put(struct ce_gw_tx *tx, struct ce_gw_job *job)
+ * @brief Drops all queued frames of a route and releases the transmission
+ *        state. The state is freed after its last user is gone.
+ * @param tx The transmission state returned by ce_gw_tx_get()
+ * @param job The route which is removed
+ * @ingroup tx
+ */
+extern void ce_gw_tx_put(struct ce_gw_tx *tx, struct ce_gw_job *job);
+
+/**
+ * @fn int ce_gw_tx_check(const struct ce_gw_tx_cfg *cfg)
+ * @brief Checks the settings of a CAN destination device
+ * @param cfg the settings, only fields marked in cfg->valid are checked
+ * @retval 0 if ce_gw_tx_configure() accepts them
+ * @retval -EINVAL invalid setting
+ * @ingroup tx
+ */
+extern int ce_gw_tx_check(const struct ce_gw_tx_cfg *cfg);
+
+/**
+ * @fn int ce_gw_tx_configure(int ifindex, const struct ce_gw_tx_cfg *cfg)
+ * @brief Sets the queue settings of a CAN destination device
+ * @param ifindex interface index of the CAN destination device
+ * @param cfg the new settings. Only fields marked in cfg->valid are changed.
+ * @details If the scheduler is changed the queued frames are sorted again.
+ * @pre a route with the CAN device as destination must exist
+ * @retval 0 on success
+ * @retval -ENODEV no route uses the device as destination
+ * @retval -EINVAL invalid setting
+ * @ingroup tx
+ */
+extern int ce_gw_tx_configure(int ifindex, const struct ce_gw_tx_cfg *cfg);
+
+/**
+ * @fn int ce_gw_tx_send(struct ce_gw_job *job, struct sk_buff *can_skb)
+ * @brief Sends a CAN frame of a route to its CAN destination device
+ * @param job The route of the frame. job->tx must be set.
+ * @param can_skb The CAN frame
+ * @details Without #CE_GW_F_TX_QUEUE flag in job, with the
+ *          #CE_GW_TX_SCHED_FIFO scheduler and without shaper the frame is
+ *          passed directly to can_send(). Otherwise the frame is queued if the CAN device is
+ *          busy or other frames are already waiting.
+ * @warning param can_skb is always consumed, also on failure.
+ * @retval 0 the frame was sent
+ * @retval CE_GW_TX_QUEUED the frame was queued and will be sent later
+ * @retval <0 the frame was dropped
+ * @ingroup tx
+ */
+extern int ce_gw_tx_send(struct ce_gw_job *job, struct sk_buff *can_skb);
+
+#endif
+
+/**@}*/
@@ -0,0 +1,302 @@
+/**
+ * @file ce_gw_defer.c
+ * @brief Control Area Network - Ethernet - Gateway - Deferred Processing
+ * @author Fabian Raab (fabian.raab@tum.de)
+ * @date May, 2013
+ * @copyright GNU Public License v3 or higher
+ * @ingroup files
+ * @{
+ */
+
+/*****************************************************************************
+ * (C) Copyright 2013 Fabian Raab, Stefan Smarzly
+ *
+ * This file is part of CAN-Eth-GW.
+ *
+ * CAN-Eth-GW is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CAN-Eth-GW is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CAN-Eth-GW.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/rcupdate.h>
+#include <linux/skbuff.h>
+#include "ce_gw_main.h"
+#include "ce_gw_defer.h"
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,12,0)
+#define CE_GW_DEFER_RING
+#include <linux/ptr_ring.h>
+#include <linux/cpuhotplug.h>
+#endif
+
+#include <asm-generic/errno-base.h>
+#include <asm-generic/errno.h>
+
+static unsigned int defer_ring = 1024;
+module_param(defer_ring, uint, S_IRUGO);
+MODULE_PARM_DESC(defer_ring, "Frames per ring of the deferred processing "
+                 "workers (default 1024)");
+
+/** Maximum number of frames a worker takes from its ring at once */
+#define CE_GW_DEFER_BATCH 16
+
+/**
+ * @struct ce_gw_defer_cb
+ * @brief Control buffer of a frame on a ring
+ * @details The frame on the ring is a clone, so skb->cb is free.
+ */
+struct ce_gw_defer_cb {
+	struct ce_gw_job *job;	/**< Route of the frame */
+};
+#define CE_GW_DEFER_CB(skb) ((struct ce_gw_defer_cb *)(skb)->cb)
+
+#ifdef CE_GW_DEFER_RING
+/**
+ * @struct ce_gw_defer_worker
+ * @brief Worker thread of a CPU with its ring of frames
+ */
+struct ce_gw_defer_worker {
+	struct ptr_ring ring;	/**< Queued frames, many producers */
+	struct task_struct *task; /**< Thread bound to the CPU */
+};
+
+static DEFINE_PER_CPU(struct ce_gw_defer_worker, ce_gw_defer_workers);
+static bool ce_gw_defer_running;
+static int ce_gw_defer_hp;	/**< Dynamic CPU hotplug state of the workers */
+
+/**
+ * @fn static int ce_gw_defer_thread(void *data)
+ * @brief Main loop of a worker, processes the frames of its ring in batches
+ * @param data struct ce_gw_defer_worker of the CPU
+ * @ingroup defer
+ */
+static int ce_gw_defer_thread(void *data)
+{
+	struct ce_gw_defer_worker *w = (struct ce_gw_defer_worker *) data;
+	void *batch[CE_GW_DEFER_BATCH];
+	struct ce_gw_job *job;
+	struct sk_buff *skb;
+	int i, n;
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (ptr_ring_empty_bh(&w->ring)) {
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
+		n = ptr_ring_consume_batched_bh(&w->ring, batch,
+		                                CE_GW_DEFER_BATCH);
+
+		/* same context as the receive functions */
+		local_bh_disable();
+		rcu_read_lock();
+		for (i = 0; i < n; i++) {
+			skb = (struct sk_buff *) batch[i];
+			job = CE_GW_DEFER_CB(skb)->job;
+			ce_gw_job_rcv(skb, job);
+			consume_skb(skb);
+			smp_mb__before_atomic();
+			atomic_dec(&job->deferred);
+		}
+		rcu_read_unlock();
+		local_bh_enable();
+
+		cond_resched();
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+/**
+ * @fn static void ce_gw_defer_free(void *ptr)
+ * @brief Frees a frame which is still on a ring when the worker stops
+ * @ingroup defer
+ */
+static void ce_gw_defer_free(void *ptr)
+{
+	kfree_skb((struct sk_buff *) ptr);
+}
+
+/**
+ * @fn static int ce_gw_defer_online(unsigned int cpu)
+ * @brief Creates the ring and the worker of a CPU which comes online
+ * @param cpu The CPU
+ * @retval 0 on success
+ * @retval -ENOMEM if the ring could not be created
+ * @retval <0 if the worker could not be created
+ * @details The worker of a CPU which went offline keeps running on another
+ *          CPU and is bound to its CPU again.
+ * @ingroup defer
+ */
+static int ce_gw_defer_online(unsigned int cpu)
+{
+	struct ce_gw_defer_worker *w = per_cpu_ptr(&ce_gw_defer_workers, cpu);
+	struct task_struct *task;
+
+	if (w->task != NULL) {
+		set_cpus_allowed_ptr(w->task, cpumask_of(cpu));
+		return 0;
+	}
+
+	if (ptr_ring_init(&w->ring, defer_ring, GFP_KERNEL) != 0)
+		return -ENOMEM;
+
+	task = kthread_create_on_node(ce_gw_defer_thread, w, cpu_to_node(cpu),
+	                              "ce_gw/%d", cpu);
+	if (IS_ERR(task)) {
+		ptr_ring_cleanup(&w->ring, NULL);
+		return PTR_ERR(task);
+	}
+	kthread_bind(task, cpu);
+	/* ce_gw_defer() uses the ring as soon as it sees the worker */
+	smp_store_release(&w->task, task);
+	wake_up_process(task);
+
+	return 0;
+}
+
+/**
+ * @fn static int ce_gw_defer_start(void)
+ * @brief Creates the ring and the worker of every online CPU and of every
+ *        CPU which comes online later
+ * @retval 0 on success
+ * @retval <0 if a ring or worker could not be created
+ * @ingroup defer
+ */
+static int ce_gw_defer_start(void)
+{
+	int err;
+
+	if (ce_gw_defer_running)
+		return 0;
+
+	/* calls ce_gw_defer_online() for all online CPUs */
+	err = cpuhp_setup_state(CPUHP_AP_ONLINE_DYN, "ce_gw/defer:online",
+	                        ce_gw_defer_online, NULL);
+	if (err < 0)
+		goto error;
+	ce_gw_defer_hp = err;
+
+	ce_gw_defer_running = true;
+	return 0;
+
+error:
+	pr_err("ce_gw_defer: starting the workers failed.\n");
+	ce_gw_defer_running = true;
+	ce_gw_defer_exit();
+	return err;
+}
+#endif
+
+int ce_gw_defer_route(struct ce_gw_job *gwj, int cpu)
+{
+#	ifdef CE_GW_DEFER_RING
+	if (cpu >= 0 && (cpu >= nr_cpu_ids || !cpu_online(cpu) ||
+	                 (ce_gw_defer_running &&
+	                  per_cpu(ce_gw_defer_workers, cpu).task == NULL)))
+		return -EINVAL;
+
+	gwj->defer_cpu = cpu;
+	atomic_set(&gwj->deferred, 0);
+
+	return ce_gw_defer_start();
+#	else
+	return -EOPNOTSUPP;
+#	endif
+}
+
+int ce_gw_defer(struct sk_buff *skb, struct ce_gw_job *gwj)
+{
+#	ifdef CE_GW_DEFER_RING
+	struct ce_gw_defer_worker *w;
+	struct task_struct *task;
+	struct sk_buff *clone;
+	int cpu = gwj->defer_cpu;
+
+	if (cpu < 0)
+		cpu = smp_processor_id();
+	w = per_cpu_ptr(&ce_gw_defer_workers, cpu);
+	task = smp_load_acquire(&w->task);
+	if (task == NULL) {
+		/* the worker of this CPU could not be created */
+		ce_gw_job_rcv(skb, gwj);
+		return 0;
+	}
+
+	clone = skb_clone(skb, GFP_ATOMIC);
+	if (clone == NULL)
+		return -ENOBUFS;
+	CE_GW_DEFER_CB(clone)->job = gwj;
+
+	atomic_inc(&gwj->deferred);
+	if (ptr_ring_produce(&w->ring, clone) != 0) {
+		atomic_dec(&gwj->deferred);
+		kfree_skb(clone);
+		return -ENOBUFS;
+	}
+	wake_up_process(task);
+
+	return 0;
+#	else
+	return -ENOBUFS;
+#	endif
+}
+
+void ce_gw_defer_wait(struct ce_gw_job *gwj)
+{
+	if ((gwj->flags & CE_GW_F_DEFER) == 0)
+		return;
+
+	while (atomic_read(&gwj->deferred) != 0)
+		msleep(1);
+}
+
+void ce_gw_defer_exit(void)
+{
+#	ifdef CE_GW_DEFER_RING
+	struct ce_gw_defer_worker *w;
+	int cpu;
+
+	if (!ce_gw_defer_running)
+		return;
+
+	if (ce_gw_defer_hp > 0) {
+		cpuhp_remove_state_nocalls(ce_gw_defer_hp);
+		ce_gw_defer_hp = 0;
+	}
+
+	for_each_possible_cpu(cpu) {
+		w = per_cpu_ptr(&ce_gw_defer_workers, cpu);
+		if (w->task == NULL)
+			continue;
+
+		kthread_stop(w->task);
+		w->task = NULL;
+		ptr_ring_cleanup(&w->ring, ce_gw_defer_free);
+	}
+	ce_gw_defer_running = false;
+#	endif
+}
+
+/**@}*/
@@ -34,6 +34,9 @@
 
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
+#include <linux/moduleparam.h>
+#include <linux/jhash.h>
+#include <linux/cpumask.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,7,0)
 # include <uapi/linux/can.h>
 # else
@@ -43,7 +46,13 @@
 #   error Only Linux Kernel 3.6 and above are supported
 #  endif
 #endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,0)
+#include <net/xdp.h>		/* for ndo_xdp_xmit */
+#endif
 #include "ce_gw_dev.h"
+#ifdef CE_GW_DEV_XDP
+#include <trace/events/xdp.h>	/* for trace_xdp_exception */
+#endif
 #include "ce_gw_main.h"
 
 #include <asm-generic/errno-base.h>
@@ -53,6 +62,18 @@ HLIST_HEAD(ce_gw_dev_allocated); /**< list of all allocated ethernet devices */
 HLIST_HEAD(ce_gw_dev_registered);/**< list of all registered ethernet devices */
 static struct kmem_cache *ce_gw_dev_cache __read_mostly; /**< cache for lists */
 
+/**
+ * Upper limit of TX/RX queues per virtual ethernet device. The device gets
+ * one queue per online CPU, but never more than this value.
+ */
+static unsigned int max_queues = 8;
+module_param(max_queues, uint, S_IRUGO);
+MODULE_PARM_DESC(max_queues, "Maximum number of TX/RX queues per cegw device "
+                 "(default 8, one queue per online CPU up to this limit)");
+
+/** Poll interval of ce_gw_job_info.wake_timer while a CAN device is busy */
+#define CE_GW_DEV_WAKE_NS (250 * NSEC_PER_USEC)
+
 /**
  * @struct ce_gw_dev_list
  * @brief internal list of all registered and allocated devices.
@@ -83,7 +104,7 @@ int ce_gw_dev_open(struct net_device *dev)
 		return -1;
 	}
 
-	netif_start_queue(dev);
+	netif_tx_start_all_queues(dev);
 	return 0;
 }
 
@@ -97,54 +118,296 @@ int ce_gw_dev_open(struct net_device *dev)
  */
 int ce_gw_dev_stop(struct net_device *dev)
 {
+	struct ce_gw_job_info *priv = netdev_priv(dev);
+
 	printk ("ce_gw_dev: ce_gw_release called\n");
-	netif_stop_queue(dev);
+	netif_tx_stop_all_queues(dev);
+	hrtimer_cancel(&priv->wake_timer);
 	return 0;
 }
 
 /**
- * @fn static int ce_gw_dev_start_xmit(struct sk_buff *skb,
- *                              struct net_device *dev)
- * @brief called by the OS if a package is sent to the device
- * @param dev correspondening eth device
- * @param skb sk buffer from OS
- * @retval 0 on success
- * @retval <0 on failure
+ * @fn static bool ce_gw_dev_dst_busy(struct ce_gw_job_info *priv)
+ * @brief checks if one of the CAN destinations of the device can not send
+ * @param priv private field of the ethernet device
+ * @retval true if the TX queue of at least one CAN destination is stopped
+ * @retval false if all CAN destinations are ready
+ * @pre must be called under rcu_read_lock()
  * @ingroup dev
  */
-static int ce_gw_dev_start_xmit(struct sk_buff *skb,
-                                struct net_device *dev)
+static bool ce_gw_dev_dst_busy(struct ce_gw_job_info *priv)
 {
-	printk ("ce_gw_dev: dummy xmit function called....\n");
-	/* TODO: Get right gw_job and push it to eth_skb (instead of NULL) */
-	struct ce_gw_job_info *priv = netdev_priv(dev);
-
 	struct ce_gw_job *job = NULL;
-	struct hlist_node *node;
 
 #	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
-	hlist_for_each_entry_safe(job, node, &priv->job_src, list_dev) {
-
+	hlist_for_each_entry_rcu(job, &priv->job_src, list_dev) {
 #	else
 	struct hlist_node *pos;
-	hlist_for_each_entry_safe(job, pos, node, &priv->job_src,
-	                          list_dev) {
+	hlist_for_each_entry_rcu(job, pos, &priv->job_src, list_dev) {
 #	endif
-		ce_gw_eth_rcv(skb, job);
+		if (netif_queue_stopped(job->dst.dev))
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * @fn static void ce_gw_dev_throttle(struct net_device *dev, u16 queue)
+ * @brief stops a TX queue of the device until the CAN destinations are ready
+ * @param dev correspondening eth device
+ * @param queue index of the TX queue which should be stopped
+ * @details The queue will be woken by ce_gw_dev_wake_timer().
+ * @ingroup dev
+ */
+static void ce_gw_dev_throttle(struct net_device *dev, u16 queue)
+{
+	struct ce_gw_job_info *priv = netdev_priv(dev);
+
+	netif_stop_subqueue(dev, queue);
+	if (!hrtimer_is_queued(&priv->wake_timer))
+		hrtimer_start(&priv->wake_timer, ns_to_ktime(CE_GW_DEV_WAKE_NS),
+		              HRTIMER_MODE_REL);
+}
+
+/**
+ * @fn static enum hrtimer_restart ce_gw_dev_wake_timer(struct hrtimer *timer)
+ * @brief wakes all TX queues of the device if the CAN destinations are ready
+ * @param timer ce_gw_job_info.wake_timer of the device
+ * @retval HRTIMER_RESTART at least one CAN destination is still busy
+ * @retval HRTIMER_NORESTART all TX queues are woken
+ * @ingroup dev
+ */
+static enum hrtimer_restart ce_gw_dev_wake_timer(struct hrtimer *timer)
+{
+	struct ce_gw_job_info *priv;
+	bool busy;
+
+	priv = container_of(timer, struct ce_gw_job_info, wake_timer);
+
+	rcu_read_lock();
+	busy = ce_gw_dev_dst_busy(priv);
+	rcu_read_unlock();
+
+	if (busy) {
+		hrtimer_forward_now(timer, ns_to_ktime(CE_GW_DEV_WAKE_NS));
+		return HRTIMER_RESTART;
 	}
 
+	netif_tx_wake_all_queues(priv->dev);
+	return HRTIMER_NORESTART;
+}
+
+/**
+ * @fn static netdev_tx_t ce_gw_dev_start_xmit(struct sk_buff *skb,
+ *                              struct net_device *dev)
+ * @brief called by the OS if a package is sent to the device
+ * @param dev correspondening eth device
+ * @param skb sk buffer from OS
+ * @retval NETDEV_TX_OK the package was consumed
+ * @retval NETDEV_TX_BUSY a CAN destination is busy. The TX queue is stopped
+ *         and the OS will requeue the package (not in #CE_GW_F_NO_QUEUE mode)
+ * @ingroup dev
+ */
+static netdev_tx_t ce_gw_dev_start_xmit(struct sk_buff *skb,
+                                        struct net_device *dev)
+{
+	struct ce_gw_job_info *priv = netdev_priv(dev);
+	bool flow_control = !(priv->flags & CE_GW_F_NO_QUEUE);
+	u16 queue = skb_get_queue_mapping(skb);
+
+	if (flow_control && ce_gw_dev_dst_busy(priv)) {
+		ce_gw_dev_throttle(dev, queue);
+		return NETDEV_TX_BUSY;
+	}
+
+	/* translates the frame once for all routes of the device */
+	ce_gw_eth_rcv(skb, &priv->job_src);
+
 	dev_kfree_skb(skb);
 
+	/* stop before the next package instead of requeuing it */
+	if (flow_control && ce_gw_dev_dst_busy(priv))
+		ce_gw_dev_throttle(dev, queue);
+
 	/*here is my test for ce_gw_eth_to_canfd*/
 	/*	struct sk_buff *can_skb;*/
 	/*	__u32 id = 0xF65C034B;*/
 	/*	__u8 flags = 0x04;*/
-	/*	__u8 res0 = 0xF3;*/
-	/*	__u8 res1 = 0x00;*/
-	/*	can_skb = ce_gw_eth_to_canfd(id, flags, res0, res1, skb, dev);*/
-	return 0;
+	/*	can_skb = ce_gw_eth_to_canfd(id, flags, skb, dev, 64);*/
+	return NETDEV_TX_OK;
 }
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,0)
+/**
+ * @fn static int ce_gw_dev_xdp_xmit(struct net_device *dev, int n,
+ *                                   struct xdp_frame **frames, u32 flags)
+ * @brief called by the OS for frames an XDP program redirected to the device
+ * @param dev correspondening eth device
+ * @param n Number of frames
+ * @param frames The frames, each an ethernet frame with a CAN frame
+ * @param flags XDP_XMIT_FLUSH, nothing is buffered here
+ * @return Number of frames consumed by the device
+ * @details The CAN frames are copied from the XDP frames into CAN sk_buffs
+ *          (ce_gw_eth_rcv_buf()), no ethernet sk_buff is built. All frames
+ *          are freed here, also frames without a CAN frame.
+ * @ingroup dev
+ */
+static int ce_gw_dev_xdp_xmit(struct net_device *dev, int n,
+                              struct xdp_frame **frames, u32 flags)
+{
+	struct ce_gw_job_info *priv = netdev_priv(dev);
+	int drops = 0;
+	int i;
+
+	if (unlikely(flags & ~XDP_XMIT_FLAGS_MASK))
+		return -EINVAL;
+
+	rcu_read_lock();
+	for (i = 0; i < n; i++) {
+		if (ce_gw_eth_rcv_buf(frames[i]->data, frames[i]->len,
+		                      &priv->job_src) != 0) {
+			dev->stats.tx_dropped++;
+			drops++;
+		} else {
+			dev->stats.tx_packets++;
+			dev->stats.tx_bytes += frames[i]->len;
+		}
+		xdp_return_frame(frames[i]);
+	}
+	rcu_read_unlock();
+
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(5,13,0)
+	/* the caller frees frames which are not counted */
+	return n;
+#	else
+	return n - drops;
+#	endif
+}
+#endif
+
+#ifdef CE_GW_DEV_XDP
+/** per CPU page the xdp_buff of ce_gw_dev_xdp() is built in */
+static DEFINE_PER_CPU(struct page *, ce_gw_dev_xdp_page);
+
+int ce_gw_dev_xdp(struct net_device *dev, struct sk_buff **eth_skb)
+{
+	struct ce_gw_job_info *priv = netdev_priv(dev);
+	struct sk_buff *skb = *eth_skb;
+	struct bpf_prog *prog;
+	struct xdp_buff xdp;
+	struct page *page;
+	u32 act;
+
+	prog = rcu_dereference(priv->xdp_prog);
+	if (likely(prog == NULL))
+		return 0;
+
+	/* a redirected or passed page has a new owner, get a new one */
+	page = __this_cpu_read(ce_gw_dev_xdp_page);
+	if (page == NULL) {
+		page = alloc_page(GFP_ATOMIC);
+		if (page == NULL) {
+			kfree_skb(skb);
+			return -ENOMEM;
+		}
+		__this_cpu_write(ce_gw_dev_xdp_page, page);
+	}
+
+	xdp_init_buff(&xdp, PAGE_SIZE, &priv->xdp_rxq);
+	xdp_prepare_buff(&xdp, page_address(page), XDP_PACKET_HEADROOM,
+	                 skb->len, false);
+	skb_copy_bits(skb, 0, xdp.data, skb->len);
+
+	act = bpf_prog_run_xdp(prog, &xdp);
+	switch (act) {
+	case XDP_PASS:
+		/* the program may have changed the frame, the page becomes the
+		 * head of the sk_buff which is passed on */
+		*eth_skb = build_skb(xdp.data_hard_start, PAGE_SIZE);
+		if (*eth_skb == NULL)
+			break;
+		__this_cpu_write(ce_gw_dev_xdp_page, NULL);
+		skb_reserve(*eth_skb, xdp.data - xdp.data_hard_start);
+		__skb_put(*eth_skb, xdp.data_end - xdp.data);
+		skb_reset_mac_header(*eth_skb);
+		skb_set_network_header(*eth_skb, ETH_HLEN);
+		(*eth_skb)->protocol = ((struct ethhdr *) xdp.data)->h_proto;
+		(*eth_skb)->pkt_type = skb->pkt_type;
+		(*eth_skb)->mark = skb->mark;
+		(*eth_skb)->dev = skb->dev;
+		skb_copy_hash(*eth_skb, skb);
+		consume_skb(skb);
+		return 0;
+	case XDP_REDIRECT:
+		if (xdp_do_redirect(dev, &xdp, prog) != 0) {
+			trace_xdp_exception(dev, prog, act);
+			break;
+		}
+		/* flushed by ce_gw_dev_xdp_flush() after the last route */
+		__this_cpu_write(ce_gw_dev_xdp_page, NULL);
+		dev->stats.rx_packets++;
+		dev->stats.rx_bytes += xdp.data_end - xdp.data;
+		consume_skb(skb);
+		return 1;
+	case XDP_DROP:
+		break;
+	case XDP_TX:
+		/* the device has no wire to send the frame back to */
+		trace_xdp_exception(dev, prog, act);
+		break;
+	default:
+#		if LINUX_VERSION_CODE >= KERNEL_VERSION(5,17,0)
+		bpf_warn_invalid_xdp_action(dev, prog, act);
+#		else
+		bpf_warn_invalid_xdp_action(act);
+#		endif
+		fallthrough;
+	case XDP_ABORTED:
+		trace_xdp_exception(dev, prog, act);
+		break;
+	}
+
+	dev->stats.rx_dropped++;
+	kfree_skb(skb);
+	return -EPERM;
+}
+
+void ce_gw_dev_xdp_flush(void)
+{
+	xdp_do_flush();
+}
+
+/**
+ * @fn static int ce_gw_dev_bpf(struct net_device *dev,
+ *                              struct netdev_bpf *bpf)
+ * @brief called by the OS to attach or detach an XDP program
+ * @param dev correspondening eth device
+ * @param bpf the command, only XDP_SETUP_PROG is supported
+ * @retval 0 on success
+ * @retval -EINVAL unsupported command
+ * @details The program runs in ce_gw_dev_xdp() for every frame of a
+ *          CAN -> ETH route to the device. Called under rtnl_lock().
+ * @ingroup dev
+ */
+static int ce_gw_dev_bpf(struct net_device *dev, struct netdev_bpf *bpf)
+{
+	struct ce_gw_job_info *priv = netdev_priv(dev);
+	struct bpf_prog *old;
+
+	switch (bpf->command) {
+	case XDP_SETUP_PROG:
+		old = rtnl_dereference(priv->xdp_prog);
+		rcu_assign_pointer(priv->xdp_prog, bpf->prog);
+		if (old != NULL)
+			bpf_prog_put(old);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+#endif
+
 /**
  * @fn static int ce_gw_dev_init(struct net_device *dev)
  * @brief called by the OS on device registered
@@ -155,9 +418,81 @@ static int ce_gw_dev_start_xmit(struct sk_buff *skb,
  */
 int ce_gw_dev_init(struct net_device *dev) {
 	printk ("ce_gw_dev: device init called\n");
+
+#	ifdef CE_GW_DEV_XDP
+	struct ce_gw_job_info *priv = netdev_priv(dev);
+	int err;
+
+	err = xdp_rxq_info_reg(&priv->xdp_rxq, dev, 0, 0);
+	if (err < 0)
+		return err;
+
+	/* pages are given away with XDP_REDIRECT or XDP_PASS and freed with
+	 * put_page() */
+	err = xdp_rxq_info_reg_mem_model(&priv->xdp_rxq, MEM_TYPE_PAGE_ORDER0,
+	                                 NULL);
+	if (err < 0) {
+		xdp_rxq_info_unreg(&priv->xdp_rxq);
+		return err;
+	}
+#	endif
 	return 0;
 }
 
+/**
+ * @fn static u16 ce_gw_dev_select_queue(struct net_device *dev,
+ *                                      struct sk_buff *skb)
+ * @brief called by the OS to choose the TX queue of a package
+ * @param dev correspondening eth device
+ * @param skb sk buffer from OS
+ * @return index of the TX queue
+ * @details Frames with a CAN frame as payload (#CE_GW_TYPE_NET) are hashed on
+ *          their CAN ID, so all frames of one ID stay in order on one queue
+ *          while different IDs are spread over all queues. All other frames
+ *          use queue 0.
+ * @ingroup dev
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,2,0)
+static u16 ce_gw_dev_select_queue(struct net_device *dev, struct sk_buff *skb,
+                                  struct net_device *sb_dev)
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4,19,0)
+static u16 ce_gw_dev_select_queue(struct net_device *dev, struct sk_buff *skb,
+                                  struct net_device *sb_dev,
+                                  select_queue_fallback_t fallback)
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(3,14,0)
+static u16 ce_gw_dev_select_queue(struct net_device *dev, struct sk_buff *skb,
+                                  void *accel_priv,
+                                  select_queue_fallback_t fallback)
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(3,13,0)
+static u16 ce_gw_dev_select_queue(struct net_device *dev, struct sk_buff *skb,
+                                  void *accel_priv)
+#else
+static u16 ce_gw_dev_select_queue(struct net_device *dev, struct sk_buff *skb)
+#endif
+{
+	const struct ethhdr *ethh;
+	const canid_t *idp;
+	struct ethhdr eth_buf;
+	canid_t id_buf;
+
+	if (dev->real_num_tx_queues <= 1)
+		return 0;
+
+	/* skb->data points to the ethernet header, the CAN ID follows it. The
+	 * head must not be reallocated here, so nothing is pulled. */
+	ethh = skb_header_pointer(skb, 0, sizeof(eth_buf), &eth_buf);
+	if (ethh == NULL ||
+	    (ethh->h_proto != htons(ETH_P_CAN) &&
+	     ethh->h_proto != htons(ETH_P_CANFD)))
+		return 0;
+
+	idp = skb_header_pointer(skb, ETH_HLEN, sizeof(id_buf), &id_buf);
+	if (idp == NULL)
+		return 0;
+
+	return (u16) (jhash_1word(*idp, 0) % dev->real_num_tx_queues);
+}
+
 /**
  * @brief Defined Functions of Ethernet device
  */
@@ -166,6 +501,13 @@ static struct net_device_ops ce_gw_ops = {
 	.ndo_open 	= ce_gw_dev_open,
 	.ndo_stop	= ce_gw_dev_stop,
 	.ndo_start_xmit	= ce_gw_dev_start_xmit,
+	.ndo_select_queue = ce_gw_dev_select_queue,
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,0)
+	.ndo_xdp_xmit	= ce_gw_dev_xdp_xmit,
+#	endif
+#	ifdef CE_GW_DEV_XDP
+	.ndo_bpf	= ce_gw_dev_bpf,
+#	endif
 	0
 };
 
@@ -280,8 +622,19 @@ struct net_device *ce_gw_dev_alloc(char *dev_name) {
 	pr_debug("ce_gw_dev: Alloc Device\n");
 	struct net_device *dev;
 
-	dev = alloc_netdev(sizeof(struct ce_gw_job_info),
-	                   dev_name, ether_setup);
+	/* one TX/RX queue per CPU, limited by module param max_queues */
+	unsigned int queues = min_t(unsigned int, num_online_cpus(),
+	                            max_queues);
+	if (queues == 0)
+		queues = 1;
+
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0)
+	dev = alloc_netdev_mqs(sizeof(struct ce_gw_job_info), dev_name,
+	                       NET_NAME_UNKNOWN, ether_setup, queues, queues);
+#	else
+	dev = alloc_netdev_mqs(sizeof(struct ce_gw_job_info), dev_name,
+	                       ether_setup, queues, queues);
+#	endif
 	if (dev == NULL) {
 		pr_err("ce_gw_dev: Error allocation etherdev.");
 		goto ce_gw_dev_create_error;
@@ -292,6 +645,14 @@ struct net_device *ce_gw_dev_alloc(char *dev_name) {
 	memset(priv, 0, sizeof(struct ce_gw_job_info));
 	priv->job_src.first = NULL;
 	priv->job_dst.first = NULL;
+	priv->dev = dev;
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+	hrtimer_setup(&priv->wake_timer, ce_gw_dev_wake_timer,
+	              CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#	else
+	hrtimer_init(&priv->wake_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	priv->wake_timer.function = ce_gw_dev_wake_timer;
+#	endif
 
 	/* create list entry and add */
 	struct ce_gw_dev_list *dl;
@@ -340,6 +701,15 @@ void ce_gw_dev_free(struct net_device *eth_dev) {
 		hlist_del_rcu(&dl->list_alloc);
 	}
 
+	struct ce_gw_job_info *priv = netdev_priv(eth_dev);
+	hrtimer_cancel(&priv->wake_timer);
+
+#	ifdef CE_GW_DEV_XDP
+	/* only registered if the device was registered */
+	if (xdp_rxq_info_is_reg(&priv->xdp_rxq))
+		xdp_rxq_info_unreg(&priv->xdp_rxq);
+#	endif
+
 	free_netdev(eth_dev);
 	kmem_cache_free(ce_gw_dev_cache, dl);
 }
@@ -348,6 +718,30 @@ void ce_gw_dev_setup(struct net_device *dev, enum ce_gw_type type,
                      __u32 flags) {
 	dev->netdev_ops = &ce_gw_ops;
 
+	/* ce_gw_dev_start_xmit() only reads the RCU protected job list, so the
+	 * TX queue lock is not needed. */
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(6,12,0)
+	dev->lltx = true;
+#	else
+	dev->features |= NETIF_F_LLTX;
+#	endif
+
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+	/* devmap only redirects to devices which announce it */
+	dev->xdp_features = NETDEV_XDP_ACT_NDO_XMIT;
+#	endif
+
+	struct ce_gw_job_info *priv = netdev_priv(dev);
+	priv->flags = flags;
+
+	if ((flags & CE_GW_F_NO_QUEUE) == CE_GW_F_NO_QUEUE) {
+#		if LINUX_VERSION_CODE >= KERNEL_VERSION(4,3,0)
+		dev->priv_flags |= IFF_NO_QUEUE;
+#		else
+		dev->tx_queue_len = 0;
+#		endif
+	}
+
 	/* Set sensible MTU */
 	switch (type) {
 	case CE_GW_TYPE_NONE:
@@ -542,6 +936,16 @@ void ce_gw_dev_cleanup(void) {
 	}
 
 	kmem_cache_destroy(ce_gw_dev_cache);
+
+#	ifdef CE_GW_DEV_XDP
+	int cpu;
+	for_each_possible_cpu(cpu) {
+		struct page *page = per_cpu(ce_gw_dev_xdp_page, cpu);
+		if (page != NULL)
+			put_page(page);
+		per_cpu(ce_gw_dev_xdp_page, cpu) = NULL;
+	}
+#	endif
 }
 
 /**@}*/
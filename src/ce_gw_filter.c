@@ -0,0 +1,468 @@
+/**
+ * @file ce_gw_filter.c
+ * @brief Control Area Network - Ethernet - Gateway - Per ID Filter
+ * @author Fabian Raab (fabian.raab@tum.de)
+ * @date May, 2013
+ * @copyright GNU Public License v3 or higher
+ * @ingroup files
+ * @{
+ */
+
+/*****************************************************************************
+ * (C) Copyright 2013 Fabian Raab, Stefan Smarzly
+ *
+ * This file is part of CAN-Eth-GW.
+ *
+ * CAN-Eth-GW is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CAN-Eth-GW is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CAN-Eth-GW.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/log2.h>
+#include <linux/jhash.h>
+#include <linux/jiffies.h>
+#include <linux/bsearch.h>
+#include <linux/sort.h>
+#include "ce_gw_filter.h"
+#include "ce_gw_main.h"
+
+#include <asm-generic/errno-base.h>
+#include <asm-generic/errno.h>
+
+static unsigned int filter_eff_slots = 1024;
+module_param(filter_eff_slots, uint, S_IRUGO);
+MODULE_PARM_DESC(filter_eff_slots, "Entries for EFF IDs in the per ID tables "
+                 "of a route (default 1024)");
+
+/** Number of SFF IDs, direct-mapped in a struct ce_gw_idtab */
+#define CE_GW_IDTAB_SFF (CAN_SFF_MASK + 1)
+
+/**
+ * @struct ce_gw_change_ent
+ * @brief Last forwarded frame of an ID in struct ce_gw_change
+ */
+struct ce_gw_change_ent {
+	struct ce_gw_idtab_ent hdr;	/**< ID of the entry */
+	unsigned long stamp;	/**< jiffies of the last forwarded frame */
+	u8 len;			/**< DLC of the last forwarded frame */
+	u8 data[];		/**< ce_gw_change.data_len data bytes */
+};
+
+/**
+ * @struct ce_gw_throttle_ent
+ * @brief Rate limit state of an ID in struct ce_gw_throttle
+ */
+struct ce_gw_throttle_ent {
+	struct ce_gw_idtab_ent hdr;	/**< ID of the entry */
+	unsigned long last;	/**< jiffies of the last forwarded frame */
+	unsigned long interval;	/**< Minimum interval of the ID in jiffies */
+	struct sk_buff *kept;	/**< Latest suppressed frame (trailing) */
+	struct list_head pending; /**< Entry of ce_gw_throttle.pending */
+};
+
+/**
+ * @fn static int ce_gw_idtab_init(struct ce_gw_idtab *tab, size_t ent_size)
+ * @brief Allocates the entries of a table
+ * @param tab The table
+ * @param ent_size Size of an entry, starting with a struct ce_gw_idtab_ent
+ * @retval 0 on success
+ * @retval -ENOMEM if the allocation failed
+ * @ingroup alloc
+ */
+static int ce_gw_idtab_init(struct ce_gw_idtab *tab, size_t ent_size)
+{
+	u32 eff = roundup_pow_of_two(clamp(filter_eff_slots, 1U, 1U << 20));
+
+	tab->ent_size = ALIGN(ent_size, sizeof(unsigned long));
+	tab->eff_mask = eff - 1;
+	tab->evict = NULL;
+	spin_lock_init(&tab->lock);
+
+	tab->ents = vzalloc((CE_GW_IDTAB_SFF + eff) * tab->ent_size);
+	if (tab->ents == NULL)
+		return -ENOMEM;
+	return 0;
+}
+
+/**
+ * @fn static struct ce_gw_idtab_ent *ce_gw_idtab_get(struct ce_gw_idtab *tab,
+ *                                                   canid_t can_id)
+ * @brief Returns the entry of a CAN ID
+ * @param tab The table, tab->lock must be held
+ * @param can_id The CAN ID, RTR and ERR flags are ignored
+ * @return The entry. If it held no or another ID it is cleared, so
+ *         ce_gw_idtab_ent.used is 0.
+ * @ingroup proc
+ */
+static struct ce_gw_idtab_ent *ce_gw_idtab_get(struct ce_gw_idtab *tab,
+                                               canid_t can_id)
+{
+	struct ce_gw_idtab_ent *ent;
+	u32 idx;
+
+	if (can_id & CAN_EFF_FLAG) {
+		can_id &= CAN_EFF_FLAG | CAN_EFF_MASK;
+		idx = CE_GW_IDTAB_SFF + (jhash_1word(can_id, 0) & tab->eff_mask);
+	} else {
+		can_id &= CAN_SFF_MASK;
+		idx = can_id;
+	}
+
+	ent = tab->ents + idx * tab->ent_size;
+	if (ent->id != can_id) {
+		if (ent->used && tab->evict != NULL)
+			tab->evict(ent);
+		memset(ent, 0, tab->ent_size);
+		ent->id = can_id;
+	}
+	return ent;
+}
+
+struct ce_gw_change *ce_gw_change_create(bool fd, const u8 *mask,
+                                         unsigned int mask_len,
+                                         u32 refresh_ms)
+{
+	struct ce_gw_change *chg;
+
+	chg = kzalloc(sizeof(struct ce_gw_change), GFP_KERNEL);
+	if (chg == NULL)
+		return NULL;
+
+	chg->data_len = fd ? CANFD_MAX_DLEN : CAN_MAX_DLEN;
+	chg->refresh = msecs_to_jiffies(refresh_ms);
+	memset(chg->mask, 0xff, sizeof(chg->mask));
+	if (mask != NULL)
+		memcpy(chg->mask, mask, min_t(unsigned int, mask_len,
+		                              sizeof(chg->mask)));
+
+	if (ce_gw_idtab_init(&chg->tab, sizeof(struct ce_gw_change_ent) +
+	                     chg->data_len) != 0) {
+		kfree(chg);
+		return NULL;
+	}
+
+	return chg;
+}
+
+void ce_gw_change_destroy(struct ce_gw_change *chg)
+{
+	if (chg == NULL)
+		return;
+
+	vfree(chg->tab.ents);
+	kfree(chg);
+}
+
+bool ce_gw_change_pass(struct ce_gw_change *chg,
+                       const struct sk_buff *can_skb)
+{
+	const struct canfd_frame *cfd = (const struct canfd_frame *)
+	                                can_skb->data;
+	unsigned int len = min_t(unsigned int, cfd->len, chg->data_len);
+	struct ce_gw_change_ent *ent;
+	bool pass;
+	int i;
+
+	spin_lock(&chg->tab.lock);
+	ent = (struct ce_gw_change_ent *) ce_gw_idtab_get(&chg->tab,
+	                                                  cfd->can_id);
+
+	pass = !ent->hdr.used || ent->len != cfd->len ||
+	       (chg->refresh && time_after_eq(jiffies,
+	                                      ent->stamp + chg->refresh));
+	for (i = 0; !pass && i < len; i++)
+		pass = ((ent->data[i] ^ cfd->data[i]) & chg->mask[i]) != 0;
+
+	/* compared with the last forwarded frame, so slow drifts pass too */
+	if (pass) {
+		ent->hdr.used = 1;
+		ent->len = cfd->len;
+		ent->stamp = jiffies;
+		memcpy(ent->data, cfd->data, len);
+	}
+	spin_unlock(&chg->tab.lock);
+
+	return pass;
+}
+
+/**
+ * @fn static void ce_gw_throttle_evict(struct ce_gw_idtab_ent *hdr)
+ * @brief Frees the kept frame of an entry which gets another ID
+ * @param hdr The entry
+ * @ingroup proc
+ */
+static void ce_gw_throttle_evict(struct ce_gw_idtab_ent *hdr)
+{
+	struct ce_gw_throttle_ent *ent = (struct ce_gw_throttle_ent *) hdr;
+
+	if (ent->kept == NULL)
+		return;
+
+	list_del(&ent->pending);
+	kfree_skb(ent->kept);
+	ent->kept = NULL;
+}
+
+/**
+ * @fn static int ce_gw_throttle_cmp(const void *a, const void *b)
+ * @brief Orders struct ce_gw_throttle_id by can_id for sort() and bsearch()
+ * @ingroup alloc
+ */
+static int ce_gw_throttle_cmp(const void *a, const void *b)
+{
+	u32 ia = ((const struct ce_gw_throttle_id *) a)->can_id;
+	u32 ib = ((const struct ce_gw_throttle_id *) b)->can_id;
+
+	return ia < ib ? -1 : ia > ib;
+}
+
+/**
+ * @fn static unsigned long ce_gw_throttle_interval(struct ce_gw_throttle *thr,
+ *                                                  canid_t id)
+ * @brief Returns the interval of an ID
+ * @param thr The rate limit
+ * @param id The CAN ID as in struct ce_gw_idtab_ent
+ * @return The interval in jiffies
+ * @details Only called when an entry gets its ID, not for every frame.
+ * @ingroup proc
+ */
+static unsigned long ce_gw_throttle_interval(struct ce_gw_throttle *thr,
+                                             canid_t id)
+{
+	struct ce_gw_throttle_id key = { .can_id = id };
+	const struct ce_gw_throttle_id *found;
+
+	if (thr->n_ids == 0)
+		return thr->interval;
+
+	found = bsearch(&key, thr->ids, thr->n_ids,
+	                sizeof(struct ce_gw_throttle_id), ce_gw_throttle_cmp);
+	if (found == NULL)
+		return thr->interval;
+	return msecs_to_jiffies(found->interval_ms);
+}
+
+/**
+ * @fn static void ce_gw_throttle_arm(struct ce_gw_throttle *thr,
+ *                                    unsigned long expires)
+ * @brief Starts the timer for the end of an interval unless it runs out
+ *        earlier
+ * @param thr The rate limit, thr->tab.lock must be held
+ * @param expires End of the interval in jiffies
+ * @ingroup proc
+ */
+static void ce_gw_throttle_arm(struct ce_gw_throttle *thr,
+                               unsigned long expires)
+{
+	long delta = (long)(expires - jiffies);
+	ktime_t rel = ns_to_ktime(jiffies_to_nsecs(max(delta, 0L)));
+
+	if (thr->dead)
+		return;
+	/* IDs with different intervals share the timer */
+	if (hrtimer_is_queued(&thr->timer) &&
+	    ktime_compare(hrtimer_get_remaining(&thr->timer), rel) <= 0)
+		return;
+
+	hrtimer_start(&thr->timer, rel, HRTIMER_MODE_REL);
+}
+
+/**
+ * @fn static enum hrtimer_restart ce_gw_throttle_timer(struct hrtimer *timer)
+ * @brief Schedules ce_gw_throttle_flush(), the frames must not be forwarded
+ *        in hard interrupt context of the hrtimer.
+ * @param timer ce_gw_throttle.timer
+ * @retval HRTIMER_NORESTART always, ce_gw_throttle_flush() restarts it
+ * @ingroup proc
+ */
+static enum hrtimer_restart ce_gw_throttle_timer(struct hrtimer *timer)
+{
+	struct ce_gw_throttle *thr = container_of(timer, struct ce_gw_throttle,
+	                                          timer);
+
+	tasklet_schedule(&thr->tasklet);
+	return HRTIMER_NORESTART;
+}
+
+/**
+ * @fn static void ce_gw_throttle_flush(unsigned long data)
+ * @brief Forwards the kept frames of all IDs whose interval ended
+ * @param data The struct ce_gw_throttle
+ * @details The timer is restarted for the earliest interval which did not
+ *          end yet.
+ * @ingroup proc
+ */
+static void ce_gw_throttle_flush(unsigned long data)
+{
+	struct ce_gw_throttle *thr = (struct ce_gw_throttle *) data;
+	struct ce_gw_throttle_ent *ent, *tmp;
+	struct sk_buff_head flush;
+	struct sk_buff *skb;
+	unsigned long next = 0;
+	bool more = false;
+
+	__skb_queue_head_init(&flush);
+
+	spin_lock(&thr->tab.lock);
+	list_for_each_entry_safe(ent, tmp, &thr->pending, pending) {
+		unsigned long end = ent->last + ent->interval;
+
+		if (time_before(jiffies, end)) {
+			if (!more || time_before(end, next))
+				next = end;
+			more = true;
+			continue;
+		}
+
+		list_del(&ent->pending);
+		__skb_queue_tail(&flush, ent->kept);
+		ent->kept = NULL;
+		ent->last = jiffies;
+	}
+	if (more)
+		ce_gw_throttle_arm(thr, next);
+	spin_unlock(&thr->tab.lock);
+
+	rcu_read_lock();
+	while ((skb = __skb_dequeue(&flush)) != NULL) {
+		if (!thr->dead)
+			ce_gw_job_rcv(skb, thr->job);
+		consume_skb(skb);
+	}
+	rcu_read_unlock();
+}
+
+struct ce_gw_throttle *ce_gw_throttle_create(struct ce_gw_job *job,
+        u32 interval_ms, const struct ce_gw_throttle_id *ids,
+        unsigned int n_ids, bool trailing)
+{
+	struct ce_gw_throttle *thr;
+
+	thr = kzalloc(sizeof(struct ce_gw_throttle), GFP_KERNEL);
+	if (thr == NULL)
+		return NULL;
+
+	if (n_ids != 0) {
+		thr->ids = kmemdup(ids, n_ids * sizeof(struct ce_gw_throttle_id),
+		                   GFP_KERNEL);
+		if (thr->ids == NULL)
+			goto ce_gw_throttle_create_error;
+		sort(thr->ids, n_ids, sizeof(struct ce_gw_throttle_id),
+		     ce_gw_throttle_cmp, NULL);
+		thr->n_ids = n_ids;
+	}
+
+	if (ce_gw_idtab_init(&thr->tab, sizeof(struct ce_gw_throttle_ent)) != 0)
+		goto ce_gw_throttle_create_error;
+	thr->tab.evict = ce_gw_throttle_evict;
+
+	thr->job = job;
+	thr->interval = msecs_to_jiffies(interval_ms);
+	thr->trailing = trailing;
+	INIT_LIST_HEAD(&thr->pending);
+
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+	hrtimer_setup(&thr->timer, ce_gw_throttle_timer,
+	              CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#	else
+	hrtimer_init(&thr->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	thr->timer.function = ce_gw_throttle_timer;
+#	endif
+	tasklet_init(&thr->tasklet, ce_gw_throttle_flush, (unsigned long) thr);
+
+	return thr;
+
+ce_gw_throttle_create_error:
+	kfree(thr->ids);
+	kfree(thr);
+	return NULL;
+}
+
+void ce_gw_throttle_destroy(struct ce_gw_throttle *thr)
+{
+	struct ce_gw_throttle_ent *ent, *tmp;
+
+	if (thr == NULL)
+		return;
+
+	/* the tasklet does not start the timer again */
+	spin_lock_bh(&thr->tab.lock);
+	thr->dead = true;
+	spin_unlock_bh(&thr->tab.lock);
+	hrtimer_cancel(&thr->timer);
+	tasklet_kill(&thr->tasklet);
+
+	list_for_each_entry_safe(ent, tmp, &thr->pending, pending) {
+		list_del(&ent->pending);
+		kfree_skb(ent->kept);
+	}
+
+	vfree(thr->tab.ents);
+	kfree(thr->ids);
+	kfree(thr);
+}
+
+bool ce_gw_throttle_pass(struct ce_gw_throttle *thr,
+                         const struct sk_buff *can_skb)
+{
+	const struct canfd_frame *cfd = (const struct canfd_frame *)
+	                                can_skb->data;
+	struct ce_gw_throttle_ent *ent;
+	struct sk_buff *kept;
+	bool pass;
+
+	spin_lock(&thr->tab.lock);
+	ent = (struct ce_gw_throttle_ent *) ce_gw_idtab_get(&thr->tab,
+	                                                    cfd->can_id);
+	if (!ent->hdr.used) {
+		ent->hdr.used = 1;
+		ent->interval = ce_gw_throttle_interval(thr, ent->hdr.id);
+		ent->last = jiffies - ent->interval;
+	}
+
+	pass = ent->interval == 0 ||
+	       time_after_eq(jiffies, ent->last + ent->interval);
+	if (pass) {
+		ent->last = jiffies;
+		/* this frame is newer than a kept one */
+		if (ent->kept != NULL) {
+			list_del(&ent->pending);
+			kfree_skb(ent->kept);
+			ent->kept = NULL;
+		}
+	} else if (thr->trailing) {
+		/* keep the latest frame of the interval */
+		kept = skb_clone(can_skb, GFP_ATOMIC);
+		if (kept != NULL) {
+			if (ent->kept != NULL) {
+				consume_skb(ent->kept);
+			} else {
+				list_add_tail(&ent->pending, &thr->pending);
+				ce_gw_throttle_arm(thr, ent->last +
+				                   ent->interval);
+			}
+			ent->kept = kept;
+		}
+	}
+	spin_unlock(&thr->tab.lock);
+
+	return pass;
+}
+
+/**@}*/
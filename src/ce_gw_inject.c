@@ -0,0 +1,195 @@
+/**
+ * @file ce_gw_inject.c
+ * @brief Control Area Network - Ethernet - Gateway - Frame Injection
+ * @author Fabian Raab (fabian.raab@tum.de)
+ * @date May, 2013
+ * @copyright GNU Public License v3 or higher
+ * @ingroup files
+ * @{
+ */
+
+/*****************************************************************************
+ * (C) Copyright 2013 Fabian Raab, Stefan Smarzly
+ *
+ * This file is part of CAN-Eth-GW.
+ *
+ * CAN-Eth-GW is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CAN-Eth-GW is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CAN-Eth-GW.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/uaccess.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h>	/* cond_resched */
+#include "ce_gw_main.h"
+#include "ce_gw_inject.h"
+
+#include <asm-generic/errno-base.h>
+#include <asm-generic/errno.h>
+
+#ifndef u64_to_user_ptr
+#define u64_to_user_ptr(x) ((void __user *)(uintptr_t)(x))
+#endif
+
+/** Records copied from user space at once */
+#define CE_GW_INJECT_BATCH 64
+
+/**
+ * @fn static int ce_gw_inject_batch(u32 id, struct ce_gw_inject_rec *recs,
+ *                                   s32 *status, unsigned int n)
+ * @brief Sends records which are already copied from user space
+ * @param id ID of the route
+ * @param recs The records
+ * @param status Returns the status of every record
+ * @param n Number of records
+ * @retval 0 on success
+ * @retval -ENOENT if the route does not exist (anymore)
+ * @ingroup proc
+ */
+static int ce_gw_inject_batch(u32 id, struct ce_gw_inject_rec *recs,
+                              s32 *status, unsigned int n)
+{
+	struct ce_gw_job *gwj;
+	unsigned int i;
+	int err = 0;
+
+	rcu_read_lock();
+	/* same context as ce_gw_eth_rcv() in ndo_start_xmit */
+	local_bh_disable();
+
+	gwj = ce_gw_job_find_rcu(id);
+	if (gwj == NULL) {
+		err = -ENOENT;
+		goto out;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (recs[i].reserved != 0 ||
+		    (recs[i].flags & ~CE_GW_INJECT_FD) != 0) {
+			status[i] = -EINVAL;
+			continue;
+		}
+		status[i] = ce_gw_job_inject(gwj, &recs[i].frame,
+		                             recs[i].flags & CE_GW_INJECT_FD);
+	}
+
+out:
+	local_bh_enable();
+	rcu_read_unlock();
+	return err;
+}
+
+/**
+ * @fn static long ce_gw_inject_ioctl(struct file *file, unsigned int cmd,
+ *                                    unsigned long arg)
+ * @brief Character device ioctl(), handles #CE_GW_IOC_INJECT
+ * @retval 0 if all records were processed, see ce_gw_inject.status
+ * @retval -EFAULT on invalid pointers
+ * @retval -ENOENT if the route does not exist
+ * @retval -ENOTTY on unknown commands
+ * @details The records are copied and sent in batches of
+ *          #CE_GW_INJECT_BATCH. ce_gw_inject.done tells how many were
+ *          processed if an error occurs in the middle.
+ * @ingroup proc
+ */
+static long ce_gw_inject_ioctl(struct file *file, unsigned int cmd,
+                               unsigned long arg)
+{
+	struct ce_gw_inject __user *uarg = (struct ce_gw_inject __user *) arg;
+	struct ce_gw_inject inj;
+	struct ce_gw_inject_rec *recs;
+	s32 *status;
+	unsigned int n;
+	int err = 0;
+
+	if (cmd != CE_GW_IOC_INJECT)
+		return -ENOTTY;
+
+	if (copy_from_user(&inj, uarg, sizeof(inj)))
+		return -EFAULT;
+	if (inj.reserved != 0)
+		return -EINVAL;
+
+	recs = kmalloc_array(CE_GW_INJECT_BATCH, sizeof(*recs), GFP_KERNEL);
+	status = kmalloc_array(CE_GW_INJECT_BATCH, sizeof(*status),
+	                       GFP_KERNEL);
+	if (recs == NULL || status == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (inj.done = 0; inj.done < inj.count; inj.done += n) {
+		n = min_t(unsigned int, inj.count - inj.done,
+		          CE_GW_INJECT_BATCH);
+
+		if (copy_from_user(recs, u64_to_user_ptr(inj.recs) +
+		                   (size_t) inj.done * sizeof(*recs),
+		                   n * sizeof(*recs))) {
+			err = -EFAULT;
+			break;
+		}
+
+		err = ce_gw_inject_batch(inj.id, recs, status, n);
+		if (err != 0)
+			break;
+
+		if (inj.status != 0 &&
+		    copy_to_user(u64_to_user_ptr(inj.status) +
+		                 (size_t) inj.done * sizeof(*status),
+		                 status, n * sizeof(*status))) {
+			err = -EFAULT;
+			break;
+		}
+
+		cond_resched();
+	}
+
+	if (put_user(inj.done, &uarg->done))
+		err = -EFAULT;
+
+out:
+	kfree(recs);
+	kfree(status);
+	return err;
+}
+
+static const struct file_operations ce_gw_inject_fops = {
+	.owner = THIS_MODULE,
+	.unlocked_ioctl = ce_gw_inject_ioctl,
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
+	.compat_ioctl = compat_ptr_ioctl,
+#	endif
+};
+
+static struct miscdevice ce_gw_inject_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "cegw",
+	.fops = &ce_gw_inject_fops,
+};
+
+int ce_gw_inject_init(void)
+{
+	return misc_register(&ce_gw_inject_misc);
+}
+
+void ce_gw_inject_exit(void)
+{
+	misc_deregister(&ce_gw_inject_misc);
+}
+
+/**@}*/
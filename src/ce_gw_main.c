@@ -6,6 +6,8 @@
  * @defgroup get Getter & Setter
  * @defgroup dev Device
  * @defgroup net Netlink
+ * @defgroup tx Transmission
+ * @defgroup defer Deferred Processing
  * @file ce_gw_main.c
  * @brief Control Area Network - Ethernet - Gateway - Device
  * @author Stefan Smarzly (stefan.smarzly@in.tum.de)
@@ -105,8 +107,9 @@
 *  |        |   union     |       |u32 id                |      |   union     |
 *  +--------+-------------+       |enum ce_gw_type type  |      +-------------+
 *           |             |<>-----|u32 flags             |----<>|             |
-*           +-------------+  dst/ |u32 handled_frames    | src/ +-------------+
-*                            src  |u32 dropped_frames    | dst
+*           +-------------+  dst/ |ce_gw_xlat_fn xlat    | src/ +-------------+
+*                            src  |struct ce_gw_job_stats| dst
+*                                 |__percpu *stats       |
 *                                 |union { struct can_   |
 *                                 |filter can_rcv_filter}|
 *                                 +----------------------+
@@ -122,6 +125,8 @@
 #include <linux/skbuff.h>	/* sk_buff for receive */
 #include "ce_gw_dev.h"
 #include "ce_gw_netlink.h"
+#include "ce_gw_skb.h"
+#include "ce_gw_inject.h"
 #include <uapi/linux/can.h>	/* since kernel 3.7 in uapi/linux/ */
 #include <uapi/linux/if_arp.h>  /* Net_device types */
 #include <linux/can/core.h>	/* for can_rx_register and can_send */
@@ -130,12 +135,17 @@
 #include <linux/if_ether.h>	/* for using ethernet header */
 #include <linux/netdevice.h>
 #include <linux/crc32.h>	/* for calculating crc checksum */
+#include <linux/jhash.h>	/* flow hash for RPS/RFS */
+#include <linux/version.h>
 #include "ce_gw_main.h"
 #include <net/ip.h>
 #include <asm-generic/errno-base.h>
 #include <asm-generic/errno.h>
 
 #include <linux/can/dev.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+#include <linux/can/skb.h>	/* for can_skb_reserve */
+#endif
 
 MODULE_DESCRIPTION("Control Area Network - Ethernet - Gateway");
 MODULE_LICENSE("GPL");
@@ -147,6 +157,19 @@ MODULE_ALIAS("can_eth_gateway");
 HLIST_HEAD(ce_gw_job_list);
 static struct kmem_cache *ce_gw_job_cache __read_mostly;
 static int job_count = 1;	/* reserve 0 for removing all routes */
+/* Fan-out groups of CAN -> ETH routes, see struct ce_gw_group */
+static HLIST_HEAD(ce_gw_group_list);
+/* Physical ethernet sources of ETH -> CAN routes, see struct ce_gw_eth_src */
+static HLIST_HEAD(ce_gw_eth_src_list);
+
+static unsigned int loop_mark = 0xce6a0000;
+module_param(loop_mark, uint, S_IRUGO);
+MODULE_PARM_DESC(loop_mark, "skb->mark of frames forwarded by the gateway, "
+                 "the lowest 8 bit count the hops. 0 disables the loop "
+                 "detection (default 0xce6a0000)");
+
+/** Bits of skb->mark which count the gateway hops, see loop_mark */
+#define CE_GW_HOPS_MASK 0xff
 
 /* Prototypes for testing */
 static void list_jobs(void);
@@ -158,63 +181,142 @@ struct hlist_head *ce_gw_get_job_list(void) {
 	return &ce_gw_job_list;
 }
 
-struct can_frame *ce_gw_alloc_can_frame(void) {
-	struct can_frame *memory;
-	memory = kmalloc(sizeof(struct can_frame),GFP_KERNEL);
-	return memory;
+void ce_gw_get_header_can(struct can_frame *cf, canid_t can_id,
+                          __u8 can_dlc, const __u8 *payload)
+{
+	u8 len = min_t(u8, can_dlc, CAN_MAX_DLEN);
+
+	cf->can_id = can_id;
+	cf->can_dlc = len;
+	memcpy(cf->data, payload, len);
+	memset(cf->data + len, 0, CAN_MAX_DLEN - len);
 }
 
-void ce_gw_free_can_frame(struct can_frame *memory)
+
+void ce_gw_get_header_canfd(struct canfd_frame *cfd, canid_t id, __u8 len,
+                            __u8 flags, const __u8 *data)
 {
-	kfree (memory);
+	len = min_t(u8, len, CANFD_MAX_DLEN);
+
+	cfd->can_id = id;
+	cfd->len = len;
+	cfd->flags = flags;
+	cfd->__res0 = 0;
+	cfd->__res1 = 0;
+	memcpy(cfd->data, data, len);
+	memset(cfd->data + len, 0, CANFD_MAX_DLEN - len);
 }
 
+/**
+ * @fn static struct sk_buff *ce_gw_alloc_canfd_skb(struct net_device *dev,
+ *                                                 struct canfd_frame **cfd)
+ * @brief Allocates an sk_buff for a CAN FD frame like alloc_can_skb()
+ * @param dev The CAN device which will send the frame
+ * @param cfd Returns the zeroed CAN FD frame in the sk_buff
+ * @retval NULL if the allocation failed
+ * @ingroup alloc
+ */
+static struct sk_buff *ce_gw_alloc_canfd_skb(struct net_device *dev,
+                                             struct canfd_frame **cfd)
+{
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,15,0)
+	return alloc_canfd_skb(dev, cfd);
+#	else
+	struct sk_buff *skb;
 
-struct canfd_frame *ce_gw_alloc_canfd_frame(void) {
-	struct canfd_frame *memory;
-	memory = kmalloc(sizeof(struct canfd_frame), GFP_KERNEL);
-	return memory;
-}
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	skb = netdev_alloc_skb(dev, sizeof(struct can_skb_priv) +
+	                       sizeof(struct canfd_frame));
+#	else
+	skb = netdev_alloc_skb(dev, sizeof(struct canfd_frame));
+#	endif
+	if (skb == NULL)
+		return NULL;
 
+	skb->protocol = htons(ETH_P_CANFD);
+	skb->pkt_type = PACKET_BROADCAST;
+	skb->ip_summed = CHECKSUM_UNNECESSARY;
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	can_skb_reserve(skb);
+	can_skb_prv(skb)->ifindex = dev->ifindex;
+#	endif
 
-void ce_gw_free_canfd_frame(struct canfd_frame *memory)
-{
-	kfree (memory);
+	*cfd = (struct canfd_frame *) skb_put(skb, sizeof(struct canfd_frame));
+	memset(*cfd, 0, sizeof(struct canfd_frame));
+
+	return skb;
+#	endif
 }
 
+/**
+ * @fn static inline u8 ce_gw_get_hops(struct sk_buff *skb)
+ * @brief Returns how often a frame was already forwarded by the gateway
+ * @param skb CAN or ethernet frame received by a route
+ * @retval 0 the frame does not come from the gateway
+ * @details The gateway tags the frames it forwards with loop_mark in
+ *          skb->mark. The mark is kept by the clones of the CAN loopback and
+ *          by the echo skb of CAN drivers, so frames looped back into the
+ *          gateway are recognized.
+ * @ingroup trans
+ */
+static inline u8 ce_gw_get_hops(struct sk_buff *skb)
+{
+	u32 mark = loop_mark & ~CE_GW_HOPS_MASK;
 
-struct can_frame *ce_gw_get_header_can(canid_t can_id, __u8 can_dlc, __u8
-                                       *payload) {
-	struct can_frame *new_can_frame = ce_gw_alloc_can_frame();
-	if (new_can_frame == NULL) {
-		printk (KERN_ERR "ce_gw_main.c: kmalloc failed in function"
-		        "ce_gw_get_header_can \n");
-		return NULL;
-	}
-	new_can_frame->can_id = can_id;
-	new_can_frame->can_dlc = can_dlc;
-	*(u64 *)new_can_frame->data = *(u64 *)payload;
-	return new_can_frame;
+	if (mark == 0 || (skb->mark & ~CE_GW_HOPS_MASK) != mark)
+		return 0;
+
+	return skb->mark & CE_GW_HOPS_MASK;
 }
 
+/**
+ * @fn static inline void ce_gw_set_hops(struct sk_buff *skb, u8 hops)
+ * @brief Tags a frame forwarded by the gateway, see ce_gw_get_hops()
+ * @param skb The translated CAN or ethernet frame
+ * @param hops Number of times the frame passed the gateway
+ * @ingroup trans
+ */
+static inline void ce_gw_set_hops(struct sk_buff *skb, u8 hops)
+{
+	u32 mark = loop_mark & ~CE_GW_HOPS_MASK;
 
-struct canfd_frame *ce_gw_get_header_canfd(canid_t id, __u8 len, __u8 flags,
-                __u8 res0, __u8 res1, __u8 *data) {
-	struct canfd_frame *canfd = ce_gw_alloc_canfd_frame();
-	if (canfd == NULL) {
-		printk (KERN_ERR "ce_gw_main.c: kmalloc failed in function"
-		        "ce_gw_get_header_canfd\n");
-		return NULL;
-	}
+	if (mark != 0)
+		skb->mark = mark | hops;
+}
 
-	canfd->can_id = id;
-	canfd->len = len;
-	canfd->flags = flags;
-	canfd->__res0 = res0;
-	canfd->__res1 = res1;
-	*(u64 *)canfd->data = *(u64 *)data;
+/**
+ * Hops of the frames which ce_gw_can_fwd() redirected with XDP while
+ * ce_gw_xdp_flush() flushes them. A redirect to a gateway device reaches
+ * ce_gw_eth_rcv_buf() on the same CPU during the flush, without a sk_buff for
+ * the mark.
+ */
+static DEFINE_PER_CPU(u8, ce_gw_xdp_hops);
 
-	return canfd;
+/**
+ * @fn static inline void ce_gw_set_flow_hash(struct sk_buff *eth_skb,
+ *                                           struct net_device *can_dev,
+ *                                           canid_t can_id)
+ * @brief tags an sk_buff with a flow hash of CAN source device and CAN ID
+ * @param eth_skb The translated sk_buff which will be passed to the OS.
+ * @param can_dev The device where the CAN frame was received.
+ * @param can_id The CAN ID of the received frame.
+ * @ingroup trans
+ * @details The hash is marked as L4 hash, so RPS/RFS on the cegw device use it
+ * directly for steering instead of dissecting the frame. All frames of one
+ * CAN ID on one bus end up on the same CPU, so their order is kept.
+ */
+static inline void ce_gw_set_flow_hash(struct sk_buff *eth_skb,
+                                       struct net_device *can_dev,
+                                       canid_t can_id)
+{
+	u32 hash = jhash_2words(can_dev->ifindex, can_id, 0);
+
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,14,0)
+	skb_set_hash(eth_skb, hash, PKT_HASH_TYPE_L4);
+#	else
+	eth_skb->rxhash = hash;
+	eth_skb->l4_rxhash = 1;
+#	endif
 }
 
 /**
@@ -276,12 +378,14 @@ void ce_gw_can2net(struct sk_buff *eth_skb, struct sk_buff *can_skb,
  *                                  struct net_device *eth_dev,
  *                                  struct net_device *can_dev,
  *                                  unsigned char *mac_dst,
- *                                  unsigned char *mac_src)
+ *                                  unsigned char *mac_src,
+ *                                  struct ce_gw_skb_reserve *res)
  * @param can_skb The sk_buff where the can-frame is located.
  * @param eth_dev The device which will redirect the eth_skb.
  * @param can_dev The device where can_skb was received.
  * @param mac_dst The dest MAC Address for the eth_skb.
  * @param mac_src The source MAC Address for the eth_skb
+ * @param res Reserve of the route if the allocation fails, may be disabled
  * @warning you must free can_skb yourself
  * @retval NULL if an error occured
  * @retval sk_buff An allocated sk_buff with an ethernet header and the
@@ -296,11 +400,16 @@ struct sk_buff *ce_gw_can2net_alloc(struct sk_buff *can_skb,
                                     struct net_device *eth_dev,
                                     struct net_device *can_dev,
                                     unsigned char *mac_dst,
-                                    unsigned char *mac_src) {
+                                    unsigned char *mac_src,
+                                    struct ce_gw_skb_reserve *res) {
 	int err;
 	struct sk_buff *eth_skb;
-	eth_skb = netdev_alloc_skb(eth_dev, sizeof(struct ethhdr) +
-	                           sizeof(struct can_frame));
+	eth_skb = ce_gw_skb_alloc(eth_dev, sizeof(struct ethhdr) +
+	                          sizeof(struct can_frame));
+	if (eth_skb == NULL)
+		eth_skb = ce_gw_skb_reserve_alloc(res, eth_dev,
+		                                  sizeof(struct ethhdr) +
+		                                  sizeof(struct can_frame));
 	if (eth_skb == NULL) {
 		err = -ENOMEM;
 		pr_err("ce_gw: Error during ce_gw_can2net_alloc: %d\n", err);
@@ -311,6 +420,8 @@ struct sk_buff *ce_gw_can2net_alloc(struct sk_buff *can_skb,
 	/* On CAN only broatcast possible */
 	eth_skb->pkt_type = PACKET_BROADCAST;
 	ce_gw_can2net(eth_skb, can_skb, eth_dev, can_dev, mac_dst, mac_src);
+	ce_gw_set_flow_hash(eth_skb, can_dev,
+	                    ((struct can_frame *) can_skb->data)->can_id);
 
 	return eth_skb;
 
@@ -321,14 +432,17 @@ ce_gw_can2net_alloc_error:
 
 /**
  * @fn struct sk_buff *ce_gw_net2can_alloc(struct sk_buff *eth_skb,
- *                                         struct net_device *can_dev)
+ *                                         struct net_device *can_dev,
+ *                                         struct ce_gw_skb_reserve *res)
  * @brief for CE_GW_TYPE_NET: Copy the can-frame from eth_skb to a new can skb.
  * @param eth_skb An ethernet header as hardware layer and a can-frame as
  * network layer.
  * @param can_dev CAN net device where the package will be later redirect to
  * (this function does not redirect)
+ * @param res Reserve of the route if the allocation fails, may be disabled
  * @warning you must free eth_skb yourself
- * @retval NULL on error
+ * @retval NULL on error, also if eth_skb is shorter than a can-frame or its
+ *         can_dlc is above CAN_MAX_DLEN
  * @retval sk_buff on success including can-frame
  * @ingroup trans
  * @details Copy the can-frame from the network layer in eth_skb to hardware
@@ -336,25 +450,34 @@ ce_gw_can2net_alloc_error:
  * settings. The returned sk_buff will be set to a PACKET_BROADCAST.
  */
 struct sk_buff *ce_gw_net2can_alloc(struct sk_buff *eth_skb,
-                                    struct net_device *can_dev) {
+                                    struct net_device *can_dev,
+                                    struct ce_gw_skb_reserve *res) {
 	int err;
 
 	/* No transport layer */
 	/* No network layer */
 
+	/* Get Can frame at network layer start before the reserve is used,
+	 * the frame may be short or not linear */
+	struct can_frame frame;
+	if (skb_copy_bits(eth_skb, skb_network_offset(eth_skb), &frame,
+	                  sizeof(frame)) != 0 || frame.can_dlc > CAN_MAX_DLEN)
+		return NULL;
+
 	/* hardware (mac) layer */
 	struct sk_buff *can_skb;
 	/* canf is the pointer where you can later copy the data to buffer */
 	struct can_frame *canf;
 	can_skb = alloc_can_skb(can_dev, &canf);
+	if (!can_skb)
+		can_skb = ce_gw_skb_reserve_can(res, can_dev, &canf);
 	if (!can_skb) {
 		err = -ENOMEM;
 		pr_err("ce_gw: Allocation failed: %d\n", err);
 		goto ce_gw_net2can_alloc_error;
 	}
 
-	/* Get Can frame at network layer start */
-	memcpy(canf, skb_network_header(eth_skb), sizeof(struct can_frame));
+	memcpy(canf, &frame, sizeof(struct can_frame));
 
 	return can_skb;
 
@@ -424,12 +547,14 @@ void ce_gw_canfd2net(struct sk_buff *eth_skb, struct sk_buff *can_skb,
  *                                    struct net_device *eth_dev,
  *                                    struct net_device *can_dev,
  *                                    unsigned char *mac_dst,
- *                                    unsigned char *mac_src)
+ *                                    unsigned char *mac_src,
+ *                                    struct ce_gw_skb_reserve *res)
  * @param can_skb The sk_buff where the canfd-frame is located.
  * @param eth_dev The device which will redirect the eth_skb.
  * @param can_dev The device where can_skb was received.
  * @param mac_dst The dest MAC Address for the eth_skb.
  * @param mac_src The source MAC Address for the eth_skb
+ * @param res Reserve of the route if the allocation fails, may be disabled
  * @warning you must free can_skb yourself
  * @retval NULL if an error occured
  * @retval sk_buff An allocated sk_buff with an ethernet header and the
@@ -445,11 +570,16 @@ struct sk_buff *ce_gw_canfd2net_alloc(struct sk_buff *can_skb,
                                       struct net_device *eth_dev,
                                       struct net_device *can_dev,
                                       unsigned char *mac_dst,
-                                      unsigned char *mac_src) {
+                                      unsigned char *mac_src,
+                                      struct ce_gw_skb_reserve *res) {
 	int err;
 	struct sk_buff *eth_skb;
-	eth_skb = netdev_alloc_skb(eth_dev, sizeof(struct ethhdr) +
-	                           sizeof(struct canfd_frame));
+	eth_skb = ce_gw_skb_alloc(eth_dev, sizeof(struct ethhdr) +
+	                          sizeof(struct canfd_frame));
+	if (eth_skb == NULL)
+		eth_skb = ce_gw_skb_reserve_alloc(res, eth_dev,
+		                                  sizeof(struct ethhdr) +
+		                                  sizeof(struct canfd_frame));
 	if (eth_skb == NULL) {
 		err = -ENOMEM;
 		pr_err("ce_gw: Allocation failed: %d\n", err);
@@ -460,7 +590,9 @@ struct sk_buff *ce_gw_canfd2net_alloc(struct sk_buff *can_skb,
 	            sizeof(struct canfd_frame));
 	eth_skb->pkt_type = PACKET_BROADCAST;
 
-	ce_gw_can2net(eth_skb, can_skb, eth_dev, can_dev, mac_dst, mac_src);
+	ce_gw_canfd2net(eth_skb, can_skb, eth_dev, can_dev, mac_dst, mac_src);
+	ce_gw_set_flow_hash(eth_skb, can_dev,
+	                    ((struct canfd_frame *) can_skb->data)->can_id);
 	return eth_skb;
 
 ce_gw_can2net_alloc_error:
@@ -478,14 +610,14 @@ ce_gw_can2net_alloc_error:
  * @param can_dev CAN net device where the package will be later redirect to
  * (this function does not redirect)
  * @warning you must free eth_skb yourself
- * @retval NULL on error
+ * @retval NULL on error, also if eth_skb is shorter than a canfd-frame or its
+ *         len is above CANFD_MAX_DLEN
  * @retval sk_buff on success including canfd-frame
  * @ingroup trans
  * @details Copy the canfd-frame from the network layer in eth_skb to hardware
  * layer in a new sk_buff. This Function allocates a new sk_buff and set some
  * settings. The returned sk_buff will be set to a PACKET_BROADCAST.
  * @todo not tested yet.
- * @todo there might be a better way to allocted the new skb.
  */
 struct sk_buff *ce_gw_net2canfd_alloc(struct sk_buff *eth_skb,
                                       struct net_device *can_dev,
@@ -495,32 +627,25 @@ struct sk_buff *ce_gw_net2canfd_alloc(struct sk_buff *eth_skb,
 	/* No transport layer */
 	/* No network layer */
 
+	/* get canfd_frame, it may be short or not linear */
+	struct canfd_frame frame;
+	if (skb_copy_bits(eth_skb, skb_network_offset(eth_skb), &frame,
+	                  sizeof(frame)) != 0 || frame.len > CANFD_MAX_DLEN)
+		return NULL;
+
 	/* hardware layer */
 	struct sk_buff *can_skb;
-	/* canf is the pointer where you can later copy the data to buffer */
-	struct can_frame *canf;
-	can_skb = alloc_can_skb(can_dev, &canf);
+	/* canfdf is the pointer where you can later copy the data to buffer */
+	struct canfd_frame *canfdf;
+	can_skb = ce_gw_alloc_canfd_skb(can_dev, &canfdf);
 	if (can_skb == NULL) {
 		err = -ENOMEM;
 		pr_err("ce_gw: Allocation failed: %d\n", err);
 		goto ce_gw_net2can_alloc_error;
 	}
 
-	/* expand the sk_buff because alloc_can_skb only allocates space for
-	 * an can_frame and not the larger canfd_frame. So it will be
-	 * expanded by the difference
-	 * TODO This is quite a bad idea but there is no alloc_can_skb function
-	 * for canfd_frame. Anyway there might exist a better way */
-	skb_copy_expand(can_skb, 0, sizeof(struct canfd_frame) -
-	                sizeof(struct can_frame), GFP_ATOMIC);
-	skb_put(can_skb, sizeof(struct canfd_frame) - sizeof(struct can_frame));
-	can_skb->protocol = htons(ETH_P_CANFD);
-
-	struct canfd_frame *canfdf;
-	canfdf = (struct canfd_frame *) canf;
-
 	/* copy canfd_frame */
-	memcpy(canfdf, skb_network_header(eth_skb), sizeof(struct canfd_frame));
+	memcpy(canfdf, &frame, sizeof(struct canfd_frame));
 
 	return can_skb;
 
@@ -530,206 +655,149 @@ ce_gw_net2can_alloc_error:
 }
 
 
-struct sk_buff *ce_gw_can_to_eth(unsigned char *dest, unsigned char *source,
-                                 __be16 type, struct sk_buff *can_buffer, struct
-                                 net_device *dev) {
-	struct can_frame *can_frame_skb = (struct can_frame *)
-	                                  can_buffer->data;
+/**
+ * @fn static struct sk_buff *ce_gw_payload_to_eth(unsigned char *dest,
+ *                                      unsigned char *source, __be16 type,
+ *                                      const __u8 *payload, unsigned int len,
+ *                                      struct net_device *dev,
+ *                                      unsigned int headroom)
+ * @brief Builds an ethernet frame with the payload of a CAN or CAN FD frame
+ * @param dest MAC address of destination
+ * @param source MAC address of source
+ * @param type type of layer3 message
+ * @param payload data of the CAN frame
+ * @param len length of param payload
+ * @param dev device of destination
+ * @param headroom additional headroom in front of the ethernet header
+ * @retval NULL if the allocation failed
+ * @details The only allocation is the returned sk_buff with exactly the
+ * space needed.
+ * @ingroup trans
+ */
+static struct sk_buff *ce_gw_payload_to_eth(unsigned char *dest,
+                                            unsigned char *source,
+                                            __be16 type, const __u8 *payload,
+                                            unsigned int len,
+                                            struct net_device *dev,
+                                            unsigned int headroom)
+{
+	struct sk_buff *eth_skb;
 	struct ethhdr *ethhdr;
-	u8 canlen = can_dlc2len(can_frame_skb->can_dlc);
-	struct sk_buff *eth_skb = dev_alloc_skb(sizeof(struct ethhdr) + sizeof
-	                                        (struct can_frame) + 64);
+
+	eth_skb = ce_gw_skb_alloc(dev, headroom + ETH_HLEN + len);
 	if (eth_skb == NULL) {
-		printk (KERN_ERR "ce_gw_main.c: kmalloc failed in function"
-		        "ce_gw_can_to_eth \n");
+		pr_err("ce_gw: Allocation failed in ce_gw_payload_to_eth\n");
 		return NULL;
 	}
-	eth_skb->dev = dev;
-
-	/*updates data pointer to tail */
-	skb_reserve(eth_skb, sizeof(struct ethhdr) + sizeof(struct can_frame) +
-	            64);
-	/*updates data pointer to start of network header*/
-	eth_skb->data = skb_push(eth_skb, (const int) canlen);
-
-	/*copys data from can sk buffer into ethernet sk buffer */
-	memcpy(eth_skb->data, can_buffer->data + sizeof(struct can_frame) -
-	       - canlen, canlen);
-	/*update network_header */
-	skb_set_network_header(eth_skb, 0);
-	/*updates transport header */
-	skb_set_transport_header(eth_skb, (const int) canlen);
+	skb_reserve(eth_skb, headroom);
 
-	/*updates data pointer to mac header */
-	eth_skb->data = skb_push(eth_skb, (const int) sizeof(struct ethhdr));
-	/*updates mac_header*/
-	skb_set_mac_header(eth_skb, 0);
-	/*fills ethhdr with data */
-	ethhdr = eth_hdr(eth_skb);
+	/* mac header */
+	ethhdr = (struct ethhdr *) skb_put(eth_skb, ETH_HLEN);
+	skb_reset_mac_header(eth_skb);
 	memcpy(ethhdr->h_dest, dest, ETH_ALEN);
 	memcpy(ethhdr->h_source, source, ETH_ALEN);
 	ethhdr->h_proto = type;
 
+	/* network header, there is no transport layer */
+	skb_set_network_header(eth_skb, ETH_HLEN);
+	memcpy(skb_put(eth_skb, len), payload, len);
+	skb_set_transport_header(eth_skb, ETH_HLEN + len);
+
+	return eth_skb;
+}
+
+
+struct sk_buff *ce_gw_can_to_eth(unsigned char *dest, unsigned char *source,
+                                 __be16 type, struct sk_buff *can_buffer,
+                                 struct net_device *dev,
+                                 unsigned int headroom)
+{
+	struct can_frame *cf = (struct can_frame *) can_buffer->data;
+	struct sk_buff *eth_skb;
+
+	eth_skb = ce_gw_payload_to_eth(dest, source, type, cf->data,
+	                               min_t(u8, cf->can_dlc, CAN_MAX_DLEN),
+	                               dev, headroom);
+	if (eth_skb != NULL)
+		ce_gw_set_flow_hash(eth_skb, can_buffer->dev, cf->can_id);
+
 	return eth_skb;
 }
 
 
 struct sk_buff *ce_gw_canfd_to_eth(unsigned char *dest, unsigned char *source,
                                    __be16 type, struct sk_buff *canfd_skb,
-                                   struct net_device *dev) {
-	struct sk_buff *eth_skb = dev_alloc_skb(sizeof(struct ethhdr) +
-	                                        sizeof(struct canfd_frame) + 64);
-	if (eth_skb == NULL) {
-		printk (KERN_ERR "ce_gw_main.c: kmalloc failed in function"
-		        "ce_gw_canfd_to_eth \n");
-		return NULL;
-	}
-	struct ethhdr *ethhdr;
-	struct canfd_frame *canfd_frame_skb = (struct canfd_frame *)
-	                                      canfd_skb->data;
-	u8 canlen = can_dlc2len(canfd_frame_skb->len);
-	unsigned int iplen = ip_hdrlen(canfd_skb);
-	eth_skb->dev = dev;
-
-	/*updates data pointer to tail */
-	skb_reserve(eth_skb, sizeof(struct ethhdr) + sizeof(struct canfd_frame)
-	            + 64);
-	/*updates data pointer to start of network header*/
-	eth_skb->data = skb_push(eth_skb, (const int) canlen);
-
-	/*copys data from canfd sk buffer into ethernet sk buffer */
-	memcpy(eth_skb->data, canfd_skb->data + sizeof(struct canfd_frame) -
-	       sizeof(__u8)*64, canlen);
-	/*update network_header */
-	skb_set_network_header(eth_skb, 0);
-	/*updates transport header */
-	if (canlen >= iplen) {
-		skb_set_transport_header(eth_skb, (const int) iplen);
-	} else {
-		skb_set_transport_header(eth_skb, (const int) sizeof(__u8)*64);
-	}
-	/*updates data pointer to start of mac header*/
-	eth_skb->data = skb_push(eth_skb, (const int) sizeof(struct ethhdr));
-	/*updates mac_header*/
-	skb_set_mac_header(eth_skb, 0);
-	/*fills eth_skb with data*/
-	ethhdr = eth_hdr(eth_skb);
-	memcpy(ethhdr->h_dest, &dest, ETH_ALEN);
-	memcpy(ethhdr->h_source, &source, ETH_ALEN);
-	ethhdr->h_proto = type;
+                                   struct net_device *dev,
+                                   unsigned int headroom)
+{
+	struct canfd_frame *cfd = (struct canfd_frame *) canfd_skb->data;
+	struct sk_buff *eth_skb;
+
+	eth_skb = ce_gw_payload_to_eth(dest, source, type, cfd->data,
+	                               min_t(u8, cfd->len, CANFD_MAX_DLEN),
+	                               dev, headroom);
+	if (eth_skb != NULL)
+		ce_gw_set_flow_hash(eth_skb, canfd_skb->dev, cfd->can_id);
 
 	return eth_skb;
 }
 
 
-struct sk_buff *ce_gw_eth_to_can(canid_t id, struct sk_buff *eth_buff, struct
-                                 net_device *dev) {
+struct sk_buff *ce_gw_eth_to_can(canid_t id, struct sk_buff *eth_buff,
+                                 struct net_device *dev, unsigned int len)
+{
 	struct sk_buff *can_buff;
-	struct can_frame *can = ce_gw_alloc_can_frame();
-	if (can == NULL) {
-		printk (KERN_ERR "ce_gw_main.c: kmalloc failed in function"
-		        "ce_gw_eth_to_can \n");
-		return NULL;
-	}
-	unsigned int ethdatalen = (skb_tail_pointer(eth_buff) - (eth_buff->data
-	                           + sizeof(struct ethhdr)));
-	/* unsigned int iplen = ip_hdrlen(eth_buff); */
+	struct can_frame *cf;
 
-	/*fills can header */
-	can->can_id = id;
-	can->can_dlc = (__u8) eth_buff->data_len - sizeof(struct ethhdr);
+	if (eth_buff->len < ETH_HLEN)
+		return NULL;
+	len = min_t(unsigned int, len, eth_buff->len - ETH_HLEN);
+	len = min_t(unsigned int, len, CAN_MAX_DLEN);
 
-	can_buff = dev_alloc_skb(sizeof(struct can_frame) + ethdatalen + 64);
+	can_buff = alloc_can_skb(dev, &cf);
 	if (can_buff == NULL) {
-		printk (KERN_ERR "ce_gw_main.c: kmalloc failed in function"
-		        "ce_gw_eth_to_can \n");
+		pr_err("ce_gw: Allocation failed in ce_gw_eth_to_can\n");
+		return NULL;
+	}
+
+	/* fills can header, the data is copied straight into the frame */
+	cf->can_id = id;
+	cf->can_dlc = len;
+	if (skb_copy_bits(eth_buff, ETH_HLEN, cf->data, len) < 0) {
+		kfree_skb(can_buff);
 		return NULL;
 	}
-	can_buff->dev = dev;
-
-	/*updates data pointer to tail */
-	skb_reserve(can_buff, sizeof(struct can_frame) + ethdatalen + 64);
-	/*updates data pointer to start of network header*/
-	can_buff->data = skb_push(can_buff, (const int) ethdatalen);
-
-	/*copys data from ethernet sk buffer into can buffer */
-	memcpy(can_buff->data, eth_buff->data + sizeof(struct ethhdr),
-	       sizeof(u64));
-	/*update network_header */
-	skb_set_network_header(can_buff, 0);
-	/*updates transport header */
-	skb_set_transport_header(can_buff, (const int) sizeof(u64));
-
-	/*updates data pointer to start of mac header */
-	can_buff->data = skb_push(can_buff, (const int) sizeof(__u32) +
-	                          sizeof(__u8));
-	/*updates mac header */
-	skb_set_mac_header(can_buff, 0);
-	/*copys can header at the beginning of sk buffer */
-	memcpy(skb_mac_header(can_buff), &can->can_id, sizeof(__u32) +
-	       sizeof(__u8));
-
-	ce_gw_free_can_frame(can);
 
 	return can_buff;
 }
 
 
-struct sk_buff *ce_gw_eth_to_canfd(canid_t id, __u8 flags, __u8 res0, __u8
-                                   res1, struct sk_buff *eth_skb, struct
-                                   net_device *dev) {
+struct sk_buff *ce_gw_eth_to_canfd(canid_t id, __u8 flags,
+                                   struct sk_buff *eth_skb,
+                                   struct net_device *dev, unsigned int len)
+{
 	struct sk_buff *canfd_skb;
-	struct canfd_frame *canfd = ce_gw_alloc_canfd_frame();
-	if (canfd == NULL) {
-		printk (KERN_ERR "ce_gw_main.c: kmalloc failed in function"
-		        "ce_gw_eth_to_canfd \n");
+	struct canfd_frame *cfd;
+
+	if (eth_skb->len < ETH_HLEN)
 		return NULL;
-	}
-	/* unsigned int ethdatalen = (skb_tail_pointer(eth_skb) - (eth_skb->data
-	                           + sizeof(struct ethhdr))); */
-	unsigned int iplen = ip_hdrlen(eth_skb);
-
-	/*fills canfd header */
-	canfd->can_id = id;
-	canfd->flags = flags;
-	canfd->__res0 = res0;
-	canfd->__res1 = res1;
-	canfd->len = (__u8) eth_skb->data_len - sizeof(struct ethhdr);
-
-	canfd_skb = dev_alloc_skb(sizeof(struct canfd_frame) + 64);
+	len = min_t(unsigned int, len, eth_skb->len - ETH_HLEN);
+	len = min_t(unsigned int, len, CANFD_MAX_DLEN);
+
+	canfd_skb = ce_gw_alloc_canfd_skb(dev, &cfd);
 	if (canfd_skb == NULL) {
-		printk (KERN_ERR "ce_gw_main.c: kmalloc failed in function"
-		        "ce_gw_eth_to_canfd \n");
+		pr_err("ce_gw: Allocation failed in ce_gw_eth_to_canfd\n");
 		return NULL;
 	}
-	canfd_skb->dev = dev;
-
-	/*updates data pointer to tail */
-	skb_reserve(canfd_skb, sizeof(struct canfd_frame) + 64);
-	/*updates data pointer to start of network header*/
-	canfd_skb->data = skb_push(canfd_skb, (const int) sizeof(__u8)*64);
-
-	/*copys data from ethernet sk buffer into canfd sk buffer */
-	memcpy(canfd_skb->data, eth_skb->data + sizeof(struct ethhdr),
-	       sizeof(__u8)*64);
-	/*update network_header */
-	skb_set_network_header(canfd_skb, 0);
-	/*checks if can data length >= iplen*/
-	/*updates transport header */
-	if (sizeof(__u8)*64 >= iplen) {
-		skb_set_transport_header(canfd_skb, (const int) iplen);
-	} else {
-		skb_set_transport_header(canfd_skb, sizeof(__u8)*64);
+
+	/* fills canfd header, the data is copied straight into the frame */
+	cfd->can_id = id;
+	cfd->flags = flags;
+	cfd->len = len;
+	if (skb_copy_bits(eth_skb, ETH_HLEN, cfd->data, len) < 0) {
+		kfree_skb(canfd_skb);
+		return NULL;
 	}
-	/*updates data pointer to start of mac header */
-	canfd_skb->data = skb_push(canfd_skb, (const int) sizeof(struct
-	                           canfd_frame) - sizeof(__u8)*64);
-	/*updates mac header */
-	skb_set_mac_header(canfd_skb, 0);
-	/*copys canfd header into sk buffer */
-	memcpy(skb_mac_header(canfd_skb), &canfd->can_id, sizeof(struct
-	                canfd_frame) - sizeof(__u8)*64);
-	ce_gw_free_canfd_frame(canfd);
 
 	return canfd_skb;
 }
@@ -756,165 +824,1013 @@ static __u8 ce_gw_get_ip_version(void *payload)
 }
 
 
-void ce_gw_can_rcv(struct sk_buff *can_skb, void *data)
+/**
+ * @fn static struct sk_buff *ce_gw_xlat_can2net(struct sk_buff *can_skb,
+ *                                              struct ce_gw_job *cgj)
+ * @brief Translation of CE_GW_TYPE_NET routes from CAN to ethernet
+ * @param can_skb The received CAN frame
+ * @param cgj The route
+ * @retval NULL for CAN FD frames or if the allocation failed
+ * @ingroup trans
+ */
+static struct sk_buff *ce_gw_xlat_can2net(struct sk_buff *can_skb,
+                                          struct ce_gw_job *cgj)
 {
-	int err = 0;
-	struct can_frame *cf;
-	/* CAN frame (id, dlc, data)*/
-	cf = (struct can_frame *)can_skb->data;
-	pr_debug("Incoming msg from can dev: can_id %x, len %i, can_msg %x\n",
-	         cf->can_id, cf->can_dlc, cf->data[0]);
+	long long dmac = 0xffffffffffff;
+	long long smac = 0x000000000000;
 
-	struct ce_gw_job *cgj = (struct ce_gw_job *)data;
-	struct sk_buff *eth_skb = NULL;
+	/* the gateway device has no MTU for CAN FD frames */
+	if (can_skb->len != CAN_MTU)
+		return NULL;
+
+	return ce_gw_can2net_alloc(can_skb, cgj->dst.dev, cgj->src.dev,
+	                           (unsigned char *) &dmac,
+	                           (unsigned char *) &smac, &cgj->reserve);
+}
 
+/**
+ * @fn static struct sk_buff *ce_gw_xlat_canfd2net(struct sk_buff *can_skb,
+ *                                                struct ce_gw_job *cgj)
+ * @brief Translation of CE_GW_TYPE_NET routes with the #CE_GW_F_CAN_FD flag
+ *        from CAN to ethernet
+ * @param can_skb The received CAN or CAN FD frame
+ * @param cgj The route
+ * @retval NULL if the allocation failed
+ * @ingroup trans
+ */
+static struct sk_buff *ce_gw_xlat_canfd2net(struct sk_buff *can_skb,
+                                            struct ce_gw_job *cgj)
+{
 	long long dmac = 0xffffffffffff;
 	long long smac = 0x000000000000;
 
-	switch (cgj->type) {
+	if (can_skb->len != CANFD_MTU)
+		return ce_gw_xlat_can2net(can_skb, cgj);
 
-	case CE_GW_TYPE_ETH:
-		pr_info("Translation ETH not implemented yet.");
-		break;
+	return ce_gw_canfd2net_alloc(can_skb, cgj->dst.dev, cgj->src.dev,
+	                             (unsigned char *) &dmac,
+	                             (unsigned char *) &smac, &cgj->reserve);
+}
+
+/**
+ * @fn static struct sk_buff *ce_gw_xlat_net2can(struct sk_buff *eth_skb,
+ *                                              struct ce_gw_job *gwj)
+ * @brief Translation of CE_GW_TYPE_NET routes from ethernet to CAN
+ * @param eth_skb The received ethernet frame
+ * @param gwj The route
+ * @retval NULL if the allocation failed or the CAN frame is invalid
+ * @ingroup trans
+ */
+static struct sk_buff *ce_gw_xlat_net2can(struct sk_buff *eth_skb,
+                                          struct ce_gw_job *gwj)
+{
+	return ce_gw_net2can_alloc(eth_skb, gwj->dst.dev, &gwj->reserve);
+}
+
+/**
+ * @fn static struct sk_buff *ce_gw_xlat_net2canfd(struct sk_buff *eth_skb,
+ *                                                struct ce_gw_job *gwj)
+ * @brief Translation of CE_GW_TYPE_NET routes with the #CE_GW_F_CAN_FD flag
+ *        from ethernet to CAN
+ * @param eth_skb The received ethernet frame with a CAN or CAN FD frame
+ * @param gwj The route
+ * @retval NULL if the allocation failed or the CAN frame is invalid
+ * @ingroup trans
+ */
+static struct sk_buff *ce_gw_xlat_net2canfd(struct sk_buff *eth_skb,
+                                            struct ce_gw_job *gwj)
+{
+	if (eth_hdr(eth_skb)->h_proto != htons(ETH_P_CANFD))
+		return ce_gw_xlat_net2can(eth_skb, gwj);
+
+	return ce_gw_net2canfd_alloc(eth_skb, gwj->dst.dev, gwj->src.dev);
+}
 
+/**
+ * @fn static ce_gw_xlat_fn ce_gw_job_xlat(enum ce_gw_type type, u32 flags,
+ *                                        bool to_eth)
+ * @brief Selects the translation of a route
+ * @param type Translation type of the route
+ * @param flags Flags of the route
+ * @param to_eth true for CAN -> ETH, false for ETH -> CAN routes
+ * @retval NULL if the translation type is not implemented
+ * @ingroup trans
+ */
+static ce_gw_xlat_fn ce_gw_job_xlat(enum ce_gw_type type, u32 flags,
+                                    bool to_eth)
+{
+	bool fd = (flags & CE_GW_F_CAN_FD) == CE_GW_F_CAN_FD;
+
+	switch (type) {
 	case CE_GW_TYPE_NET:
-		eth_skb = ce_gw_can2net_alloc(can_skb,
-		                              cgj->dst.dev,
-		                              cgj->src.dev,
-		                              (unsigned char *) &dmac,
-		                              (unsigned char *) &smac);
-		break;
+		if (to_eth)
+			return fd ? ce_gw_xlat_canfd2net : ce_gw_xlat_can2net;
+		else
+			return fd ? ce_gw_xlat_net2canfd : ce_gw_xlat_net2can;
 
+	case CE_GW_TYPE_ETH:
 	case CE_GW_TYPE_TCP:
-		pr_info("Translation IP TCP not implemented yet.");
-		break;
-
 	case CE_GW_TYPE_UDP:
-		pr_info("Translation IP UDP not implemented yet.");
-		break;
+		pr_info("ce_gw: Translation type %d not implemented yet.\n",
+		        type);
+		return NULL;
 
 	default:
-		pr_err("ce_gw: Translation type of ce_gw_job not "
-		       "implemented. BUG: Some module inserted an invalid "
-		       "type. Use enum ce_gw_type instead.");
-		goto drop_frame;
-		break;
+		pr_err("ce_gw: Invalid translation type %d. "
+		       "Use enum ce_gw_type instead.\n", type);
+		return NULL;
+	}
+}
+
+void ce_gw_job_get_stats(const struct ce_gw_job *gwj,
+                         struct ce_gw_job_stats *sum)
+{
+	const struct ce_gw_job_stats *st;
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		st = per_cpu_ptr(gwj->stats, cpu);
+		sum->handled_frames += st->handled_frames;
+		sum->dropped_frames += st->dropped_frames;
+		sum->loop_frames += st->loop_frames;
+		sum->filtered_frames += st->filtered_frames;
 	}
+}
+
+/**
+ * @fn static struct ce_gw_job *ce_gw_job_bpf(struct sk_buff *skb,
+ *                                          struct ce_gw_job *gwj,
+ *                                          unsigned int hlen)
+ * @brief Runs the BPF program of a route on a translated frame
+ * @param skb The translated frame, skb->data points to the header
+ * @param gwj The route, must have a program
+ * @param hlen Length of the header before the CAN frame (ethernet header for
+ *        CAN -> ETH routes, 0 for ETH -> CAN routes)
+ * @retval NULL The program dropped the frame or returned an unknown verdict
+ * @return The route which forwards the frame, param gwj or the route of a
+ *         #CE_GW_BPF_ROUTE verdict
+ * @details The program sees the CAN or CAN FD frame at offset 0 and may
+ *          change it with the usual skb helpers (bpf_skb_load_bytes(),
+ *          bpf_skb_store_bytes() or direct packet access). A clone is
+ *          copied before it is changed. Frames whose length was changed are
+ *          dropped. A redirected frame does not pass the program of the
+ *          other route.
+ * @ingroup proc
+ */
+static struct ce_gw_job *ce_gw_job_bpf(struct sk_buff *skb,
+                                       struct ce_gw_job *gwj,
+                                       unsigned int hlen)
+{
+#	ifdef CE_GW_BPF
+	unsigned int len = skb->len;
+	struct ce_gw_job *to;
+	u32 ret;
+
+	skb->dev = gwj->dst.dev;
+	__skb_pull(skb, hlen);
+	bpf_compute_data_pointers(skb);
+	ret = bpf_prog_run_save_cb(gwj->prog, skb);
+	__skb_push(skb, hlen);
+
+	if (skb->len != len)
+		return NULL;
+
+	if (ret == CE_GW_BPF_PASS)
+		return gwj;
+
+	/* CE_GW_BPF_DROP and everything unknown, e.g. TC_ACT_REDIRECT */
+	if ((ret & CE_GW_BPF_ROUTE_MASK) != CE_GW_BPF_ROUTE(0))
+		return NULL;
+
+	/* the other route must send the same kind of frame */
+	to = ce_gw_job_find_rcu(ret & ~CE_GW_BPF_ROUTE_MASK);
+	if (to == NULL || (to->src.dev->type == ARPHRD_CAN) !=
+	                  (gwj->src.dev->type == ARPHRD_CAN))
+		return NULL;
+	return to;
+#	else
+	return gwj;
+#	endif
+}
 
+/**
+ * @fn static bool ce_gw_can_fwd(struct sk_buff *eth_skb, struct ce_gw_job *cgj)
+ * @brief Passes a translated frame of a CAN -> ETH route to the OS
+ * @param eth_skb The translated frame or a clone of it. NULL if the clone
+ *        failed.
+ * @param cgj The route
+ * @retval true The XDP program of the device redirected the frame, see
+ *         ce_gw_xdp_flush()
+ * @details The XDP program of the destination device sees the frame after
+ *          the modifications and the BPF program of the route.
+ * @ingroup proc
+ */
+static bool ce_gw_can_fwd(struct sk_buff *eth_skb, struct ce_gw_job *cgj)
+{
+	int err;
+
+	if (eth_skb == NULL) {
+		ce_gw_job_inc(cgj, dropped_frames);
+		return false;
+	}
+
+	if (cgj->mod != NULL &&
+	    ce_gw_mod_skb(cgj->mod, eth_skb, sizeof(struct ethhdr)) != 0) {
+		kfree_skb(eth_skb);
+		ce_gw_job_inc(cgj, dropped_frames);
+		return false;
+	}
+
+	if (cgj->prog != NULL) {
+		struct ce_gw_job *to = ce_gw_job_bpf(eth_skb, cgj,
+		                                     sizeof(struct ethhdr));
+		if (to == NULL) {
+			kfree_skb(eth_skb);
+			ce_gw_job_inc(cgj, dropped_frames);
+			return false;
+		}
+		cgj = to;
+	}
+
+	/* eth_skb is consumed unless the program passes it */
+	err = ce_gw_dev_xdp(cgj->dst.dev, &eth_skb);
+	if (err != 0) {
+		if (err > 0) {
+			ce_gw_job_inc(cgj, handled_frames);
+			return true;
+		}
+		ce_gw_job_inc(cgj, dropped_frames);
+		return false;
+	}
+
+	eth_skb->dev = cgj->dst.dev;
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(5,18,0)
+	err = netif_rx(eth_skb);
+#	else
 	err = netif_rx_ni(eth_skb);
+#	endif
 	if (err != 0) {
 		pr_err("ce_gw: send to kernel failed");
-		cgj->dropped_frames++;
-		goto exit_error;
+		ce_gw_job_inc(cgj, dropped_frames);
+		return false;
 	}
-	cgj->handled_frames++;
+	ce_gw_job_inc(cgj, handled_frames);
+	return false;
+}
+
+/**
+ * @fn static void ce_gw_xdp_flush(u8 hops)
+ * @brief Sends the frames the XDP programs redirected in ce_gw_can_fwd()
+ * @param hops Number of times the redirected frames passed the gateway
+ * @details Called once per received frame after all of its routes.
+ * @ingroup proc
+ */
+static void ce_gw_xdp_flush(u8 hops)
+{
+	__this_cpu_write(ce_gw_xdp_hops, hops);
+	ce_gw_dev_xdp_flush();
+	__this_cpu_write(ce_gw_xdp_hops, 0);
+}
+
+void ce_gw_can_rcv(struct sk_buff *can_skb, void *data)
+{
+	struct can_frame *cf;
+	/* CAN frame (id, dlc, data)*/
+	cf = (struct can_frame *)can_skb->data;
+	pr_debug("Incoming msg from can dev: can_id %x, len %i, can_msg %x\n",
+	         cf->can_id, cf->can_dlc, cf->data[0]);
+
+	struct ce_gw_group *grp = (struct ce_gw_group *)data;
+	struct ce_gw_job *cgj = NULL;
+	struct ce_gw_job *last = NULL;
+	struct sk_buff *eth_skb = NULL;
+	bool redirected = false;
+	u8 hops = ce_gw_get_hops(can_skb);
+
+	/* The frame is translated once for the first route. Every route
+	 * gets a clone, only the last one gets the translated frame itself. */
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	hlist_for_each_entry_rcu(cgj, &grp->jobs, list_grp) {
+#	else
+	struct hlist_node *pos;
+	hlist_for_each_entry_rcu(cgj, pos, &grp->jobs, list_grp) {
+#	endif
+		/* frame was sent by the gateway itself and looped back */
+		if (hops >= cgj->hop_limit) {
+			ce_gw_job_inc(cgj, loop_frames);
+			continue;
+		}
+
+		if (cgj->change != NULL &&
+		    !ce_gw_change_pass(cgj->change, can_skb)) {
+			ce_gw_job_inc(cgj, filtered_frames);
+			continue;
+		}
+
+		if (cgj->throttle != NULL &&
+		    !ce_gw_throttle_pass(cgj->throttle, can_skb)) {
+			ce_gw_job_inc(cgj, filtered_frames);
+			continue;
+		}
+
+		if (cgj->ring != NULL) {
+			if (ce_gw_ring_put(cgj->ring, can_skb) != 0)
+				ce_gw_job_inc(cgj, dropped_frames);
+			else
+				ce_gw_job_inc(cgj, handled_frames);
+			continue;
+		}
+
+		if (cgj->flags & CE_GW_F_DEFER) {
+			if (ce_gw_defer(can_skb, cgj) != 0)
+				ce_gw_job_inc(cgj, dropped_frames);
+			continue;
+		}
+
+		if (eth_skb != NULL) {
+			if (ce_gw_can_fwd(skb_clone(eth_skb, GFP_ATOMIC), last))
+				redirected = true;
+			last = cgj;
+			continue;
+		}
+
+		eth_skb = grp->xlat(can_skb, cgj);
+		if (eth_skb == NULL) {
+			ce_gw_job_inc(cgj, dropped_frames);
+			continue;
+		}
+		ce_gw_set_hops(eth_skb, hops + 1);
+		last = cgj;
+	}
+
+	if (last != NULL && ce_gw_can_fwd(eth_skb, last))
+		redirected = true;
+
+	/* one flush for all routes which redirected the frame */
+	if (redirected)
+		ce_gw_xdp_flush(hops + 1);
 
 	/* TODO If you use kfree_skb(can_skb) the system hang up completely
 	 * without printing stack trace. But a few packets normally passed
 	 * before sytem hang up. But <linux/can/dev.h> uses kfree_skb(). There
 	 * is no refdata count left. The reason why hang up is completely
-	 * unknown. */
-exit_error:
-	pr_info("ce_gw: WARNING can skb will not be freed");
-	/*kfree_skb(can_skb);*/
-	return;
-
-drop_frame:
-	cgj->dropped_frames++;
-	dev_kfree_skb(eth_skb);
-	return;
+	 * unknown. (can_skb belongs to af_can, a receiver must not free it) */
 }
 
+/**
+ * @fn static int ce_gw_eth_fwd(struct sk_buff *can_skb, struct ce_gw_job *gwj)
+ * @brief Sends a translated frame of an ETH -> CAN route to its CAN device
+ * @param can_skb The translated frame or a copy of it. NULL if the copy
+ *        failed.
+ * @param gwj The route
+ * @return result of ce_gw_tx_send(), -ENOMEM if param can_skb is NULL,
+ *         -EPERM if the BPF program of the route dropped the frame, result
+ *         of ce_gw_mod_skb() if the modifications failed
+ * @ingroup proc
+ */
+static int ce_gw_eth_fwd(struct sk_buff *can_skb, struct ce_gw_job *gwj)
+{
+	int err;
+
+	if (can_skb == NULL) {
+		ce_gw_job_inc(gwj, dropped_frames);
+		return -ENOMEM;
+	}
+
+	if (gwj->mod != NULL) {
+		err = ce_gw_mod_skb(gwj->mod, can_skb, 0);
+		if (err != 0) {
+			kfree_skb(can_skb);
+			ce_gw_job_inc(gwj, dropped_frames);
+			return err;
+		}
+	}
+
+	if (gwj->prog != NULL) {
+		struct ce_gw_job *to = ce_gw_job_bpf(can_skb, gwj, 0);
+		if (to == NULL) {
+			kfree_skb(can_skb);
+			ce_gw_job_inc(gwj, dropped_frames);
+			return -EPERM;
+		}
+		gwj = to;
+	}
+
+	can_skb->dev = gwj->dst.dev;
+	/* can-gw checks the incoming interface against it */
+	can_skb_prv(can_skb)->ifindex = gwj->dst.dev->ifindex;
+
+	/* send to CAN netdevice, can_skb is consumed also on failure */
+	err = ce_gw_tx_send(gwj, can_skb);
+	if (err < 0)
+		ce_gw_job_inc(gwj, dropped_frames);
+	else if (err == 0)
+		ce_gw_job_inc(gwj, handled_frames);
+	/* else: queued, will be counted by ce_gw_tx_drain() */
+
+	return err;
+}
 
 void ce_gw_eth_rcv(struct sk_buff *eth_skb, void *data)
 {
-	struct ce_gw_job *gwj = (struct ce_gw_job *)data;
-
-	/* Create Can skb and convert incoming Eth sk buffer depending on
-	 * type (ce_gw_type in gwj)
+	struct hlist_head *jobs = (struct hlist_head *)data;
+	struct ce_gw_job *gwj = NULL;
+	struct ce_gw_job *last = NULL;
+	u8 hops = ce_gw_get_hops(eth_skb);
+
+	/* Create Can skb and convert incoming Eth sk buffer with the
+	 * translation of the route. It is translated once for all routes with
+	 * the same translation, the other routes get a copy. Unlike the
+	 * clones of ce_gw_can_rcv() every CAN device needs its own headroom
+	 * for struct can_skb_priv.
 	 */
 	struct sk_buff *can_skb = NULL;
 
-	switch (gwj->type) {
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	hlist_for_each_entry_rcu(gwj, jobs, list_dev) {
+#	else
+	struct hlist_node *pos;
+	hlist_for_each_entry_rcu(gwj, pos, jobs, list_dev) {
+#	endif
+		/* frame was forwarded to ethernet by the gateway and came
+		 * back */
+		if (hops >= gwj->hop_limit) {
+			ce_gw_job_inc(gwj, loop_frames);
+			continue;
+		}
 
-	case CE_GW_TYPE_ETH:
-		pr_info("Translation ETH not implemented yet.");
-		break;
+		if (gwj->flags & CE_GW_F_DEFER) {
+			if (ce_gw_defer(eth_skb, gwj) != 0)
+				ce_gw_job_inc(gwj, dropped_frames);
+			continue;
+		}
+
+		if (can_skb != NULL) {
+			if (gwj->xlat == last->xlat) {
+				ce_gw_eth_fwd(pskb_copy(can_skb, GFP_ATOMIC),
+				              last);
+				last = gwj;
+				continue;
+			}
+			ce_gw_eth_fwd(can_skb, last);
+			last = NULL;
+		}
+
+		can_skb = gwj->xlat(eth_skb, gwj);
+
+		/* Memory allocation or translation ETH -> CAN failed */
+		if (!can_skb) {
+			ce_gw_job_inc(gwj, dropped_frames);
+			continue;
+		}
+
+		struct can_frame *cf;
+		cf = (struct can_frame *)can_skb->data;
+		pr_debug("Incoming msg from eth dev (gwj %i): "
+		         "can_id %x, len %i, can_msg(1) %x\n",
+		         gwj->id, cf->can_id, cf->can_dlc, cf->data[0]);
+
+		/* used by the CE_GW_TX_SCHED_PRIO_SKB scheduler */
+		can_skb->priority = eth_skb->priority;
+		ce_gw_set_hops(can_skb, hops + 1);
+		last = gwj;
+	}
 
-	case CE_GW_TYPE_NET:
-		can_skb = ce_gw_net2can_alloc(eth_skb, gwj->dst.dev);
-		break;
+	if (last != NULL)
+		ce_gw_eth_fwd(can_skb, last);
+}
 
-	case CE_GW_TYPE_TCP:
-		pr_info("Translation IP TCP not implemented yet.");
-		break;
+u8 ce_gw_skb_hops(struct sk_buff *skb)
+{
+	return ce_gw_get_hops(skb);
+}
 
-	case CE_GW_TYPE_UDP:
-		pr_info("Translation IP UDP not implemented yet.");
-		break;
+void ce_gw_job_rcv(struct sk_buff *skb, struct ce_gw_job *gwj)
+{
+	u8 hops = ce_gw_get_hops(skb);
+	struct sk_buff *out;
 
-	default:
-		printk(KERN_ERR "ce_gw: Translation type of ce_gw_job not "
-		       "implemented. BUG: Some module inserted an invalid "
-		       "type. Use enum ce_gw_type instead.");
-		goto drop_frame;
-		break;
+	out = gwj->xlat(skb, gwj);
+	if (out == NULL) {
+		ce_gw_job_inc(gwj, dropped_frames);
+		return;
 	}
+	ce_gw_set_hops(out, hops + 1);
 
-	/* Memory allocation or translation ETH -> CAN failed */
-	if (!can_skb)
-		goto drop_frame;
+	if (gwj->src.dev->type == ARPHRD_CAN) {
+		if (ce_gw_can_fwd(out, gwj))
+			ce_gw_xdp_flush(hops + 1);
+	} else {
+		/* used by the CE_GW_TX_SCHED_PRIO_SKB scheduler */
+		out->priority = skb->priority;
+		ce_gw_eth_fwd(out, gwj);
+	}
+}
+
+struct ce_gw_job *ce_gw_job_find_rcu(u32 id)
+{
+	struct ce_gw_job *gwj = NULL;
+
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	hlist_for_each_entry_rcu(gwj, &ce_gw_job_list, list) {
+#	else
+	struct hlist_node *pos;
+	hlist_for_each_entry_rcu(gwj, pos, &ce_gw_job_list, list) {
+#	endif
+		if (gwj->id == id)
+			return gwj;
+	}
+
+	return NULL;
+}
 
+int ce_gw_job_inject(struct ce_gw_job *gwj, const struct canfd_frame *cfd,
+                     bool fd)
+{
+	struct sk_buff *can_skb;
+	struct canfd_frame *frame;
 	struct can_frame *cf;
-	cf = (struct can_frame *)can_skb->data;
-	pr_debug("Incoming msg from eth dev (gwj %i): "
-	         "can_id %x, len %i, can_msg(1) %x\n",
-	         gwj->id, cf->can_id, cf->can_dlc, cf->data[0]);
 
-	/* send to CAN netdevice (with echo flag for loopback devices) */
-	if (can_send(can_skb, 0x01))
-		goto drop_frame;
+	if (gwj->dst.dev->type != ARPHRD_CAN)
+		return -EINVAL;
+
+	if (fd) {
+		if ((gwj->flags & CE_GW_F_CAN_FD) == 0 ||
+		    cfd->len > CANFD_MAX_DLEN)
+			return -EINVAL;
+
+		can_skb = ce_gw_alloc_canfd_skb(gwj->dst.dev, &frame);
+		if (can_skb == NULL)
+			return -ENOMEM;
+		memcpy(frame, cfd, sizeof(struct canfd_frame));
+	} else {
+		if (cfd->len > CAN_MAX_DLEN)
+			return -EINVAL;
+
+		can_skb = alloc_can_skb(gwj->dst.dev, &cf);
+		if (can_skb == NULL)
+			can_skb = ce_gw_skb_reserve_can(&gwj->reserve,
+			                                gwj->dst.dev, &cf);
+		if (can_skb == NULL)
+			return -ENOMEM;
+		memcpy(cf, cfd, sizeof(struct can_frame));
+	}
+
+	/* the frame comes from the gateway like a translated one */
+	ce_gw_set_hops(can_skb, 1);
+
+	return ce_gw_eth_fwd(can_skb, gwj);
+}
+
+/**
+ * @fn static struct sk_buff *ce_gw_buf2can(const u8 *data, bool fd,
+ *                                         struct ce_gw_job *gwj)
+ * @brief for CE_GW_TYPE_NET: Copies a CAN or CAN FD frame from a buffer into a
+ *        new CAN sk_buff
+ * @param data The CAN or CAN FD frame after the ethernet header
+ * @param fd true for a CAN FD frame
+ * @param gwj The route, gives the CAN device and the reserve
+ * @retval NULL if the allocation failed or the DLC is invalid
+ * @ingroup trans
+ */
+static struct sk_buff *ce_gw_buf2can(const u8 *data, bool fd,
+                                     struct ce_gw_job *gwj)
+{
+	struct sk_buff *can_skb;
+	struct canfd_frame *cfd;
+	struct can_frame *cf;
+
+	/* len and can_dlc are at the same offset */
+	if (((const struct canfd_frame *) data)->len >
+	    (fd ? CANFD_MAX_DLEN : CAN_MAX_DLEN))
+		return NULL;
+
+	if (fd) {
+		can_skb = ce_gw_alloc_canfd_skb(gwj->dst.dev, &cfd);
+		if (can_skb != NULL)
+			memcpy(cfd, data, sizeof(struct canfd_frame));
+		return can_skb;
+	}
+
+	can_skb = alloc_can_skb(gwj->dst.dev, &cf);
+	if (can_skb == NULL)
+		can_skb = ce_gw_skb_reserve_can(&gwj->reserve, gwj->dst.dev,
+		                                &cf);
+	if (can_skb != NULL)
+		memcpy(cf, data, sizeof(struct can_frame));
+	return can_skb;
+}
+
+/**
+ * @fn static struct sk_buff *ce_gw_buf2eth(const u8 *data, unsigned int len,
+ *                                         u8 hops)
+ * @brief Copies an ethernet frame from a buffer into a new sk_buff for the
+ *        deferred routes of ce_gw_eth_rcv_buf()
+ * @param data The ethernet frame
+ * @param len Length of param data
+ * @param hops Number of times the frame passed the gateway
+ * @retval NULL if the allocation failed
+ * @ingroup trans
+ */
+static struct sk_buff *ce_gw_buf2eth(const u8 *data, unsigned int len,
+                                     u8 hops)
+{
+	struct sk_buff *eth_skb;
+
+	eth_skb = alloc_skb(len, GFP_ATOMIC);
+	if (eth_skb == NULL)
+		return NULL;
+
+	/* same layout as a frame in ndo_start_xmit */
+	memcpy(skb_put(eth_skb, len), data, len);
+	skb_reset_mac_header(eth_skb);
+	skb_set_network_header(eth_skb, ETH_HLEN);
+	eth_skb->protocol = ((const struct ethhdr *) data)->h_proto;
+	ce_gw_set_hops(eth_skb, hops);
+
+	return eth_skb;
+}
+
+int ce_gw_eth_rcv_buf(const u8 *data, unsigned int len, void *jobs_data)
+{
+	struct hlist_head *jobs = (struct hlist_head *)jobs_data;
+	const struct ethhdr *ethh = (const struct ethhdr *) data;
+	struct ce_gw_job *gwj = NULL;
+	struct ce_gw_job *last = NULL;
+	struct sk_buff *can_skb = NULL;
+	struct sk_buff *eth_skb = NULL;
+	u8 hops = this_cpu_read(ce_gw_xdp_hops);
+	bool fd;
+
+	if (len >= ETH_HLEN + CANFD_MTU && ethh->h_proto == htons(ETH_P_CANFD))
+		fd = true;
+	else if (len >= ETH_HLEN + CAN_MTU && ethh->h_proto == htons(ETH_P_CAN))
+		fd = false;
 	else
-		gwj->handled_frames++;
+		return -EPROTONOSUPPORT;
+
+	/* the frame is copied once into a CAN sk_buff for the first route,
+	 * the other routes get a copy like in ce_gw_eth_rcv() */
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	hlist_for_each_entry_rcu(gwj, jobs, list_dev) {
+#	else
+	struct hlist_node *pos;
+	hlist_for_each_entry_rcu(gwj, pos, jobs, list_dev) {
+#	endif
+		/* the CAN frame is not at the network layer */
+		if (gwj->type != CE_GW_TYPE_NET)
+			continue;
+
+		/* frame was forwarded to ethernet by the gateway and came
+		 * back */
+		if (hops >= gwj->hop_limit) {
+			ce_gw_job_inc(gwj, loop_frames);
+			continue;
+		}
+
+		if (fd && (gwj->flags & CE_GW_F_CAN_FD) == 0) {
+			ce_gw_job_inc(gwj, dropped_frames);
+			continue;
+		}
+
+		/* the worker translates a sk_buff like in ce_gw_eth_rcv() */
+		if (gwj->flags & CE_GW_F_DEFER) {
+			if (eth_skb == NULL)
+				eth_skb = ce_gw_buf2eth(data, len, hops);
+			if (eth_skb == NULL || ce_gw_defer(eth_skb, gwj) != 0)
+				ce_gw_job_inc(gwj, dropped_frames);
+			continue;
+		}
+
+		if (can_skb != NULL) {
+			ce_gw_eth_fwd(pskb_copy(can_skb, GFP_ATOMIC), last);
+			last = gwj;
+			continue;
+		}
+
+		can_skb = ce_gw_buf2can(data + ETH_HLEN, fd, gwj);
+		if (can_skb == NULL) {
+			ce_gw_job_inc(gwj, dropped_frames);
+			continue;
+		}
+		ce_gw_set_hops(can_skb, hops + 1);
+		last = gwj;
+	}
 
-	return; /* Receive + process + send to CAN successful */
+	if (last != NULL)
+		ce_gw_eth_fwd(can_skb, last);
+	/* the deferred routes got clones */
+	consume_skb(eth_skb);
 
-drop_frame:
-	gwj->dropped_frames++;
-	dev_kfree_skb(can_skb);
-	return;
+	return 0;
+}
+
+/**
+ * @fn static struct ce_gw_group *ce_gw_group_find(struct ce_gw_job *gwj)
+ * @brief Searches the fan-out group a CAN -> ETH route belongs to
+ * @param gwj The route. Source device, filter and type must be set.
+ * @retval NULL if there is no group yet
+ * @ingroup alloc
+ */
+static struct ce_gw_group *ce_gw_group_find(struct ce_gw_job *gwj)
+{
+	struct ce_gw_group *grp = NULL;
+	struct hlist_node *node;
+
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	hlist_for_each_entry_safe(grp, node, &ce_gw_group_list, list) {
+#	else
+	struct hlist_node *pos;
+	hlist_for_each_entry_safe(grp, pos, node, &ce_gw_group_list, list) {
+#	endif
+		if (grp->dev == gwj->src.dev && grp->xlat == gwj->xlat &&
+		    grp->filter.can_id == gwj->can_rcv_filter.can_id &&
+		    grp->filter.can_mask == gwj->can_rcv_filter.can_mask)
+			return grp;
+	}
+
+	return NULL;
+}
+
+/**
+ * @fn static void ce_gw_group_tx_update(struct net_device *dev)
+ * @brief Passes the CAN receivers of the gateway on a device to its
+ *        transmission state, see ce_gw_tx_gw_rcv()
+ * @param dev The CAN device
+ * @ingroup alloc
+ */
+static void ce_gw_group_tx_update(struct net_device *dev)
+{
+	struct ce_gw_group *grp = NULL;
+	struct ce_gw_job *gwj = NULL;
+	unsigned int rcv = 0;
+	u8 hop_limit = 0;
+
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	hlist_for_each_entry(grp, &ce_gw_group_list, list) {
+#	else
+	struct hlist_node *pos, *jpos;
+	hlist_for_each_entry(grp, pos, &ce_gw_group_list, list) {
+#	endif
+		if (grp->dev != dev)
+			continue;
+
+		rcv++;
+#		if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+		hlist_for_each_entry(gwj, &grp->jobs, list_grp) {
+#		else
+		hlist_for_each_entry(gwj, jpos, &grp->jobs, list_grp) {
+#		endif
+			hop_limit = max(hop_limit, gwj->hop_limit);
+		}
+	}
+
+	ce_gw_tx_gw_rcv(dev, rcv, hop_limit);
 }
 
 static inline int ce_gw_register_can_src(struct ce_gw_job *gwj)
 {
-	return can_rx_register(gwj->src.dev, gwj->can_rcv_filter.can_id,
-	                       gwj->can_rcv_filter.can_mask, ce_gw_can_rcv,
-	                       gwj, "ce_gw");
+	struct ce_gw_group *grp;
+	int err;
+
+	grp = ce_gw_group_find(gwj);
+	if (grp == NULL) {
+		grp = kzalloc(sizeof(struct ce_gw_group), GFP_KERNEL);
+		if (grp == NULL)
+			return -ENOMEM;
+
+		grp->dev = gwj->src.dev;
+		grp->xlat = gwj->xlat;
+		grp->filter = gwj->can_rcv_filter;
+		INIT_HLIST_HEAD(&grp->jobs);
+
+#		if LINUX_VERSION_CODE >= KERNEL_VERSION(4,12,0)
+		err = can_rx_register(&init_net, grp->dev, grp->filter.can_id,
+		                      grp->filter.can_mask, ce_gw_can_rcv,
+		                      grp, "ce_gw", NULL);
+#		elif LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+		err = can_rx_register(&init_net, grp->dev, grp->filter.can_id,
+		                      grp->filter.can_mask, ce_gw_can_rcv,
+		                      grp, "ce_gw");
+#		else
+		err = can_rx_register(grp->dev, grp->filter.can_id,
+		                      grp->filter.can_mask, ce_gw_can_rcv,
+		                      grp, "ce_gw");
+#		endif
+		if (err != 0) {
+			kfree(grp);
+			return err;
+		}
+		hlist_add_head(&grp->list, &ce_gw_group_list);
+	}
+
+	gwj->grp = grp;
+	hlist_add_head_rcu(&gwj->list_grp, &grp->jobs);
+	ce_gw_group_tx_update(grp->dev);
+	return 0;
 }
 
 static inline void ce_gw_unregister_can_src(struct ce_gw_job *gwj)
 {
-	return can_rx_unregister(gwj->src.dev, gwj->can_rcv_filter.can_id,
-	                         gwj->can_rcv_filter.can_mask,
-	                         ce_gw_can_rcv, gwj);
+	struct ce_gw_group *grp = gwj->grp;
+
+	hlist_del_rcu(&gwj->list_grp);
+	if (!hlist_empty(&grp->jobs)) {
+		ce_gw_group_tx_update(grp->dev);
+		return;
+	}
+
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+	can_rx_unregister(&init_net, grp->dev, grp->filter.can_id,
+	                  grp->filter.can_mask, ce_gw_can_rcv, grp);
+#	else
+	can_rx_unregister(grp->dev, grp->filter.can_id, grp->filter.can_mask,
+	                  ce_gw_can_rcv, grp);
+#	endif
+	hlist_del(&grp->list);
+	ce_gw_group_tx_update(grp->dev);
+	kfree_rcu(grp, rcu);
+}
+
+/**
+ * @fn static int ce_gw_eth_src_rcv(struct sk_buff *skb, struct net_device *dev,
+ *                                  struct packet_type *pt,
+ *                                  struct net_device *orig_dev)
+ * @brief Receives CAN over ethernet frames of a physical ethernet device
+ * @param skb The received frame, skb->data points to the CAN frame
+ * @param dev The device which received the frame
+ * @param pt pt_can or pt_canfd of the struct ce_gw_eth_src of the device
+ * @param orig_dev The original device (e.g. below a bond)
+ * @return NET_RX_SUCCESS or NET_RX_DROP
+ * @details Called by the OS in softirq context under rcu_read_lock(). The
+ *          frame is passed to ce_gw_eth_rcv() like a frame sent to a cegw
+ *          device.
+ * @ingroup proc
+ */
+static int ce_gw_eth_src_rcv(struct sk_buff *skb, struct net_device *dev,
+                             struct packet_type *pt,
+                             struct net_device *orig_dev)
+{
+	struct ce_gw_eth_src *src;
+	unsigned int len;
+
+	if (pt->type == htons(ETH_P_CANFD)) {
+		src = container_of(pt, struct ce_gw_eth_src, pt_canfd);
+		len = CANFD_MTU;
+	} else {
+		src = container_of(pt, struct ce_gw_eth_src, pt_can);
+		len = CAN_MTU;
+	}
+
+	/* frames to other hosts seen in promiscuous mode */
+	if (skb->pkt_type == PACKET_OTHERHOST)
+		goto drop;
+
+	/* the skb is shared with other packet handlers */
+	skb = skb_share_check(skb, GFP_ATOMIC);
+	if (skb == NULL)
+		return NET_RX_DROP;
+
+	if (!pskb_may_pull(skb, len))
+		goto drop;
+
+	ce_gw_eth_rcv(skb, &src->jobs);
+	consume_skb(skb);
+	return NET_RX_SUCCESS;
+
+drop:
+	kfree_skb(skb);
+	return NET_RX_DROP;
+}
+
+/**
+ * @fn static int ce_gw_eth_src_add(struct ce_gw_job *gwj)
+ * @brief Adds an ETH -> CAN route to the receivers of its physical ethernet
+ *        device
+ * @param gwj The route
+ * @retval 0 on success
+ * @retval -ENOMEM if the allocation failed
+ * @details The packet_type handlers are registered with the first route of
+ *          the device.
+ * @ingroup alloc
+ */
+static int ce_gw_eth_src_add(struct ce_gw_job *gwj)
+{
+	struct ce_gw_eth_src *src = NULL;
+
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	hlist_for_each_entry(src, &ce_gw_eth_src_list, list) {
+#	else
+	struct hlist_node *pos;
+	hlist_for_each_entry(src, pos, &ce_gw_eth_src_list, list) {
+#	endif
+		if (src->dev == gwj->src.dev)
+			break;
+	}
+
+	if (src == NULL || src->dev != gwj->src.dev) {
+		src = kzalloc(sizeof(struct ce_gw_eth_src), GFP_KERNEL);
+		if (src == NULL)
+			return -ENOMEM;
+
+		src->dev = gwj->src.dev;
+		INIT_HLIST_HEAD(&src->jobs);
+
+		src->pt_can.type = htons(ETH_P_CAN);
+		src->pt_can.dev = src->dev;
+		src->pt_can.func = ce_gw_eth_src_rcv;
+		src->pt_canfd.type = htons(ETH_P_CANFD);
+		src->pt_canfd.dev = src->dev;
+		src->pt_canfd.func = ce_gw_eth_src_rcv;
+
+		hlist_add_head(&src->list, &ce_gw_eth_src_list);
+		dev_add_pack(&src->pt_can);
+		dev_add_pack(&src->pt_canfd);
+	}
+
+	gwj->eth_src = src;
+	hlist_add_head_rcu(&gwj->list_dev, &src->jobs);
+	return 0;
+}
+
+/**
+ * @fn static void ce_gw_eth_src_remove(struct ce_gw_job *gwj)
+ * @brief Removes an ETH -> CAN route from its physical ethernet device
+ * @param gwj The route
+ * @details The packet_type handlers are unregistered with the last route of
+ *          the device.
+ * @ingroup alloc
+ */
+static void ce_gw_eth_src_remove(struct ce_gw_job *gwj)
+{
+	struct ce_gw_eth_src *src = gwj->eth_src;
+
+	hlist_del_rcu(&gwj->list_dev);
+	if (!hlist_empty(&src->jobs))
+		return;
+
+	/* waits until ce_gw_eth_src_rcv() is not running any more */
+	dev_remove_pack(&src->pt_can);
+	dev_remove_pack(&src->pt_canfd);
+	hlist_del(&src->list);
+	kfree_rcu(src, rcu);
 }
 
-/* TODO: register at eth device for receiving data frames */
 static inline int ce_gw_register_eth_src(struct ce_gw_job *gwj)
 {
+	int err;
+
+	gwj->tx = ce_gw_tx_get(gwj->dst.dev);
+	if (gwj->tx == NULL)
+		return -ENOMEM;
+	/* the CAN -> ETH routes of the device may be older than the state */
+	ce_gw_group_tx_update(gwj->dst.dev);
+
+	if (ce_gw_is_registered_dev(gwj->src.dev) != 0) {
+		/* physical ethernet device */
+		err = ce_gw_eth_src_add(gwj);
+		if (err) {
+			ce_gw_tx_put(gwj->tx, gwj);
+			return err;
+		}
+		return 0;
+	}
+
 	ce_gw_dev_job_src_add(gwj);
 	return 0;
 }
 
-/* TODO: unregister at eth device */
 static inline void ce_gw_unregister_eth_src(struct ce_gw_job *gwj)
 {
-	ce_gw_dev_job_remove(gwj);
+	if (gwj->eth_src != NULL)
+		ce_gw_eth_src_remove(gwj);
+	else
+		ce_gw_dev_job_remove(gwj);
+	/* ce_gw_eth_rcv() may still queue frames of the job */
+	synchronize_rcu();
+	ce_gw_defer_wait(gwj);
+	ce_gw_tx_put(gwj->tx, gwj);
 }
 
+/**
+ * @fn static inline void ce_gw_job_put_prog(struct ce_gw_job *gwj)
+ * @brief Releases the BPF program of a route
+ * @param gwj The route, no frame may use it any more
+ * @ingroup alloc
+ */
+static inline void ce_gw_job_put_prog(struct ce_gw_job *gwj)
+{
+#	ifdef CE_GW_BPF
+	if (gwj->prog != NULL)
+		bpf_prog_put(gwj->prog);
+#	endif
+	gwj->prog = NULL;
+}
 
 int ce_gw_create_route(int src_ifindex, int dst_ifindex,
-                       enum ce_gw_type rt_type, u32 flags)
+                       enum ce_gw_type rt_type, u32 flags,
+                       const struct ce_gw_job_cfg *cfg)
 {
 	int err = 0;
 
@@ -922,8 +1838,25 @@ int ce_gw_create_route(int src_ifindex, int dst_ifindex,
 	gwj = kmem_cache_alloc(ce_gw_job_cache, GFP_KERNEL);
 
 	gwj->id = job_count++;
-	gwj->handled_frames = 0;
-	gwj->dropped_frames = 0;
+	gwj->stats = alloc_percpu(struct ce_gw_job_stats);
+	gwj->hop_limit = (cfg && cfg->hop_limit) ? cfg->hop_limit : 1;
+	gwj->tx = NULL;
+	gwj->ring = NULL;
+	gwj->grp = NULL;
+	gwj->eth_src = NULL;
+	gwj->prog = NULL;
+	gwj->mod = NULL;
+	gwj->change = NULL;
+	gwj->throttle = NULL;
+	gwj->snap = NULL;
+	ce_gw_tx_route_init(&gwj->txr, cfg ? cfg->tx_weight : 0);
+	ce_gw_skb_reserve_init(&gwj->reserve);
+
+	err = -ENOMEM;
+	gwj->src.dev = NULL;
+	gwj->dst.dev = NULL;
+	if (gwj->stats == NULL)
+		goto clean_exit;
 
 	err = -ENODEV;
 	gwj->src.dev = dev_get_by_index(&init_net, src_ifindex);
@@ -937,8 +1870,101 @@ int ce_gw_create_route(int src_ifindex, int dst_ifindex,
 		goto clean_exit;
 	}
 
+	err = ce_gw_skb_reserve_create(&gwj->reserve, cfg ? cfg->reserve : 0);
+	if (err)
+		goto clean_exit;
+
 	gwj->type = rt_type;
 	gwj->flags = flags;
+	gwj->xlat = ce_gw_job_xlat(rt_type, flags,
+	                           gwj->src.dev->type == ARPHRD_CAN);
+	if (gwj->xlat == NULL) {
+		err = -EOPNOTSUPP;
+		goto clean_exit;
+	}
+
+	if (flags & CE_GW_F_DEFER) {
+		err = ce_gw_defer_route(gwj, cfg ? cfg->defer_cpu : -1);
+		if (err)
+			goto clean_exit;
+	}
+
+	if (flags & CE_GW_F_RING) {
+		err = -EINVAL;
+		if (gwj->src.dev->type != ARPHRD_CAN)
+			goto clean_exit;
+
+		err = -ENOMEM;
+		gwj->ring = ce_gw_ring_create(gwj->id,
+		                              cfg ? cfg->ring_records : 0);
+		if (gwj->ring == NULL)
+			goto clean_exit;
+	}
+
+	if (flags & CE_GW_F_ON_CHANGE) {
+		err = -EINVAL;
+		if (gwj->src.dev->type != ARPHRD_CAN)
+			goto clean_exit;
+
+		err = -ENOMEM;
+		gwj->change = ce_gw_change_create(flags & CE_GW_F_CAN_FD,
+		                                  cfg ? cfg->change_mask : NULL,
+		                                  cfg ? cfg->change_mask_len : 0,
+		                                  cfg ? cfg->change_refresh : 0);
+		if (gwj->change == NULL)
+			goto clean_exit;
+	}
+
+	if (flags & CE_GW_F_THROTTLE) {
+		/* kept frames are forwarded directly, not through the ring */
+		err = -EINVAL;
+		if (gwj->src.dev->type != ARPHRD_CAN ||
+		    ((flags & CE_GW_F_TRAILING) && (flags & CE_GW_F_RING)))
+			goto clean_exit;
+
+		err = -ENOMEM;
+		gwj->throttle = ce_gw_throttle_create(gwj,
+		                        cfg ? cfg->throttle_ms : 0,
+		                        cfg ? cfg->throttle_ids : NULL,
+		                        cfg ? cfg->n_throttle_ids : 0,
+		                        flags & CE_GW_F_TRAILING);
+		if (gwj->throttle == NULL)
+			goto clean_exit;
+	}
+
+	if (flags & CE_GW_F_SNAPSHOT) {
+		err = -EINVAL;
+		if (gwj->src.dev->type != ARPHRD_CAN)
+			goto clean_exit;
+
+		err = -ENOMEM;
+		gwj->snap = ce_gw_snap_get(gwj->src.dev);
+		if (gwj->snap == NULL)
+			goto clean_exit;
+	}
+
+	/* the checksums of classic CAN frames must fit into 8 data bytes */
+	if (cfg && cfg->mod && (flags & CE_GW_F_CAN_FD) == 0 &&
+	    cfg->mod->data_len > CAN_MAX_DLEN) {
+		err = -EINVAL;
+		goto clean_exit;
+	}
+
+	if (cfg && cfg->bpf_fd >= 0) {
+#		ifdef CE_GW_BPF
+		struct bpf_prog *prog;
+
+		prog = bpf_prog_get_type(cfg->bpf_fd, BPF_PROG_TYPE_SCHED_CLS);
+		if (IS_ERR(prog)) {
+			err = PTR_ERR(prog);
+			goto clean_exit;
+		}
+		gwj->prog = prog;
+#		else
+		err = -EOPNOTSUPP;
+		goto clean_exit;
+#		endif
+	}
 
 	/* TEST: pre-filled values */
 	gwj->can_rcv_filter.can_id = 0x42A;
@@ -952,26 +1978,39 @@ int ce_gw_create_route(int src_ifindex, int dst_ifindex,
 		/*	    && gwj->dst.dev->type == ARPHRD_ETHER) {*/
 		/* CAN source --> ETH destination (cegw virtual dev) */
 		err = ce_gw_register_can_src(gwj);
-	} else if (ce_gw_is_registered_dev(gwj->src.dev) == 0 &&
+	} else if ((ce_gw_is_registered_dev(gwj->src.dev) == 0 ||
+	            gwj->src.dev->type == ARPHRD_ETHER) &&
 	           gwj->dst.dev->type == ARPHRD_CAN) {
-		/* ETH source (cegw virtual dev) --> CAN destination */
+		/* ETH source (cegw virtual or physical dev) --> CAN dest. */
 		err = ce_gw_register_eth_src(gwj);
 	} else {
 		/* Undefined routing setup */
+		err = -ENODEV;
 		goto clean_exit;
 	}
 
-	if (!err)
+	if (!err) {
+		/* the caller frees the modifications if the route fails */
+		gwj->mod = cfg ? cfg->mod : NULL;
 		hlist_add_head_rcu(&gwj->list, &ce_gw_job_list);
+	}
 
 clean_exit:
 	if (err) {
 		printk(KERN_ERR "ce_gw: Src or dst device not found or "
 		       "not compatible (CAN<->CEGW ETH), exit.\n");
+		/* the table removes its receiver from the device */
+		ce_gw_snap_put(gwj->snap);
 		if (gwj->src.dev)
 			dev_put(gwj->src.dev);
 		if (gwj->dst.dev)
 			dev_put(gwj->dst.dev);
+		ce_gw_throttle_destroy(gwj->throttle);
+		ce_gw_ring_destroy(gwj->ring);
+		ce_gw_change_destroy(gwj->change);
+		ce_gw_job_put_prog(gwj);
+		ce_gw_skb_reserve_destroy(&gwj->reserve);
+		free_percpu(gwj->stats);
 		kmem_cache_free(ce_gw_job_cache, gwj);
 	}
 
@@ -983,23 +2022,43 @@ int ce_gw_remove_route(u32 id)
 {
 	pr_info("ce_gw: unregister CAN ETH GW routes\n");
 	struct ce_gw_job *gwj = NULL;
-	struct hlist_node *n, *nx;
+	struct hlist_node *nx;
 
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	hlist_for_each_entry_safe(gwj, nx, &ce_gw_job_list, list) {
+#	else
+	struct hlist_node *n;
 	hlist_for_each_entry_safe(gwj, n, nx, &ce_gw_job_list, list) {
+#	endif
 		if (gwj->id != id && id)
 			continue;
 
 		pr_debug("Removing routing src device: %s, id %x, mask %x\n",
 		         gwj->src.dev->name, gwj->can_rcv_filter.can_id,
 		         gwj->can_rcv_filter.can_mask);
-		hlist_del(&gwj->list);
+		/* ce_gw_job_find_rcu() may still see the job */
+		hlist_del_rcu(&gwj->list);
 		/* TODO: Unregister destination device (only for cegw eth) */
-		if (gwj->src.dev->type == ARPHRD_CAN)
+		if (gwj->src.dev->type == ARPHRD_CAN) {
 			ce_gw_unregister_can_src(gwj);
-		else
+			/* ce_gw_can_rcv() may still use the job */
+			synchronize_rcu();
+			ce_gw_defer_wait(gwj);
+		} else {
 			ce_gw_unregister_eth_src(gwj);
+		}
+		/* the tasklet forwards with the devices and the prog */
+		ce_gw_throttle_destroy(gwj->throttle);
+		/* the table removes its receiver from the device */
+		ce_gw_snap_put(gwj->snap);
 		dev_put(gwj->src.dev);
 		dev_put(gwj->dst.dev);
+		ce_gw_ring_destroy(gwj->ring);
+		ce_gw_change_destroy(gwj->change);
+		ce_gw_job_put_prog(gwj);
+		kfree(gwj->mod);
+		ce_gw_skb_reserve_destroy(&gwj->reserve);
+		free_percpu(gwj->stats);
 		kmem_cache_free(ce_gw_job_cache, gwj);
 	}
 
@@ -1023,6 +2082,11 @@ static int __init ce_gw_init_module(void)
 	if (!ce_gw_job_cache)
 		return ENOMEM;
 
+	if (ce_gw_skb_init() != 0) {
+		kmem_cache_destroy(ce_gw_job_cache);
+		return ENOMEM;
+	}
+
 	/**
 	 * Tests: remove when done!
 	 */
@@ -1033,6 +2097,7 @@ static int __init ce_gw_init_module(void)
 
 	err = ce_gw_netlink_init();
 	err += ce_gw_dev_init_module();
+	err += ce_gw_inject_init();
 
 	if (err != 0)
 		return 1;
@@ -1051,6 +2116,7 @@ static void __exit ce_gw_cleanup(void)
 
 	pr_debug("ce_gw: Unregister netlink server.\n");
 	ce_gw_netlink_exit();
+	ce_gw_inject_exit();
 
 	/* Unregister all routes */
 	pr_info("ce_gw: unregister all CAN ETH GW routes\n");
@@ -1060,6 +2126,8 @@ static void __exit ce_gw_cleanup(void)
 	ce_gw_dev_cleanup();
 
 	/* Mem cleanup */
+	ce_gw_defer_exit();
+	ce_gw_skb_exit();
 	kmem_cache_destroy(ce_gw_job_cache);
 }
 
@@ -1069,11 +2137,16 @@ static void __exit ce_gw_cleanup(void)
 static void list_jobs()
 {
 	struct ce_gw_job *gwj = NULL;
-	struct hlist_node *n, *nx;
+	struct hlist_node *nx;
 
 	pr_info("Routing jobs\n"
 	        "------------\n");
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	hlist_for_each_entry_safe(gwj, nx, &ce_gw_job_list, list) {
+#	else
+	struct hlist_node *n;
 	hlist_for_each_entry_safe(gwj, n, nx, &ce_gw_job_list, list) {
+#	endif
 		pr_info("ID: %i, input dev: %s, output dev: %s\n",
 		        gwj->id, gwj->src.dev->name, gwj->dst.dev->name);
 	}
@@ -1120,12 +2193,12 @@ static void test_get_vcan_netdev(void)
 static void test_hash_list(void)
 {
 	struct ce_gw_job *gwj1 = kmem_cache_alloc(ce_gw_job_cache, GFP_KERNEL);
-	gwj1->dropped_frames = 25;
+	gwj1->id = 25;
 	struct ce_gw_job *gwj2 = kmem_cache_alloc(ce_gw_job_cache, GFP_KERNEL);
-	gwj2->dropped_frames = 250;
+	gwj2->id = 250;
 	/* dynamic alloc, dangerous when out of scope*/
 	struct ce_gw_job gwj3 = {
-		.dropped_frames = 555
+		.id = 555
 	};
 
 	hlist_add_head(&gwj1->list, &ce_gw_job_list);
@@ -1133,10 +2206,14 @@ static void test_hash_list(void)
 	hlist_add_head(&gwj3.list, &ce_gw_job_list);
 
 	struct ce_gw_job *gwj = NULL;
-	struct hlist_node *n, *nx;
 
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	hlist_for_each_entry(gwj, &ce_gw_job_list, list) {
+#	else
+	struct hlist_node *n;
 	hlist_for_each_entry(gwj, n, &ce_gw_job_list, list) {
-		pr_debug("cegw hashtest: List entry %i\n", gwj->dropped_frames);
+#	endif
+		pr_debug("cegw hashtest: List entry %i\n", gwj->id);
 	}
 
 }
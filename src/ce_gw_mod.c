@@ -0,0 +1,232 @@
+/**
+ * @file ce_gw_mod.c
+ * @brief Control Area Network - Ethernet - Gateway - Frame Modification
+ * @author Fabian Raab (fabian.raab@tum.de)
+ * @date May, 2013
+ * @copyright GNU Public License v3 or higher
+ * @ingroup files
+ * @{
+ */
+
+/*****************************************************************************
+ * (C) Copyright 2013 Fabian Raab, Stefan Smarzly
+ *
+ * This file is part of CAN-Eth-GW.
+ *
+ * CAN-Eth-GW is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CAN-Eth-GW is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CAN-Eth-GW.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/skbuff.h>
+#include <linux/crc8.h>
+#include <linux/can.h>
+#include <net/netlink.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,12,0)
+#include <linux/unaligned.h>
+#else
+#include <asm/unaligned.h>
+#endif
+#include "ce_gw_mod.h"
+
+#include <asm-generic/errno-base.h>
+#include <asm-generic/errno.h>
+
+/**
+ * @fn static void ce_gw_mod_compile(struct ce_gw_mod *mod, int type,
+ *                                   const struct ce_gw_mod_op *op)
+ * @brief Adds one operation to the AND masks and XOR values
+ * @param mod The modifications compiled so far
+ * @param type #CE_GW_MOD_A_AND, #CE_GW_MOD_A_OR, #CE_GW_MOD_A_XOR or
+ *        #CE_GW_MOD_A_SET
+ * @param op The operation
+ * @details With f(x) = (x & and) ^ xor for the previous operations the new
+ *          operation g(f(x)) is again of this form for every bit with the
+ *          value v of the operation:
+ *          + AND: and &= v, xor &= v
+ *          + OR: and &= ~v, xor |= v
+ *          + XOR: xor ^= v
+ *          + SET: and = 0, xor = v
+ *          Bits outside of the selected fields keep their value.
+ * @ingroup trans
+ */
+static void ce_gw_mod_compile(struct ce_gw_mod *mod, int type,
+                              const struct ce_gw_mod_op *op)
+{
+	struct canfd_frame mask;
+	u64 m[CE_GW_MOD_WORDS];
+	u64 v[CE_GW_MOD_WORDS];
+	int i;
+
+	memset(&mask, 0, sizeof(mask));
+	if (op->fields & CE_GW_MOD_ID)
+		mask.can_id = ~0U;
+	if (op->fields & CE_GW_MOD_DLC)
+		mask.len = 0xff;
+	if (op->fields & CE_GW_MOD_DATA)
+		memset(mask.data, 0xff, sizeof(mask.data));
+
+	memcpy(m, &mask, sizeof(m));
+	memcpy(v, &op->cf, sizeof(v));
+
+	for (i = 0; i < CE_GW_MOD_WORDS; i++) {
+		u64 val = v[i] & m[i];
+
+		switch (type) {
+		case CE_GW_MOD_A_AND:
+			mod->and[i] &= val | ~m[i];
+			mod->xor[i] &= val | ~m[i];
+			break;
+		case CE_GW_MOD_A_OR:
+			mod->and[i] &= ~val;
+			mod->xor[i] |= val;
+			break;
+		case CE_GW_MOD_A_XOR:
+			mod->xor[i] ^= val;
+			break;
+		case CE_GW_MOD_A_SET:
+			mod->and[i] &= ~m[i];
+			mod->xor[i] = (mod->xor[i] & ~m[i]) | val;
+			break;
+		}
+	}
+}
+
+struct ce_gw_mod *ce_gw_mod_parse(const struct nlattr *nla, int *err)
+{
+	struct ce_gw_mod *mod;
+	struct nlattr *attr;
+	int rem, i;
+
+	mod = kzalloc(sizeof(struct ce_gw_mod), GFP_KERNEL);
+	if (mod == NULL) {
+		*err = -ENOMEM;
+		return NULL;
+	}
+
+	for (i = 0; i < CE_GW_MOD_WORDS; i++)
+		mod->and[i] = ~0ULL;
+
+	nla_for_each_nested(attr, nla, rem) {
+		switch (nla_type(attr)) {
+		case CE_GW_MOD_A_AND:
+		case CE_GW_MOD_A_OR:
+		case CE_GW_MOD_A_XOR:
+		case CE_GW_MOD_A_SET:
+			if (nla_len(attr) < sizeof(struct ce_gw_mod_op))
+				goto ce_gw_mod_parse_invalid;
+			ce_gw_mod_compile(mod, nla_type(attr), nla_data(attr));
+			break;
+
+		case CE_GW_MOD_A_CSUM_XOR:
+			if (nla_len(attr) < sizeof(struct ce_gw_mod_csum_xor))
+				goto ce_gw_mod_parse_invalid;
+			memcpy(&mod->xor_csum, nla_data(attr),
+			       sizeof(struct ce_gw_mod_csum_xor));
+			if (mod->xor_csum.from_idx > mod->xor_csum.to_idx ||
+			    mod->xor_csum.to_idx >= CANFD_MAX_DLEN ||
+			    mod->xor_csum.result_idx >= CANFD_MAX_DLEN)
+				goto ce_gw_mod_parse_invalid;
+			mod->data_len = max3(mod->data_len,
+			                     (u8)(mod->xor_csum.to_idx + 1),
+			                     (u8)(mod->xor_csum.result_idx + 1));
+			mod->csum_xor = true;
+			break;
+
+		case CE_GW_MOD_A_CSUM_CRC8:
+			if (nla_len(attr) < sizeof(struct ce_gw_mod_csum_crc8))
+				goto ce_gw_mod_parse_invalid;
+			memcpy(&mod->crc8, nla_data(attr),
+			       sizeof(struct ce_gw_mod_csum_crc8));
+			if (mod->crc8.from_idx > mod->crc8.to_idx ||
+			    mod->crc8.to_idx >= CANFD_MAX_DLEN ||
+			    mod->crc8.result_idx >= CANFD_MAX_DLEN)
+				goto ce_gw_mod_parse_invalid;
+			mod->data_len = max3(mod->data_len,
+			                     (u8)(mod->crc8.to_idx + 1),
+			                     (u8)(mod->crc8.result_idx + 1));
+			crc8_populate_msb(mod->crc8_table, mod->crc8.poly);
+			mod->csum_crc8 = true;
+			break;
+
+		default:
+			goto ce_gw_mod_parse_invalid;
+		}
+	}
+
+	/* only the changed words are touched per frame */
+	mod->first = CE_GW_MOD_WORDS;
+	mod->last = 0;
+	for (i = 0; i < CE_GW_MOD_WORDS; i++) {
+		if (mod->and[i] == ~0ULL && mod->xor[i] == 0)
+			continue;
+		if (mod->first == CE_GW_MOD_WORDS)
+			mod->first = i;
+		mod->last = i;
+	}
+
+	return mod;
+
+ce_gw_mod_parse_invalid:
+	kfree(mod);
+	*err = -EINVAL;
+	return NULL;
+}
+
+int ce_gw_mod_skb(const struct ce_gw_mod *mod, struct sk_buff *skb,
+                  unsigned int hlen)
+{
+	unsigned int len = skb->len - hlen;
+	unsigned int i, last;
+	u64 *frame;
+	u8 *data;
+
+	if (len < CAN_MTU ||
+	    mod->data_len > len - offsetof(struct canfd_frame, data))
+		return -EINVAL;
+
+	/* the data of a clone is shared with the other routes */
+	if (skb_cloned(skb) && pskb_expand_head(skb, 0, 0, GFP_ATOMIC))
+		return -ENOMEM;
+
+	frame = (u64 *)(skb->data + hlen);
+	last = min_t(unsigned int, mod->last, len / sizeof(u64) - 1);
+	for (i = mod->first; i <= last; i++)
+		put_unaligned((get_unaligned(&frame[i]) & mod->and[i]) ^
+		              mod->xor[i], &frame[i]);
+
+	data = ((struct canfd_frame *)frame)->data;
+
+	if (mod->csum_xor) {
+		u8 val = mod->xor_csum.init_val;
+
+		for (i = mod->xor_csum.from_idx; i <= mod->xor_csum.to_idx; i++)
+			val ^= data[i];
+		data[mod->xor_csum.result_idx] = val;
+	}
+
+	if (mod->csum_crc8) {
+		data[mod->crc8.result_idx] =
+		        crc8(mod->crc8_table, &data[mod->crc8.from_idx],
+		             mod->crc8.to_idx - mod->crc8.from_idx + 1,
+		             mod->crc8.init_val) ^ mod->crc8.final_xor;
+	}
+
+	return 0;
+}
+
+/**@}*/
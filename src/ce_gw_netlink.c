@@ -65,6 +65,35 @@ enum {
 	CE_GW_A_TYPE,	/**< NLA_U8 */
 	CE_GW_A_HNDL,	/**< NLA_U32 Handled Frames */
 	CE_GW_A_DROP,	/**< NLA_U32 Dropped Frames */
+	CE_GW_A_TXQ_LEN,	/**< NLA_U32 Max queued frames of CAN dst */
+	CE_GW_A_TXQ_MEM,	/**< NLA_U32 Max queued bytes of CAN dst */
+	CE_GW_A_TXQ_POLICY,	/**< NLA_U8 enum ce_gw_tx_policy of CAN dst */
+	CE_GW_A_TXQ_SCHED,	/**< NLA_U8 enum ce_gw_tx_sched of CAN dst */
+	CE_GW_A_TXQ_QUANTUM,	/**< NLA_U32 DRR bytes per round of CAN dst */
+	CE_GW_A_TXQ_WEIGHT,	/**< NLA_U32 DRR weight of the route */
+	CE_GW_A_TXQ_DEPTH,	/**< NLA_U32 Queued frames of the route */
+	CE_GW_A_TXQ_WAIT_AVG,	/**< NLA_U32 Avg wait of queued frames in us */
+	CE_GW_A_TXQ_WAIT_MAX,	/**< NLA_U32 Max wait of queued frames in us */
+	CE_GW_A_TXQ_LOAD_MAX,	/**< NLA_U8 Max bus load of CAN dst in % */
+	CE_GW_A_TXQ_BITRATE,	/**< NLA_U32 Nominal bitrate of CAN dst */
+	CE_GW_A_TXQ_DBITRATE,	/**< NLA_U32 CAN FD data bitrate of CAN dst */
+	CE_GW_A_TXQ_LOAD,	/**< NLA_U8 Bus load of CAN dst in % */
+	CE_GW_A_HOPS,	/**< NLA_U8 Hop limit of gateway frames */
+	CE_GW_A_LOOP,	/**< NLA_U32 Suppressed looped frames */
+	CE_GW_A_RESERVE,	/**< NLA_U32 Reserved sk_buffs of the route */
+	CE_GW_A_RESERVE_HITS,	/**< NLA_U32 Frames allocated from reserve */
+	CE_GW_A_RESERVE_EMPTY,	/**< NLA_U32 Drops with an empty reserve */
+	CE_GW_A_DEFER_CPU,	/**< NLA_U32 CPU of the worker of the route */
+	CE_GW_A_RING_SIZE,	/**< NLA_U32 Records of the capture ring */
+	CE_GW_A_BPF_FD,		/**< NLA_U32 fd of the BPF program of a route */
+	CE_GW_A_BPF_ID,		/**< NLA_U32 id of the BPF program of a route */
+	CE_GW_A_MOD,		/**< NLA_NESTED Modifications, see ce_gw_mod.h */
+	CE_GW_A_CHANGE_MASK,	/**< NLA_BINARY Compared bits (on change) */
+	CE_GW_A_CHANGE_REFRESH,	/**< NLA_U32 Forced refresh in ms (on change) */
+	CE_GW_A_FILTERED,	/**< NLA_U32 Frames suppressed by per ID filters */
+	CE_GW_A_THROTTLE,	/**< NLA_U32 Minimum interval per ID in ms */
+	CE_GW_A_THROTTLE_IDS,	/**< NLA_BINARY struct ce_gw_throttle_id[] */
+	CE_GW_A_SNAP,		/**< NLA_BINARY struct ce_gw_snap_ent[] */
 	__CE_GW_A_MAX,	/**< Maximum Number of Attribute + 1 */
 };
 #define CE_GW_A_MAX (__CE_GW_A_MAX - 1) /**< Maximum Number of Attribute */
@@ -82,6 +111,35 @@ static struct nla_policy ce_gw_genl_policy[CE_GW_A_MAX + 1] = {
 	[CE_GW_A_TYPE] = { .type = NLA_U8 },
 	[CE_GW_A_HNDL] = { .type = NLA_U32 },
 	[CE_GW_A_DROP] = { .type = NLA_U32 },
+	[CE_GW_A_TXQ_LEN] = { .type = NLA_U32 },
+	[CE_GW_A_TXQ_MEM] = { .type = NLA_U32 },
+	[CE_GW_A_TXQ_POLICY] = { .type = NLA_U8 },
+	[CE_GW_A_TXQ_SCHED] = { .type = NLA_U8 },
+	[CE_GW_A_TXQ_QUANTUM] = { .type = NLA_U32 },
+	[CE_GW_A_TXQ_WEIGHT] = { .type = NLA_U32 },
+	[CE_GW_A_TXQ_DEPTH] = { .type = NLA_U32 },
+	[CE_GW_A_TXQ_WAIT_AVG] = { .type = NLA_U32 },
+	[CE_GW_A_TXQ_WAIT_MAX] = { .type = NLA_U32 },
+	[CE_GW_A_TXQ_LOAD_MAX] = { .type = NLA_U8 },
+	[CE_GW_A_TXQ_BITRATE] = { .type = NLA_U32 },
+	[CE_GW_A_TXQ_DBITRATE] = { .type = NLA_U32 },
+	[CE_GW_A_TXQ_LOAD] = { .type = NLA_U8 },
+	[CE_GW_A_HOPS] = { .type = NLA_U8 },
+	[CE_GW_A_LOOP] = { .type = NLA_U32 },
+	[CE_GW_A_RESERVE] = { .type = NLA_U32 },
+	[CE_GW_A_RESERVE_HITS] = { .type = NLA_U32 },
+	[CE_GW_A_RESERVE_EMPTY] = { .type = NLA_U32 },
+	[CE_GW_A_DEFER_CPU] = { .type = NLA_U32 },
+	[CE_GW_A_RING_SIZE] = { .type = NLA_U32 },
+	[CE_GW_A_BPF_FD] = { .type = NLA_U32 },
+	[CE_GW_A_BPF_ID] = { .type = NLA_U32 },
+	[CE_GW_A_MOD] = { .type = NLA_NESTED },
+	[CE_GW_A_CHANGE_MASK] = { .type = NLA_BINARY, .len = CANFD_MAX_DLEN },
+	[CE_GW_A_CHANGE_REFRESH] = { .type = NLA_U32 },
+	[CE_GW_A_FILTERED] = { .type = NLA_U32 },
+	[CE_GW_A_THROTTLE] = { .type = NLA_U32 },
+	[CE_GW_A_THROTTLE_IDS] = { .type = NLA_BINARY },
+	[CE_GW_A_SNAP] = { .type = NLA_BINARY },
 };
 
 /**
@@ -90,7 +148,14 @@ static struct nla_policy ce_gw_genl_policy[CE_GW_A_MAX + 1] = {
  */
 static struct genl_family ce_gw_genl_family = {
 	/*@{*/
+#	if LINUX_VERSION_CODE < KERNEL_VERSION(4,10,0)
 	.id = GENL_ID_GENERATE,		/**< generated unique Identifier */
+#	else
+	.module = THIS_MODULE,		/**< Owner of the family */
+#	endif
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(5,2,0)
+	.policy = ce_gw_genl_policy,	/**< Policy of all operations */
+#	endif
 	.hdrsize = CE_GW_USER_HDR_SIZE,	/**< Size of user header */
 	.name = CE_GW_GE_FAMILY_NAME,	/**< unique human readable name */
 	.version = CE_GW_GE_FAMILY_VERSION,	/**< Version */
@@ -112,6 +177,8 @@ enum {
 	CE_GW_C_ADD,  /**< Add a gateway. Calls ce_gw_netlink_add(). */
 	CE_GW_C_DEL,  /**< Delate a gateway. Calls ce_gw_netlink_del(). */
 	CE_GW_C_LIST,  /**< list active gateways. Calls ce_gw_netlink_list(). */
+	CE_GW_C_SNAP,  /**< last frames of a CAN device. Calls
+			* ce_gw_netlink_snap(). */
 	__CE_GW_C_MAX,/**< Maximum Number of Commands plus 1 */
 };
 #define CE_GW_C_MAX (__CE_GW_C_MAX - 1) /**< Maximum Number of Commands */
@@ -140,7 +207,7 @@ int ce_gw_netlink_echo(struct sk_buff *skb_info, struct genl_info *info)
 	char *nla_a_msg_pay = (char *) nla_data(nla_a_msg);
 
 	if (nla_a_msg_pay == NULL) {
-		pr_warning("ce_gw: String Message is missing.\n");
+		pr_warn("ce_gw: String Message is missing.\n");
 	} else {
 		pr_info("ce_gw: Messege received: %s\n", nla_a_msg_pay);
 	}
@@ -209,6 +276,47 @@ ce_gw_add_error:
  * + #CE_GW_A_FLAGS: The Flags of the route. For adding dev some settings
  *                  according to the type will be set. See netlink.h for the
  *                  falgs.
+ * + #CE_GW_A_TXQ_LEN, #CE_GW_A_TXQ_MEM, #CE_GW_A_TXQ_POLICY: Optional. Queue
+ *                  limits of the CAN destination of a route, used by routes
+ *                  with the #CE_GW_F_TX_QUEUE flag. See ce_gw_tx_configure().
+ * + #CE_GW_A_TXQ_SCHED: Optional. Scheduler of the CAN destination of a route
+ *                  (enum ce_gw_tx_sched).
+ * + #CE_GW_A_TXQ_QUANTUM: Optional. Bytes per round of the
+ *                  #CE_GW_TX_SCHED_DRR scheduler of the CAN destination.
+ * + #CE_GW_A_TXQ_WEIGHT: Optional. Share of the route with the
+ *                  #CE_GW_TX_SCHED_DRR scheduler (default 1).
+ * + #CE_GW_A_TXQ_LOAD_MAX: Optional. Maximum bus load in percent the
+ *                  gateway puts on the CAN destination, 0 disables the shaper.
+ * + #CE_GW_A_TXQ_BITRATE, #CE_GW_A_TXQ_DBITRATE: Optional. Bitrates of the CAN
+ *                  destination if it has no bittiming (e.g. vcan), 0 to use
+ *                  the bittiming of the CAN device. Each can be set alone.
+ * + #CE_GW_A_HOPS: Optional. Frames which already passed the gateway this
+ *                  often are not forwarded by the route (default 1, so frames
+ *                  of the gateway are never forwarded again).
+ * + #CE_GW_A_RESERVE: Optional. Number of sk_buffs reserved for the route.
+ *                  They are used if an allocation fails under memory
+ *                  pressure (default 0 = no reserve).
+ * + #CE_GW_A_DEFER_CPU: Optional. CPU whose worker translates the frames of a
+ *                  route with the #CE_GW_F_DEFER flag (default: the CPU
+ *                  which receives the frame).
+ * + #CE_GW_A_RING_SIZE: Optional. Records of the capture ring of a route
+ *                  with the #CE_GW_F_RING flag.
+ * + #CE_GW_A_BPF_FD: Optional. fd of a BPF_PROG_TYPE_SCHED_CLS program which
+ *                  filters or changes every frame of the route, see
+ *                  #CE_GW_BPF_PASS.
+ * + #CE_GW_A_MOD: Optional. Operations on ID, DLC and data of every frame of
+ *                  the route and checksums (nested CE_GW_MOD_A_* attributes).
+ * + #CE_GW_A_CHANGE_MASK: Optional. Compared bits of the data bytes of a
+ *                  route with the #CE_GW_F_ON_CHANGE flag (default: all).
+ * + #CE_GW_A_CHANGE_REFRESH: Optional. A route with the #CE_GW_F_ON_CHANGE
+ *                  flag forwards unchanged frames of an ID after this many ms
+ *                  (default 0 = never).
+ * + #CE_GW_A_THROTTLE: Optional. Minimum interval in ms between two frames
+ *                  of an ID of a route with the #CE_GW_F_THROTTLE flag.
+ * + #CE_GW_A_THROTTLE_IDS: Optional. Array of struct ce_gw_throttle_id,
+ *                  overrides CE_GW_A_THROTTLE for single IDs.
+ * @details The queue attributes need a CAN destination, otherwise the route
+ *          is not added.
  * @ingroup net
  * @retval 0 on success
  * @retval <0 on failure
@@ -292,24 +400,135 @@ int ce_gw_netlink_add(struct sk_buff *skb_info, struct genl_info *info)
 			goto ce_gw_add_error;
 		}
 		int dst_dev_ifindex = dst_dev->ifindex;
+		bool dst_can = dst_dev->type == ARPHRD_CAN;
 		dev_put(dst_dev);
 
+		struct ce_gw_tx_cfg tx_cfg = { .valid = 0 };
+
+		if (info->attrs[CE_GW_A_TXQ_LEN] != NULL) {
+			tx_cfg.valid |= CE_GW_TX_CFG_LEN;
+			tx_cfg.max_frames =
+			        nla_get_u32(info->attrs[CE_GW_A_TXQ_LEN]);
+		}
+		if (info->attrs[CE_GW_A_TXQ_MEM] != NULL) {
+			tx_cfg.valid |= CE_GW_TX_CFG_MEM;
+			tx_cfg.max_bytes =
+			        nla_get_u32(info->attrs[CE_GW_A_TXQ_MEM]);
+		}
+		if (info->attrs[CE_GW_A_TXQ_POLICY] != NULL) {
+			tx_cfg.valid |= CE_GW_TX_CFG_POLICY;
+			tx_cfg.policy =
+			        nla_get_u8(info->attrs[CE_GW_A_TXQ_POLICY]);
+		}
+		if (info->attrs[CE_GW_A_TXQ_SCHED] != NULL) {
+			tx_cfg.valid |= CE_GW_TX_CFG_SCHED;
+			tx_cfg.sched =
+			        nla_get_u8(info->attrs[CE_GW_A_TXQ_SCHED]);
+		}
+		if (info->attrs[CE_GW_A_TXQ_QUANTUM] != NULL) {
+			tx_cfg.valid |= CE_GW_TX_CFG_QUANTUM;
+			tx_cfg.quantum =
+			        nla_get_u32(info->attrs[CE_GW_A_TXQ_QUANTUM]);
+		}
+		if (info->attrs[CE_GW_A_TXQ_LOAD_MAX] != NULL) {
+			tx_cfg.valid |= CE_GW_TX_CFG_LOAD;
+			tx_cfg.load_max =
+			        nla_get_u8(info->attrs[CE_GW_A_TXQ_LOAD_MAX]);
+		}
+		if (info->attrs[CE_GW_A_TXQ_BITRATE] != NULL) {
+			tx_cfg.valid |= CE_GW_TX_CFG_BITRATE;
+			tx_cfg.bitrate =
+			        nla_get_u32(info->attrs[CE_GW_A_TXQ_BITRATE]);
+		}
+		if (info->attrs[CE_GW_A_TXQ_DBITRATE] != NULL) {
+			tx_cfg.valid |= CE_GW_TX_CFG_DBITRATE;
+			tx_cfg.dbitrate =
+			        nla_get_u32(info->attrs[CE_GW_A_TXQ_DBITRATE]);
+		}
+
+		/* the route can not be taken back after it was created, so the
+		 * queue settings are checked first */
+		if (tx_cfg.valid != 0) {
+			err = dst_can ? ce_gw_tx_check(&tx_cfg) : -EINVAL;
+			if (err != 0) {
+				pr_err("ce_gw_netlink: Queue settings of %s "
+				       "invalid: %d\n", nla_dst_data, err);
+				goto ce_gw_add_error;
+			}
+		}
+
+		struct ce_gw_job_cfg job_cfg = { .tx_weight = 0,
+		                                 .defer_cpu = -1,
+		                                 .bpf_fd = -1 };
+
+		if (info->attrs[CE_GW_A_TXQ_WEIGHT] != NULL)
+			job_cfg.tx_weight =
+			        nla_get_u32(info->attrs[CE_GW_A_TXQ_WEIGHT]);
+		if (info->attrs[CE_GW_A_HOPS] != NULL)
+			job_cfg.hop_limit =
+			        nla_get_u8(info->attrs[CE_GW_A_HOPS]);
+		if (info->attrs[CE_GW_A_RESERVE] != NULL)
+			job_cfg.reserve =
+			        nla_get_u32(info->attrs[CE_GW_A_RESERVE]);
+		if (info->attrs[CE_GW_A_DEFER_CPU] != NULL)
+			job_cfg.defer_cpu =
+			        nla_get_u32(info->attrs[CE_GW_A_DEFER_CPU]);
+		if (info->attrs[CE_GW_A_RING_SIZE] != NULL)
+			job_cfg.ring_records =
+			        nla_get_u32(info->attrs[CE_GW_A_RING_SIZE]);
+		if (info->attrs[CE_GW_A_BPF_FD] != NULL)
+			job_cfg.bpf_fd =
+			        nla_get_u32(info->attrs[CE_GW_A_BPF_FD]);
+		if (info->attrs[CE_GW_A_CHANGE_MASK] != NULL) {
+			job_cfg.change_mask =
+			        nla_data(info->attrs[CE_GW_A_CHANGE_MASK]);
+			job_cfg.change_mask_len =
+			        nla_len(info->attrs[CE_GW_A_CHANGE_MASK]);
+		}
+		if (info->attrs[CE_GW_A_CHANGE_REFRESH] != NULL)
+			job_cfg.change_refresh =
+			        nla_get_u32(info->attrs[CE_GW_A_CHANGE_REFRESH]);
+		if (info->attrs[CE_GW_A_THROTTLE] != NULL)
+			job_cfg.throttle_ms =
+			        nla_get_u32(info->attrs[CE_GW_A_THROTTLE]);
+		if (info->attrs[CE_GW_A_THROTTLE_IDS] != NULL) {
+			struct nlattr *ids = info->attrs[CE_GW_A_THROTTLE_IDS];
+
+			if (nla_len(ids) % sizeof(struct ce_gw_throttle_id)) {
+				pr_err("ce_gw_netlink: Throttle IDs invalid\n");
+				err = -EINVAL;
+				goto ce_gw_add_error;
+			}
+			job_cfg.throttle_ids = nla_data(ids);
+			job_cfg.n_throttle_ids = nla_len(ids) /
+			        sizeof(struct ce_gw_throttle_id);
+		}
+		if (info->attrs[CE_GW_A_MOD] != NULL) {
+			job_cfg.mod = ce_gw_mod_parse(info->attrs[CE_GW_A_MOD],
+			                              &err);
+			if (job_cfg.mod == NULL) {
+				pr_err("ce_gw_netlink: Modifications invalid: "
+				       "%d\n", err);
+				goto ce_gw_add_error;
+			}
+		}
+
 		err = ce_gw_create_route(src_dev_ifindex, dst_dev_ifindex,
-		                         *nla_type_data, *nla_flags_data);
+		                         *nla_type_data, *nla_flags_data,
+		                         &job_cfg);
 		if (err != 0) {
+			kfree(job_cfg.mod);
 			goto ce_gw_add_error;
 		}
+
+		/* checked above and the route created the CAN destination */
+		if (tx_cfg.valid != 0)
+			ce_gw_tx_configure(dst_dev_ifindex, &tx_cfg);
 	}
 
 ce_gw_add_error:
-	/* TODO if you send two add messages A abd B in in very short
-	 * short distance (e.g. with option -b in userspace) than the
-	 * ACK Sequence number of Message B is the same of the Massage
-	 * A. So the ACK for Message B could not correct assign to
-	 * Message B in userspace and the userpace think there is an
-	 * error, but all is correct. This seems to be a bug in this
-	 * function of netlink */
-	netlink_ack(skb_info, info->nlhdr, -err);
+	/* netlink_rcv_skb() acks the message with err, an own ack would give
+	 * userspace a second one for the same sequence number */
 	return err;
 }
 
@@ -350,7 +569,7 @@ int ce_gw_netlink_del(struct sk_buff *skb_info, struct genl_info *info)
 	if (nla_dst == NULL) { /* del route is called in userspace */
 		if (*nla_id_data == 0) {
 			err = -ENODATA;
-			pr_warning("ce_gw: ID is missing: %d\n", err);
+			pr_warn("ce_gw: ID is missing: %d\n", err);
 			goto ce_gw_del_error;
 		} else
 			pr_debug("ce_gw: del device: %d\n", *nla_id_data);
@@ -373,10 +592,38 @@ int ce_gw_netlink_del(struct sk_buff *skb_info, struct genl_info *info)
 	}
 
 ce_gw_del_error:
-	netlink_ack(skb_info, info->nlhdr, -err);
+	/* acked by netlink_rcv_skb() */
 	return err;
 }
 
+/**
+ * @fn static bool ce_gw_netlink_tx_first(struct ce_gw_job *cgj)
+ * @brief Checks if a route is the first one of its CAN destination in the
+ *        route list
+ * @param cgj The route, cgj->tx must be set
+ * @details Values of the CAN destination, which all of its routes share, are
+ *          only sent with its first route.
+ * @ingroup net
+ */
+static bool ce_gw_netlink_tx_first(struct ce_gw_job *cgj)
+{
+	struct ce_gw_job *gwj;
+
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	hlist_for_each_entry(gwj, ce_gw_get_job_list(), list) {
+#	else
+	struct hlist_node *pos;
+	hlist_for_each_entry(gwj, pos, ce_gw_get_job_list(), list) {
+#	endif
+		if (gwj == cgj)
+			return true;
+		if (gwj->tx == cgj->tx)
+			return false;
+	}
+
+	return true;
+}
+
 /**
  * @fn int ce_gw_netlink_list(struct sk_buff *skb_info, struct genl_info *info)
  * @brief Send informations of one or more routes to userspace.
@@ -394,6 +641,19 @@ ce_gw_del_error:
  * + #CE_GW_A_TYPE
  * + #CE_GW_A_HNDL
  * + #CE_GW_A_DROP
+ * + #CE_GW_A_HOPS
+ * + #CE_GW_A_LOOP
+ * + #CE_GW_A_FILTERED
+ * + #CE_GW_A_RESERVE, #CE_GW_A_RESERVE_HITS, #CE_GW_A_RESERVE_EMPTY: only for
+ *   routes with a reserve
+ * + #CE_GW_A_DEFER_CPU: only for deferred routes with a fixed CPU
+ * + #CE_GW_A_RING_SIZE: only for routes with a capture ring
+ * + #CE_GW_A_BPF_ID: only for routes with a BPF program
+ * + #CE_GW_A_TXQ_WEIGHT, #CE_GW_A_TXQ_DEPTH, #CE_GW_A_TXQ_WAIT_AVG,
+ *   #CE_GW_A_TXQ_WAIT_MAX, #CE_GW_A_TXQ_LOAD_MAX: only for routes with a CAN
+ *   destination
+ * + #CE_GW_A_TXQ_LOAD: once per CAN destination, with its first route in the
+ *   list or with the route of #CE_GW_A_ID
  * @ingroup net
  * @retval 0 on success
  * @retval <0 on failure
@@ -448,13 +708,55 @@ int ce_gw_netlink_list(struct sk_buff *skb_info, struct genl_info *info)
 			goto ce_gw_list_error;
 		}
 
+		struct ce_gw_job_stats stats;
+		ce_gw_job_get_stats(cgj, &stats);
+
 		err = nla_put_string(skb, CE_GW_A_SRC, cgj->src.dev->name);
 		err += nla_put_string(skb, CE_GW_A_DST, cgj->dst.dev->name);
 		err += nla_put_u32(skb, CE_GW_A_ID, cgj->id);
 		err += nla_put_u32(skb, CE_GW_A_FLAGS, cgj->flags);
 		err += nla_put_u8(skb, CE_GW_A_TYPE, cgj->type);
-		err += nla_put_u32(skb, CE_GW_A_HNDL, cgj->handled_frames);
-		err += nla_put_u32(skb, CE_GW_A_DROP, cgj->dropped_frames);
+		err += nla_put_u32(skb, CE_GW_A_HNDL, stats.handled_frames);
+		err += nla_put_u32(skb, CE_GW_A_DROP, stats.dropped_frames);
+		err += nla_put_u8(skb, CE_GW_A_HOPS, cgj->hop_limit);
+		err += nla_put_u32(skb, CE_GW_A_LOOP, stats.loop_frames);
+		err += nla_put_u32(skb, CE_GW_A_FILTERED,
+		                   stats.filtered_frames);
+		if (cgj->reserve.pool != NULL) {
+			err += nla_put_u32(skb, CE_GW_A_RESERVE,
+			                   cgj->reserve.pool->min_nr);
+			err += nla_put_u32(skb, CE_GW_A_RESERVE_HITS,
+			                   cgj->reserve.hits);
+			err += nla_put_u32(skb, CE_GW_A_RESERVE_EMPTY,
+			                   cgj->reserve.empty);
+		}
+		if ((cgj->flags & CE_GW_F_DEFER) && cgj->defer_cpu >= 0)
+			err += nla_put_u32(skb, CE_GW_A_DEFER_CPU,
+			                   cgj->defer_cpu);
+		if (cgj->ring != NULL)
+			err += nla_put_u32(skb, CE_GW_A_RING_SIZE,
+			                   cgj->ring->mask + 1);
+#		ifdef CE_GW_BPF
+		if (cgj->prog != NULL)
+			err += nla_put_u32(skb, CE_GW_A_BPF_ID,
+			                   cgj->prog->aux->id);
+#		endif
+		if (cgj->tx != NULL) {
+			u32 depth, wait_avg, wait_max;
+
+			ce_gw_tx_route_stats(cgj, &depth, &wait_avg, &wait_max);
+			err += nla_put_u32(skb, CE_GW_A_TXQ_WEIGHT,
+			                   cgj->txr.weight);
+			err += nla_put_u32(skb, CE_GW_A_TXQ_DEPTH, depth);
+			err += nla_put_u32(skb, CE_GW_A_TXQ_WAIT_AVG, wait_avg);
+			err += nla_put_u32(skb, CE_GW_A_TXQ_WAIT_MAX, wait_max);
+			err += nla_put_u8(skb, CE_GW_A_TXQ_LOAD_MAX,
+			                  cgj->tx->load_max);
+			/* the load belongs to the CAN destination */
+			if (*nla_id_data != 0 || ce_gw_netlink_tx_first(cgj))
+				err += nla_put_u8(skb, CE_GW_A_TXQ_LOAD,
+				                  ce_gw_tx_load(cgj->tx));
+		}
 		if (err != 0) {
 			pr_err("ce_gw: Putting Netlink Attribute Failed.\n");
 			goto ce_gw_list_error;
@@ -522,147 +824,197 @@ ce_gw_list_error:
 }
 
 /**
- * @brief details of ce_gw_netlink_echo()
+ * @fn int ce_gw_netlink_snap(struct sk_buff *skb, struct netlink_callback *cb)
+ * @brief Send the last received frame of every ID of a CAN device to
+ *        userspace.
+ * @param skb Netlink Socket Buffer for the next message
+ * @param cb Netlink Callback, cb->args[0] holds the next entry of the table
+ *        and cb->args[1] the index of the CAN device
+ * @details get Netlink Attribute:
+ * + #CE_GW_A_SRC: the CAN device, a route of it must have the
+ *   #CE_GW_F_SNAPSHOT flag.
+ * @details Dump: every message has the netlink Attribute:
+ * + #CE_GW_A_SNAP: as many struct ce_gw_snap_ent of the received IDs as fit
+ *   in the message
  * @ingroup net
+ * @retval >0 length of the message
+ * @retval 0 at the end of the table
+ * @retval <0 on failure
  */
-struct genl_ops ce_gw_genl_ops_echo = {
-	.cmd = CE_GW_C_ECHO,
-	.internal_flags = CE_GW_NO_FLAG,
-	.flags = CE_GW_NO_FLAG,
-	.policy = ce_gw_genl_policy,
-	.doit = ce_gw_netlink_echo,
-	.dumpit = NULL,
-	.done = NULL,
-};
+int ce_gw_netlink_snap(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	const size_t size = sizeof(struct ce_gw_snap_ent);
+	struct ce_gw_snap *snap;
+	struct net_device *dev;
+	struct nlattr *attr;
+	unsigned int n, max;
+	void *user_hdr;
+	u32 pos = cb->args[0];
+	int room;
+
+	pr_debug("ce_gw_netlink: ce_gw_netlink_snap is called.\n");
+
+	if (cb->args[1] == 0) {
+		attr = nlmsg_find_attr(cb->nlh,
+		                       GENL_HDRLEN + CE_GW_USER_HDR_SIZE,
+		                       CE_GW_A_SRC);
+		if (attr == NULL) {
+			pr_err("ce_gw: SRC is missing.\n");
+			return -ENODATA;
+		}
 
-/**
- * @brief details of ce_gw_netlink_add()
- * @ingroup net
- */
-struct genl_ops ce_gw_genl_ops_add = {
-	.cmd = CE_GW_C_ADD,
-	.internal_flags = CE_GW_NO_FLAG,
-	.flags = CE_GW_NO_FLAG,
-	.policy = ce_gw_genl_policy,
-	.doit = ce_gw_netlink_add,
-	.dumpit = NULL,
-	.done = NULL,
-};
+		dev = dev_get_by_name(&init_net, nla_data(attr));
+		if (dev == NULL) {
+			pr_err("ce_gw: No such device.\n");
+			return -ENODEV;
+		}
+		cb->args[1] = dev->ifindex;
+		dev_put(dev);
+	}
 
-/**
- * @brief details of ce_gw_netlink_del()
- * @ingroup net
- */
-struct genl_ops ce_gw_genl_ops_del = {
-	.cmd = CE_GW_C_DEL,
-	.internal_flags = CE_GW_NO_FLAG,
-	.flags = CE_GW_NO_FLAG,
-	.policy = ce_gw_genl_policy,
-	.doit = ce_gw_netlink_del,
-	.dumpit = NULL,
-	.done = NULL,
-};
+	/* the table lives as long as a route, routes change under genl_mutex
+	 * which is also held during the dump */
+	snap = ce_gw_snap_find(cb->args[1]);
+	if (snap == NULL)
+		return -ENOENT;
+
+#	if LINUX_VERSION_CODE < KERNEL_VERSION(3,7,0)
+	user_hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).pid,
+	                       cb->nlh->nlmsg_seq, &ce_gw_genl_family,
+	                       NLM_F_MULTI, CE_GW_C_SNAP);
+#	else
+	user_hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).portid,
+	                       cb->nlh->nlmsg_seq, &ce_gw_genl_family,
+	                       NLM_F_MULTI, CE_GW_C_SNAP);
+#	endif
+	if (user_hdr == NULL)
+		return -EMSGSIZE;
+
+	room = skb_tailroom(skb) - nla_total_size(0);
+	max = room > 0 ? room / size : 0;
+	if (max == 0) {
+		genlmsg_cancel(skb, user_hdr);
+		return -EMSGSIZE;
+	}
+
+	/* copy the entries straight into the message and trim the rest */
+	attr = nla_reserve(skb, CE_GW_A_SNAP, max * size);
+	if (attr == NULL) {
+		genlmsg_cancel(skb, user_hdr);
+		return -EMSGSIZE;
+	}
+	n = ce_gw_snap_read(snap, &pos, nla_data(attr), max);
+	if (n == 0) {
+		/* an empty skb ends the dump with NLMSG_DONE */
+		genlmsg_cancel(skb, user_hdr);
+		return 0;
+	}
+	attr->nla_len = nla_attr_size(n * size);
+	nlmsg_trim(skb, (u8 *) attr + nla_total_size(n * size));
+
+	genlmsg_end(skb, user_hdr);
+	cb->args[0] = pos;
+
+	return skb->len;
+}
+
+/** Policy of an operation, since Linux 5.2 it is set in the family */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,2,0)
+#define CE_GW_GENL_OP_POLICY \
+	.validate = GENL_DONT_VALIDATE_STRICT | GENL_DONT_VALIDATE_DUMP,
+#else
+#define CE_GW_GENL_OP_POLICY .policy = ce_gw_genl_policy,
+#endif
 
 /**
- * @brief details of ce_gw_netlink_list()
+ * @brief Generic Netlink Operations of the family
  * @ingroup net
  */
-struct genl_ops ce_gw_genl_ops_list = {
-	.cmd = CE_GW_C_LIST,
-	.internal_flags = CE_GW_NO_FLAG,
-	.flags = CE_GW_NO_FLAG,
-	.policy = ce_gw_genl_policy,
-	.doit = ce_gw_netlink_list,
-	.dumpit = NULL,
-	.done = NULL,
+static struct genl_ops ce_gw_genl_ops[] = {
+	{
+		/* details of ce_gw_netlink_echo() */
+		.cmd = CE_GW_C_ECHO,
+		.internal_flags = CE_GW_NO_FLAG,
+		.flags = CE_GW_NO_FLAG,
+		CE_GW_GENL_OP_POLICY
+		.doit = ce_gw_netlink_echo,
+		.dumpit = NULL,
+		.done = NULL,
+	},
+	{
+		/* details of ce_gw_netlink_add() */
+		.cmd = CE_GW_C_ADD,
+		.internal_flags = CE_GW_NO_FLAG,
+		.flags = CE_GW_NO_FLAG,
+		CE_GW_GENL_OP_POLICY
+		.doit = ce_gw_netlink_add,
+		.dumpit = NULL,
+		.done = NULL,
+	},
+	{
+		/* details of ce_gw_netlink_del() */
+		.cmd = CE_GW_C_DEL,
+		.internal_flags = CE_GW_NO_FLAG,
+		.flags = CE_GW_NO_FLAG,
+		CE_GW_GENL_OP_POLICY
+		.doit = ce_gw_netlink_del,
+		.dumpit = NULL,
+		.done = NULL,
+	},
+	{
+		/* details of ce_gw_netlink_list() */
+		.cmd = CE_GW_C_LIST,
+		.internal_flags = CE_GW_NO_FLAG,
+		.flags = CE_GW_NO_FLAG,
+		CE_GW_GENL_OP_POLICY
+		.doit = ce_gw_netlink_list,
+		.dumpit = NULL,
+		.done = NULL,
+	},
+	{
+		/* details of ce_gw_netlink_snap() */
+		.cmd = CE_GW_C_SNAP,
+		.internal_flags = CE_GW_NO_FLAG,
+		.flags = CE_GW_NO_FLAG,
+		CE_GW_GENL_OP_POLICY
+		.doit = NULL,
+		.dumpit = ce_gw_netlink_snap,
+		.done = NULL,
+	},
 };
 
 
 int ce_gw_netlink_init(void) {
 	int err;
 
-	if ((err = genl_register_family(&ce_gw_genl_family)) != 0) {
-		pr_err("ce_gw: Error during registering family ce_gw: %i\n",
-		       err);
-		goto ce_gw_init_family_err;
-	}
-
-	err = genl_register_ops(&ce_gw_genl_family, &ce_gw_genl_ops_echo);
-	if (err != 0) {
-		pr_err("ce_gw: Error during registering operation echo: %i\n",
-		       err);
-		goto ce_gw_init_echo_err;
-	}
-
-	err = genl_register_ops(&ce_gw_genl_family, &ce_gw_genl_ops_del);
-	if (err != 0) {
-		pr_err("ce_gw: Error during registering operation del: %i\n",
-		       err);
-		goto ce_gw_init_del_err;
-	}
-
-	err = genl_register_ops(&ce_gw_genl_family, &ce_gw_genl_ops_add);
-	if (err != 0) {
-		pr_err("ce_gw: Error during registering operation add: %i\n",
-		       err);
-		goto ce_gw_init_add_err;
-	}
-
-	err = genl_register_ops(&ce_gw_genl_family, &ce_gw_genl_ops_list);
+	/* genl_register_ops() is gone since Linux 3.13, the operations are
+	 * registered with the family */
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)
+	ce_gw_genl_family.ops = ce_gw_genl_ops;
+	ce_gw_genl_family.n_ops = ARRAY_SIZE(ce_gw_genl_ops);
+	err = genl_register_family(&ce_gw_genl_family);
+#	elif LINUX_VERSION_CODE >= KERNEL_VERSION(3,13,0)
+	err = genl_register_family_with_ops(&ce_gw_genl_family,
+	                                    ce_gw_genl_ops);
+#	else
+	err = genl_register_family_with_ops(&ce_gw_genl_family,
+	                                    ce_gw_genl_ops,
+	                                    ARRAY_SIZE(ce_gw_genl_ops));
+#	endif
 	if (err != 0) {
-		pr_err("ce_gw: Error during registering operation list: %i\n",
+		pr_err("ce_gw: Error during registering family ce_gw: %i\n",
 		       err);
-		goto ce_gw_init_list_err;
+		return -1;
 	}
 
 	return 0;
-
-
-	err = genl_unregister_ops(&ce_gw_genl_family, &ce_gw_genl_ops_list);
-
-ce_gw_init_list_err:
-	err = genl_unregister_ops(&ce_gw_genl_family, &ce_gw_genl_ops_add);
-
-ce_gw_init_add_err:
-	err = genl_unregister_ops(&ce_gw_genl_family, &ce_gw_genl_ops_del);
-
-ce_gw_init_del_err:
-	err = genl_unregister_ops(&ce_gw_genl_family, &ce_gw_genl_ops_echo);
-
-ce_gw_init_echo_err:
-	err = genl_unregister_family(&ce_gw_genl_family);
-
-ce_gw_init_family_err:
-	return -1;
 }
 
 
 void ce_gw_netlink_exit(void) {
 	int err;
-	err = genl_unregister_ops(&ce_gw_genl_family, &ce_gw_genl_ops_echo);
-	if (err != 0) {
-		pr_err("ce_gw: Error during unregistering operation echo: %i\n",
-		       err);
-	}
-
-	err = genl_unregister_ops(&ce_gw_genl_family, &ce_gw_genl_ops_add);
-	if (err != 0) {
-		pr_err("ce_gw: Error during unregistering operation add: %i\n",
-		       err);
-	}
-
-	err = genl_unregister_ops(&ce_gw_genl_family, &ce_gw_genl_ops_del);
-	if (err != 0) {
-		pr_err("ce_gw: Error during unregistering operation del: %i\n",
-		       err);
-	}
-
-	err = genl_unregister_ops(&ce_gw_genl_family, &ce_gw_genl_ops_list);
-	if (err != 0) {
-		pr_err("ce_gw: Error during unregistering operation del: %i\n",
-		       err);
-	}
 
+	/* the operations are unregistered with the family */
 	err = genl_unregister_family(&ce_gw_genl_family);
 	if (err != 0) {
 		pr_err("ce_gw: Error during unregistering family ce_gw: %i\n",
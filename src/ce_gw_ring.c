@@ -0,0 +1,330 @@
+/**
+ * @file ce_gw_ring.c
+ * @brief Control Area Network - Ethernet - Gateway - Capture Ring
+ * @author Fabian Raab (fabian.raab@tum.de)
+ * @date May, 2013
+ * @copyright GNU Public License v3 or higher
+ * @ingroup files
+ * @{
+ */
+
+/*****************************************************************************
+ * (C) Copyright 2013 Fabian Raab, Stefan Smarzly
+ *
+ * This file is part of CAN-Eth-GW.
+ *
+ * CAN-Eth-GW is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CAN-Eth-GW is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CAN-Eth-GW.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/eventfd.h>
+#include <linux/uaccess.h>
+#include <linux/log2.h>
+#include <linux/ktime.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/can.h>
+#include "ce_gw_ring.h"
+
+#include <asm-generic/errno-base.h>
+#include <asm-generic/errno.h>
+
+static unsigned int ring_records = 4096;
+module_param(ring_records, uint, S_IRUGO);
+MODULE_PARM_DESC(ring_records, "Default number of records of a capture ring "
+                 "(default 4096)");
+
+/** Maximum number of records of a capture ring */
+#define CE_GW_RING_MAX (1 << 20)
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+typedef unsigned int __poll_t;
+#endif
+
+/**
+ * @fn static void ce_gw_ring_free(struct kref *ref)
+ * @brief Frees the ring after the route and the last file released it
+ * @ingroup alloc
+ */
+static void ce_gw_ring_free(struct kref *ref)
+{
+	struct ce_gw_ring *ring = container_of(ref, struct ce_gw_ring, ref);
+
+	if (ring->efd != NULL)
+		eventfd_ctx_put(ring->efd);
+	vfree(ring->hdr);
+	kfree(ring);
+}
+
+/**
+ * @fn static int ce_gw_ring_open(struct inode *inode, struct file *file)
+ * @brief Character device open(), takes a reference of the ring
+ * @ingroup proc
+ */
+static int ce_gw_ring_open(struct inode *inode, struct file *file)
+{
+	struct miscdevice *misc = file->private_data;
+	struct ce_gw_ring *ring = container_of(misc, struct ce_gw_ring, misc);
+
+	/* misc_open() holds misc_mtx, so the ring is not yet released */
+	kref_get(&ring->ref);
+	file->private_data = ring;
+
+	return nonseekable_open(inode, file);
+}
+
+/**
+ * @fn static int ce_gw_ring_release(struct inode *inode, struct file *file)
+ * @brief Character device close(), drops the reference of the file
+ * @ingroup proc
+ */
+static int ce_gw_ring_release(struct inode *inode, struct file *file)
+{
+	struct ce_gw_ring *ring = file->private_data;
+
+	kref_put(&ring->ref, ce_gw_ring_free);
+	return 0;
+}
+
+/**
+ * @fn static int ce_gw_ring_mmap(struct file *file,
+ *                                struct vm_area_struct *vma)
+ * @brief Maps the header and the records of the ring
+ * @retval -EINVAL if the mapping is larger than the ring or has an offset
+ * @ingroup proc
+ */
+static int ce_gw_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct ce_gw_ring *ring = file->private_data;
+
+	if (vma->vm_pgoff != 0 ||
+	    vma->vm_end - vma->vm_start > PAGE_ALIGN(ring->size))
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, ring->hdr, 0);
+}
+
+/**
+ * @fn static __poll_t ce_gw_ring_poll(struct file *file, poll_table *wait)
+ * @brief Readable if the ring holds at least ce_gw_ring.wakeup records the
+ *        consumer has not read yet
+ * @details POLLHUP after the route was removed.
+ * @ingroup proc
+ */
+static __poll_t ce_gw_ring_poll(struct file *file, poll_table *wait)
+{
+	struct ce_gw_ring *ring = file->private_data;
+	__poll_t mask = 0;
+	u64 unread;
+
+	poll_wait(file, &ring->wait, wait);
+
+	unread = READ_ONCE(ring->head) - READ_ONCE(ring->hdr->tail);
+	if (unread != 0 && unread >= READ_ONCE(ring->wakeup))
+		mask |= POLLIN | POLLRDNORM;
+	if (READ_ONCE(ring->dead))
+		mask |= POLLHUP;
+
+	return mask;
+}
+
+/**
+ * @fn static long ce_gw_ring_ioctl(struct file *file, unsigned int cmd,
+ *                                  unsigned long arg)
+ * @brief Character device ioctl(), handles #CE_GW_RING_IOC_EVENTFD and
+ *        #CE_GW_RING_IOC_WAKEUP
+ * @retval 0 on success
+ * @retval -EFAULT on an invalid pointer
+ * @retval -EBADF if the file descriptor is no eventfd
+ * @retval -EINVAL if the wake up threshold is 0 or larger than the ring
+ * @retval -ENOTTY on unknown commands
+ * @details The settings belong to the ring, not to the file.
+ * @ingroup proc
+ */
+static long ce_gw_ring_ioctl(struct file *file, unsigned int cmd,
+                             unsigned long arg)
+{
+	struct ce_gw_ring *ring = file->private_data;
+	struct eventfd_ctx *efd = NULL;
+	s32 fd;
+	u32 wakeup;
+
+	switch (cmd) {
+	case CE_GW_RING_IOC_EVENTFD:
+		if (get_user(fd, (s32 __user *) arg))
+			return -EFAULT;
+		if (fd >= 0) {
+			efd = eventfd_ctx_fdget(fd);
+			if (IS_ERR(efd))
+				return PTR_ERR(efd);
+		}
+
+		spin_lock_bh(&ring->lock);
+		swap(ring->efd, efd);
+		ring->efd_head = ring->head;
+		spin_unlock_bh(&ring->lock);
+
+		if (efd != NULL)
+			eventfd_ctx_put(efd);
+		return 0;
+	case CE_GW_RING_IOC_WAKEUP:
+		if (get_user(wakeup, (u32 __user *) arg))
+			return -EFAULT;
+		if (wakeup == 0 || wakeup > ring->mask + 1)
+			return -EINVAL;
+
+		WRITE_ONCE(ring->wakeup, wakeup);
+		/* a lower threshold may already be reached */
+		wake_up_interruptible_all(&ring->wait);
+		return 0;
+	default:
+		return -ENOTTY;
+	}
+}
+
+static const struct file_operations ce_gw_ring_fops = {
+	.owner = THIS_MODULE,
+	.open = ce_gw_ring_open,
+	.release = ce_gw_ring_release,
+	.mmap = ce_gw_ring_mmap,
+	.poll = ce_gw_ring_poll,
+	.unlocked_ioctl = ce_gw_ring_ioctl,
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
+	.compat_ioctl = compat_ptr_ioctl,
+#	endif
+};
+
+struct ce_gw_ring *ce_gw_ring_create(u32 id, u32 records)
+{
+	struct ce_gw_ring *ring;
+
+	if (records == 0)
+		records = ring_records;
+	records = roundup_pow_of_two(clamp_t(u32, records, 2,
+	                                     CE_GW_RING_MAX));
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (ring == NULL)
+		return NULL;
+
+	ring->size = PAGE_SIZE + (size_t) records *
+	             sizeof(struct ce_gw_ring_rec);
+	ring->hdr = vmalloc_user(ring->size);
+	if (ring->hdr == NULL) {
+		kfree(ring);
+		return NULL;
+	}
+	ring->data = (u8 *) ring->hdr + PAGE_SIZE;
+	ring->mask = records - 1;
+	ring->wakeup = 1;
+	ring->hdr->version = CE_GW_RING_VERSION;
+	ring->hdr->records = records;
+	ring->hdr->rec_size = sizeof(struct ce_gw_ring_rec);
+	ring->hdr->data_offset = PAGE_SIZE;
+
+	spin_lock_init(&ring->lock);
+	init_waitqueue_head(&ring->wait);
+	kref_init(&ring->ref);
+
+	snprintf(ring->name, sizeof(ring->name), "cegw_ring%u", id);
+	ring->misc.minor = MISC_DYNAMIC_MINOR;
+	ring->misc.name = ring->name;
+	ring->misc.fops = &ce_gw_ring_fops;
+	if (misc_register(&ring->misc) != 0) {
+		pr_err("ce_gw_ring: registering %s failed.\n", ring->name);
+		kref_put(&ring->ref, ce_gw_ring_free);
+		return NULL;
+	}
+
+	return ring;
+}
+
+void ce_gw_ring_destroy(struct ce_gw_ring *ring)
+{
+	if (ring == NULL)
+		return;
+
+	misc_deregister(&ring->misc);
+
+	WRITE_ONCE(ring->dead, true);
+	wake_up_interruptible_all(&ring->wait);
+
+	kref_put(&ring->ref, ce_gw_ring_free);
+}
+
+int ce_gw_ring_put(struct ce_gw_ring *ring, struct sk_buff *can_skb)
+{
+	struct ce_gw_ring_hdr *hdr = ring->hdr;
+	struct ce_gw_ring_rec *rec;
+	unsigned int len = min_t(unsigned int, can_skb->len, CANFD_MTU);
+	u64 head, tail, tstamp, unread;
+	u32 wakeup = READ_ONCE(ring->wakeup);
+
+	spin_lock(&ring->lock);
+
+	/* hdr is writable by user space, only tail is read back from it */
+	head = ring->head;
+	/* tail is written by user space, a bogus value only drops frames */
+	tail = smp_load_acquire(&hdr->tail);
+	if (head - tail > ring->mask) {
+		WRITE_ONCE(hdr->dropped, ++ring->dropped);
+		spin_unlock(&ring->lock);
+		return -ENOBUFS;
+	}
+
+	rec = (struct ce_gw_ring_rec *) ((u8 *) ring->data +
+	      (size_t) (head & ring->mask) * sizeof(struct ce_gw_ring_rec));
+	tstamp = ktime_to_ns(can_skb->tstamp);
+	rec->tstamp = tstamp ? tstamp : ktime_get_real_ns();
+	rec->ifindex = can_skb->dev ? can_skb->dev->ifindex : 0;
+	rec->flags = can_skb->len == CANFD_MTU ? CE_GW_RING_REC_FD : 0;
+	skb_copy_bits(can_skb, 0, &rec->frame, len);
+
+	/* the record must be visible before the new head */
+	WRITE_ONCE(ring->head, head + 1);
+	smp_store_release(&hdr->head, head + 1);
+	unread = head + 1 - tail;
+
+	/* at most one signal per wakeup records, so a slow consumer is not
+	 * signalled for every frame */
+	if (ring->efd != NULL && unread >= wakeup &&
+	    head + 1 - ring->efd_head >= wakeup) {
+		ring->efd_head = head + 1;
+#		if LINUX_VERSION_CODE >= KERNEL_VERSION(6,8,0)
+		eventfd_signal(ring->efd);
+#		else
+		eventfd_signal(ring->efd, 1);
+#		endif
+	}
+
+	spin_unlock(&ring->lock);
+
+	/* a consumer only sleeps when it has read everything, so most frames
+	 * need no wake up */
+	smp_mb();
+	if (unread >= wakeup && waitqueue_active(&ring->wait))
+		wake_up_interruptible(&ring->wait);
+
+	return 0;
+}
+
+/**@}*/
@@ -0,0 +1,322 @@
+/**
+ * @file ce_gw_skb.c
+ * @brief Control Area Network - Ethernet - Gateway - Frame Allocation
+ * @author Fabian Raab (fabian.raab@tum.de)
+ * @date May, 2013
+ * @copyright GNU Public License v3 or higher
+ * @ingroup files
+ * @{
+ */
+
+/*****************************************************************************
+ * (C) Copyright 2013 Fabian Raab, Stefan Smarzly
+ *
+ * This file is part of CAN-Eth-GW.
+ *
+ * CAN-Eth-GW is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CAN-Eth-GW is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CAN-Eth-GW.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/if_ether.h>
+#include <linux/can.h>
+#include <linux/mempool.h>
+#include <linux/workqueue.h>
+#include "ce_gw_skb.h"
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+#include <linux/can/skb.h>	/* for can_skb_reserve */
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,15,0) && IS_ENABLED(CONFIG_PAGE_POOL)
+#define CE_GW_SKB_PAGE_POOL
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,6,0)
+#include <net/page_pool/helpers.h>
+#else
+#include <net/page_pool.h>
+#endif
+#endif
+
+#include <asm-generic/errno-base.h>
+#include <asm-generic/errno.h>
+
+static bool skb_cache = true;
+module_param(skb_cache, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(skb_cache, "Allocate CAN -> ETH frames from recycled per CPU "
+                 "page pools, needs Linux 5.15 (default on)");
+
+/** Number of pages each per CPU page pool keeps ready */
+#define CE_GW_SKB_POOL_SIZE 256
+
+/** Data bytes of a reserved sk_buff, enough for an ethernet header or
+ *  struct can_skb_priv followed by a CAN FD frame */
+#define CE_GW_SKB_RESERVE_DATA 128
+
+#ifdef CE_GW_SKB_PAGE_POOL
+static DEFINE_PER_CPU(struct page_pool *, ce_gw_skb_pool);
+
+/**
+ * @fn static struct sk_buff *ce_gw_skb_pool_alloc(struct net_device *dev,
+ *                                                unsigned int len)
+ * @brief Builds an sk_buff around a page fragment of the page pool of the
+ *        current CPU
+ * @param dev The device of the frame
+ * @param len Bytes of data the sk_buff must hold
+ * @retval NULL if the pool is empty and no page could be allocated
+ * @pre must be called in softirq context
+ * @ingroup alloc
+ */
+static struct sk_buff *ce_gw_skb_pool_alloc(struct net_device *dev,
+                                            unsigned int len)
+{
+	struct page_pool *pool = this_cpu_read(ce_gw_skb_pool);
+	unsigned int truesize = SKB_DATA_ALIGN(NET_SKB_PAD + len) +
+	                        SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+	unsigned int offset;
+	struct sk_buff *skb;
+	struct page *page;
+
+	if (pool == NULL || truesize > PAGE_SIZE)
+		return NULL;
+
+	page = page_pool_dev_alloc_frag(pool, &offset, truesize);
+	if (page == NULL)
+		return NULL;
+
+	skb = napi_build_skb(page_address(page) + offset, truesize);
+	if (skb == NULL) {
+		page_pool_put_full_page(pool, page, false);
+		return NULL;
+	}
+
+	skb_reserve(skb, NET_SKB_PAD);
+	skb_mark_for_recycle(skb);
+	skb->dev = dev;
+
+	return skb;
+}
+#endif
+
+struct sk_buff *ce_gw_skb_alloc(struct net_device *dev, unsigned int len)
+{
+#	ifdef CE_GW_SKB_PAGE_POOL
+	struct sk_buff *skb;
+
+	if (skb_cache && in_softirq()) {
+		skb = ce_gw_skb_pool_alloc(dev, len);
+		if (skb != NULL)
+			return skb;
+	}
+#	endif
+
+	return netdev_alloc_skb(dev, len);
+}
+
+/**
+ * @fn static void *ce_gw_skb_reserve_new(gfp_t gfp, void *data)
+ * @brief mempool allocation function of the reserve
+ * @details Only fills the pool in process context. mempool_alloc() in the
+ *          receive path calls it first, but the normal allocation of the
+ *          caller has just failed, so every element mempool_alloc() returns
+ *          there is taken from the reserve.
+ * @ingroup alloc
+ */
+static void *ce_gw_skb_reserve_new(gfp_t gfp, void *data)
+{
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(4,4,0)
+	if (!gfpflags_allow_blocking(gfp))
+		return NULL;
+#	else
+	if ((gfp & __GFP_WAIT) == 0)
+		return NULL;
+#	endif
+
+	return alloc_skb(NET_SKB_PAD + CE_GW_SKB_RESERVE_DATA, gfp);
+}
+
+/**
+ * @fn static void ce_gw_skb_reserve_free(void *element, void *data)
+ * @brief mempool free function of the reserve
+ * @ingroup alloc
+ */
+static void ce_gw_skb_reserve_free(void *element, void *data)
+{
+	kfree_skb((struct sk_buff *)element);
+}
+
+/**
+ * @fn static void ce_gw_skb_reserve_refill(struct work_struct *work)
+ * @brief Puts new sk_buffs into the reserve until it is full again
+ * @param work refill of struct ce_gw_skb_reserve
+ * @details mempool_free() keeps an element if the pool is not full, else it
+ *          frees the element.
+ * @ingroup alloc
+ */
+static void ce_gw_skb_reserve_refill(struct work_struct *work)
+{
+	struct ce_gw_skb_reserve *res;
+	struct sk_buff *skb;
+
+	res = container_of(work, struct ce_gw_skb_reserve, refill);
+
+	while (res->pool->curr_nr < res->pool->min_nr) {
+		skb = ce_gw_skb_reserve_new(GFP_KERNEL, NULL);
+		if (skb == NULL)
+			break;
+		mempool_free(skb, res->pool);
+	}
+}
+
+void ce_gw_skb_reserve_init(struct ce_gw_skb_reserve *res)
+{
+	res->pool = NULL;
+	res->hits = 0;
+	res->empty = 0;
+	INIT_WORK(&res->refill, ce_gw_skb_reserve_refill);
+}
+
+int ce_gw_skb_reserve_create(struct ce_gw_skb_reserve *res,
+                             unsigned int frames)
+{
+	if (frames == 0)
+		return 0;
+
+	res->pool = mempool_create(frames, ce_gw_skb_reserve_new,
+	                           ce_gw_skb_reserve_free, NULL);
+	if (res->pool == NULL)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void ce_gw_skb_reserve_destroy(struct ce_gw_skb_reserve *res)
+{
+	if (res->pool == NULL)
+		return;
+
+	cancel_work_sync(&res->refill);
+	mempool_destroy(res->pool);
+	res->pool = NULL;
+}
+
+struct sk_buff *ce_gw_skb_reserve_alloc(struct ce_gw_skb_reserve *res,
+                                        struct net_device *dev,
+                                        unsigned int len)
+{
+	struct sk_buff *skb;
+
+	if (res->pool == NULL || len > CE_GW_SKB_RESERVE_DATA)
+		return NULL;
+
+	/* always a reserved one, see ce_gw_skb_reserve_new() */
+	skb = mempool_alloc(res->pool, GFP_ATOMIC);
+	if (skb == NULL) {
+		res->empty++;
+		return NULL;
+	}
+	res->hits++;
+	schedule_work(&res->refill);
+
+	skb_reserve(skb, NET_SKB_PAD);
+	skb->dev = dev;
+
+	return skb;
+}
+
+struct sk_buff *ce_gw_skb_reserve_can(struct ce_gw_skb_reserve *res,
+                                      struct net_device *dev,
+                                      struct can_frame **cf)
+{
+	struct sk_buff *skb;
+
+	skb = ce_gw_skb_reserve_alloc(res, dev, CE_GW_SKB_RESERVE_DATA);
+	if (skb == NULL)
+		return NULL;
+
+	skb->protocol = htons(ETH_P_CAN);
+	skb->pkt_type = PACKET_BROADCAST;
+	skb->ip_summed = CHECKSUM_UNNECESSARY;
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+	skb_reset_transport_header(skb);
+
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	can_skb_reserve(skb);
+	memset(can_skb_prv(skb), 0, sizeof(struct can_skb_priv));
+	can_skb_prv(skb)->ifindex = dev->ifindex;
+#	endif
+
+	*cf = (struct can_frame *)skb_put(skb, sizeof(struct can_frame));
+	memset(*cf, 0, sizeof(struct can_frame));
+
+	return skb;
+}
+
+int ce_gw_skb_init(void)
+{
+#	ifdef CE_GW_SKB_PAGE_POOL
+	struct page_pool_params pp = {
+		.order = 0,
+		.pool_size = CE_GW_SKB_POOL_SIZE,
+#		if LINUX_VERSION_CODE < KERNEL_VERSION(6,6,0)
+		.flags = PP_FLAG_PAGE_FRAG,
+#		endif
+	};
+	struct page_pool *pool;
+	int cpu;
+#	endif
+
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	BUILD_BUG_ON(sizeof(struct can_skb_priv) + CANFD_MTU >
+	             CE_GW_SKB_RESERVE_DATA);
+#	endif
+	BUILD_BUG_ON(ETH_HLEN + CANFD_MTU > CE_GW_SKB_RESERVE_DATA);
+
+#	ifdef CE_GW_SKB_PAGE_POOL
+	for_each_possible_cpu(cpu) {
+		pp.nid = cpu_to_node(cpu);
+		pool = page_pool_create(&pp);
+		if (IS_ERR(pool)) {
+			pr_err("ce_gw_skb: page pool allocation failed.\n");
+			ce_gw_skb_exit();
+			return -ENOMEM;
+		}
+		per_cpu(ce_gw_skb_pool, cpu) = pool;
+	}
+#	endif
+
+	return 0;
+}
+
+void ce_gw_skb_exit(void)
+{
+#	ifdef CE_GW_SKB_PAGE_POOL
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		if (per_cpu(ce_gw_skb_pool, cpu) == NULL)
+			continue;
+
+		page_pool_destroy(per_cpu(ce_gw_skb_pool, cpu));
+		per_cpu(ce_gw_skb_pool, cpu) = NULL;
+	}
+#	endif
+}
+
+/**@}*/
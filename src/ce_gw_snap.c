@@ -0,0 +1,353 @@
+/**
+ * @file ce_gw_snap.c
+ * @brief Control Area Network - Ethernet - Gateway - Last Value Snapshot
+ * @author Fabian Raab (fabian.raab@tum.de)
+ * @date May, 2013
+ * @copyright GNU Public License v3 or higher
+ * @ingroup files
+ * @{
+ */
+
+/*****************************************************************************
+ * (C) Copyright 2013 Fabian Raab, Stefan Smarzly
+ *
+ * This file is part of CAN-Eth-GW.
+ *
+ * CAN-Eth-GW is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CAN-Eth-GW is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CAN-Eth-GW.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/log2.h>
+#include <linux/jhash.h>
+#include <linux/ktime.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/can.h>
+#include <linux/can/core.h>
+#include <net/net_namespace.h>
+#include "ce_gw_snap.h"
+
+#include <asm-generic/errno-base.h>
+#include <asm-generic/errno.h>
+
+static unsigned int snap_eff_slots = 1024;
+module_param(snap_eff_slots, uint, S_IRUGO);
+MODULE_PARM_DESC(snap_eff_slots, "Entries for EFF IDs in the snapshot table "
+                 "of a CAN device (default 1024)");
+
+/** Number of SFF IDs, direct-mapped in the snapshot table */
+#define CE_GW_SNAP_SFF (CAN_SFF_MASK + 1)
+
+/** All snapshot tables, changed under genl_mutex */
+static LIST_HEAD(ce_gw_snap_list);
+
+/**
+ * @fn static void ce_gw_snap_free(struct kref *ref)
+ * @brief Frees the table after the routes and the last file released it
+ * @ingroup alloc
+ */
+static void ce_gw_snap_free(struct kref *ref)
+{
+	struct ce_gw_snap *snap = container_of(ref, struct ce_gw_snap, ref);
+
+	vfree(snap->hdr);
+	kfree(snap);
+}
+
+/**
+ * @fn static int ce_gw_snap_open(struct inode *inode, struct file *file)
+ * @brief Character device open(), takes a reference of the table
+ * @ingroup proc
+ */
+static int ce_gw_snap_open(struct inode *inode, struct file *file)
+{
+	struct miscdevice *misc = file->private_data;
+	struct ce_gw_snap *snap = container_of(misc, struct ce_gw_snap, misc);
+
+	/* misc_open() holds misc_mtx, so the table is not yet released */
+	kref_get(&snap->ref);
+	file->private_data = snap;
+
+	return nonseekable_open(inode, file);
+}
+
+/**
+ * @fn static int ce_gw_snap_release(struct inode *inode, struct file *file)
+ * @brief Character device close(), drops the reference of the file
+ * @ingroup proc
+ */
+static int ce_gw_snap_release(struct inode *inode, struct file *file)
+{
+	struct ce_gw_snap *snap = file->private_data;
+
+	kref_put(&snap->ref, ce_gw_snap_free);
+	return 0;
+}
+
+/**
+ * @fn static int ce_gw_snap_mmap(struct file *file,
+ *                                struct vm_area_struct *vma)
+ * @brief Maps the header and the entries of the table read-only
+ * @retval -EINVAL if the mapping is larger than the table or has an offset
+ * @retval -EPERM if the mapping is writable
+ * @ingroup proc
+ */
+static int ce_gw_snap_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct ce_gw_snap *snap = file->private_data;
+
+	if (vma->vm_pgoff != 0 ||
+	    vma->vm_end - vma->vm_start > PAGE_ALIGN(snap->size))
+		return -EINVAL;
+	/* unlike the capture ring, readers have nothing to write */
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#	else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#	endif
+
+	return remap_vmalloc_range(vma, snap->hdr, 0);
+}
+
+static const struct file_operations ce_gw_snap_fops = {
+	.owner = THIS_MODULE,
+	.open = ce_gw_snap_open,
+	.release = ce_gw_snap_release,
+	.mmap = ce_gw_snap_mmap,
+};
+
+/**
+ * @fn static void ce_gw_snap_update(struct ce_gw_snap *snap,
+ *                                   const struct sk_buff *can_skb)
+ * @brief Stores a received CAN or CAN FD frame as the last one of its ID
+ * @param snap The table of the source device
+ * @param can_skb The received frame, it is not consumed
+ * @ingroup proc
+ */
+static void ce_gw_snap_update(struct ce_gw_snap *snap,
+                              const struct sk_buff *can_skb)
+{
+	const struct canfd_frame *cfd = (const struct canfd_frame *)
+	                                can_skb->data;
+	unsigned int len = min_t(unsigned int, can_skb->len, CANFD_MTU);
+	struct ce_gw_snap_ent *ent;
+	canid_t id = cfd->can_id;
+	u64 tstamp;
+	u32 idx, seq;
+
+	if (id & CAN_EFF_FLAG)
+		idx = CE_GW_SNAP_SFF + (jhash_1word(id & (CAN_EFF_FLAG |
+		                        CAN_EFF_MASK), 0) & snap->eff_mask);
+	else
+		idx = id & CAN_SFF_MASK;
+	ent = (struct ce_gw_snap_ent *) ((u8 *) snap->data +
+	      (size_t) idx * sizeof(struct ce_gw_snap_ent));
+
+	tstamp = ktime_to_ns(can_skb->tstamp);
+	if (tstamp == 0)
+		tstamp = ktime_get_real_ns();
+
+	spin_lock(&snap->lock);
+
+	/* seqcount in the shared memory, readers retry while it is odd */
+	seq = ent->seq;
+	WRITE_ONCE(ent->seq, seq + 1);
+	smp_wmb();
+
+	/* another EFF ID of the same entry starts a new count */
+	if (seq == 0 || ent->frame.can_id != id)
+		ent->count = 0;
+	ent->count++;
+	ent->tstamp = tstamp;
+	ent->flags = can_skb->len == CANFD_MTU ? CE_GW_SNAP_ENT_FD : 0;
+	memset(&ent->frame, 0, sizeof(ent->frame));
+	skb_copy_bits(can_skb, 0, &ent->frame, len);
+
+	/* 0 is reserved for entries which were never written */
+	smp_store_release(&ent->seq, seq + 2 ? seq + 2 : 2);
+	snap->hdr->updates++;
+
+	spin_unlock(&snap->lock);
+}
+
+/**
+ * @fn static void ce_gw_snap_rcv(struct sk_buff *can_skb, void *data)
+ * @brief Receiver of all frames of the CAN device, registered by the table
+ * @param can_skb The received frame, it belongs to af_can
+ * @param data The struct ce_gw_snap
+ * @details The table has its own receiver, so every frame is stored once,
+ *          whatever the CAN filters and hop limits of the routes are.
+ * @ingroup proc
+ */
+static void ce_gw_snap_rcv(struct sk_buff *can_skb, void *data)
+{
+	ce_gw_snap_update((struct ce_gw_snap *) data, can_skb);
+}
+
+/**
+ * @fn static struct ce_gw_snap *ce_gw_snap_create(struct net_device *dev)
+ * @brief Allocates a table and registers its character device
+ * @param dev The CAN device
+ * @retval NULL if the allocation or registration failed
+ * @ingroup alloc
+ */
+static struct ce_gw_snap *ce_gw_snap_create(struct net_device *dev)
+{
+	struct ce_gw_snap *snap;
+	u32 eff, entries;
+	int err;
+
+	eff = roundup_pow_of_two(clamp(snap_eff_slots, 1U, 1U << 20));
+	entries = CE_GW_SNAP_SFF + eff;
+
+	snap = kzalloc(sizeof(*snap), GFP_KERNEL);
+	if (snap == NULL)
+		return NULL;
+
+	snap->size = PAGE_SIZE + (size_t) entries *
+	             sizeof(struct ce_gw_snap_ent);
+	snap->hdr = vmalloc_user(snap->size);
+	if (snap->hdr == NULL) {
+		kfree(snap);
+		return NULL;
+	}
+	snap->data = (u8 *) snap->hdr + PAGE_SIZE;
+	snap->eff_mask = eff - 1;
+	snap->ifindex = dev->ifindex;
+	snap->hdr->version = CE_GW_SNAP_VERSION;
+	snap->hdr->entries = entries;
+	snap->hdr->sff_entries = CE_GW_SNAP_SFF;
+	snap->hdr->ent_size = sizeof(struct ce_gw_snap_ent);
+	snap->hdr->data_offset = PAGE_SIZE;
+	snap->hdr->ifindex = dev->ifindex;
+
+	spin_lock_init(&snap->lock);
+	kref_init(&snap->ref);
+
+	snprintf(snap->name, sizeof(snap->name), "cegw_snap_%s", dev->name);
+	snap->misc.minor = MISC_DYNAMIC_MINOR;
+	snap->misc.name = snap->name;
+	snap->misc.fops = &ce_gw_snap_fops;
+	if (misc_register(&snap->misc) != 0) {
+		pr_err("ce_gw_snap: registering %s failed.\n", snap->name);
+		kref_put(&snap->ref, ce_gw_snap_free);
+		return NULL;
+	}
+
+	/* mask 0 gets all frames of the device, but no error frames */
+	snap->dev = dev;
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(4,12,0)
+	err = can_rx_register(&init_net, dev, 0, 0, ce_gw_snap_rcv, snap,
+	                      "ce_gw_snap", NULL);
+#	elif LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+	err = can_rx_register(&init_net, dev, 0, 0, ce_gw_snap_rcv, snap,
+	                      "ce_gw_snap");
+#	else
+	err = can_rx_register(dev, 0, 0, ce_gw_snap_rcv, snap, "ce_gw_snap");
+#	endif
+	if (err != 0) {
+		pr_err("ce_gw_snap: receiver of %s failed: %d\n", dev->name,
+		       err);
+		misc_deregister(&snap->misc);
+		kref_put(&snap->ref, ce_gw_snap_free);
+		return NULL;
+	}
+
+	return snap;
+}
+
+struct ce_gw_snap *ce_gw_snap_find(int ifindex)
+{
+	struct ce_gw_snap *snap;
+
+	list_for_each_entry(snap, &ce_gw_snap_list, list) {
+		if (snap->ifindex == ifindex)
+			return snap;
+	}
+
+	return NULL;
+}
+
+struct ce_gw_snap *ce_gw_snap_get(struct net_device *dev)
+{
+	struct ce_gw_snap *snap;
+
+	snap = ce_gw_snap_find(dev->ifindex);
+	if (snap == NULL) {
+		snap = ce_gw_snap_create(dev);
+		if (snap == NULL)
+			return NULL;
+		list_add(&snap->list, &ce_gw_snap_list);
+	}
+
+	snap->routes++;
+	return snap;
+}
+
+void ce_gw_snap_put(struct ce_gw_snap *snap)
+{
+	if (snap == NULL || --snap->routes != 0)
+		return;
+
+	list_del(&snap->list);
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+	can_rx_unregister(&init_net, snap->dev, 0, 0, ce_gw_snap_rcv, snap);
+#	else
+	can_rx_unregister(snap->dev, 0, 0, ce_gw_snap_rcv, snap);
+#	endif
+	/* ce_gw_snap_rcv() may still use the table */
+	synchronize_rcu();
+	misc_deregister(&snap->misc);
+	kref_put(&snap->ref, ce_gw_snap_free);
+}
+
+unsigned int ce_gw_snap_read(struct ce_gw_snap *snap, u32 *pos,
+                             struct ce_gw_snap_ent *ents, unsigned int n)
+{
+	const struct ce_gw_snap_ent *ent;
+	unsigned int copied = 0;
+	u32 seq;
+
+	for (; *pos < snap->hdr->entries && copied < n; (*pos)++) {
+		ent = (const struct ce_gw_snap_ent *) ((const u8 *) snap->data +
+		      (size_t) *pos * sizeof(struct ce_gw_snap_ent));
+
+		do {
+			seq = smp_load_acquire(&ent->seq);
+			if (seq & 1) {
+				cpu_relax();
+				continue;
+			}
+			memcpy(&ents[copied], ent, sizeof(*ent));
+			smp_rmb();
+		} while ((seq & 1) || READ_ONCE(ent->seq) != seq);
+
+		if (seq != 0)
+			copied++;
+	}
+
+	return copied;
+}
+
+/**@}*/
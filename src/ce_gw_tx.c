@@ -0,0 +1,1057 @@
+/**
+ * @file ce_gw_tx.c
+ * @brief Control Area Network - Ethernet - Gateway - CAN Transmission
+ * @author Fabian Raab (fabian.raab@tum.de)
+ * @date May, 2013
+ * @copyright GNU Public License v3 or higher
+ * @ingroup files
+ * @{
+ */
+
+/*****************************************************************************
+ * (C) Copyright 2013 Fabian Raab, Stefan Smarzly
+ *
+ * This file is part of CAN-Eth-GW.
+ *
+ * CAN-Eth-GW is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CAN-Eth-GW is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CAN-Eth-GW.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/string.h>
+#include <linux/can/core.h>	/* for can_send */
+#include <linux/can/dev.h>	/* for can_priv */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,4,0)
+#include <linux/can/can-ml.h>	/* for can_ml_priv */
+#endif
+#include <net/rtnetlink.h>
+#include <linux/bitops.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include "ce_gw_main.h"
+#include "ce_gw_tx.h"
+
+#include <asm-generic/errno-base.h>
+#include <asm-generic/errno.h>
+
+HLIST_HEAD(ce_gw_tx_list); /**< list of all CAN destination devices */
+
+static unsigned int txq_len = 64;
+module_param(txq_len, uint, S_IRUGO);
+MODULE_PARM_DESC(txq_len, "Default maximum number of queued frames per CAN "
+                 "destination (default 64)");
+
+static unsigned int txq_mem = 64 * 1024;
+module_param(txq_mem, uint, S_IRUGO);
+MODULE_PARM_DESC(txq_mem, "Default maximum memory in bytes of queued frames "
+                 "per CAN destination (default 65536)");
+
+static unsigned int txq_poll_us = 500;
+module_param(txq_poll_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(txq_poll_us, "Poll interval in microseconds of a busy CAN "
+                 "destination while frames are queued (default 500)");
+
+static unsigned int txq_burst_us = 2000;
+module_param(txq_burst_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(txq_burst_us, "Bus time in microseconds the shaper may use at "
+                 "once after an idle period (default 2000)");
+
+/** Window of the bus load measurement, see ce_gw_tx_load_add() */
+#define CE_GW_TX_LOAD_NS (100 * NSEC_PER_MSEC)
+
+/** Maximum number of frames sent in one run of ce_gw_tx_drain() */
+#define CE_GW_TX_BUDGET 16
+
+/** Default quantum of #CE_GW_TX_SCHED_DRR, one CAN FD frame per round */
+#define CE_GW_TX_QUANTUM CANFD_MTU
+
+/** ce_gw_tx_cb.band: the frame is in ce_gw_tx_route.queue of its route */
+#define CE_GW_TX_BAND_ROUTE 0xFF
+
+/**
+ * @struct ce_gw_tx_cb
+ * @brief Control buffer of a queued CAN sk_buff
+ * @details skb->cb is free as long as the frame is in struct ce_gw_tx, but
+ *          it is overwritten by the qdisc in can_send().
+ */
+struct ce_gw_tx_cb {
+	struct ce_gw_job *job;	/**< Route of the frame */
+	u64 tstamp;		/**< Time of enqueue in ns */
+	u32 key;		/**< Arbitration key, see ce_gw_tx_prio_key() */
+	u8 band;		/**< Band in ce_gw_tx.bands or #CE_GW_TX_BAND_ROUTE */
+};
+#define CE_GW_TX_CB(skb) ((struct ce_gw_tx_cb *)(skb)->cb)
+
+/**
+ * @fn static struct ce_gw_tx *ce_gw_tx_find(struct net_device *can_dev)
+ * @brief Searches the transmission state of a CAN device
+ * @param can_dev CAN destination device
+ * @retval NULL if no route uses the device as destination
+ * @ingroup tx
+ */
+static struct ce_gw_tx *ce_gw_tx_find(struct net_device *can_dev)
+{
+	struct ce_gw_tx *tx = NULL;
+	struct hlist_node *node;
+
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	hlist_for_each_entry_safe(tx, node, &ce_gw_tx_list, list) {
+#	else
+	struct hlist_node *pos;
+	hlist_for_each_entry_safe(tx, pos, node, &ce_gw_tx_list, list) {
+#	endif
+		if (tx->dev == can_dev)
+			return tx;
+	}
+
+	return NULL;
+}
+
+/**
+ * @fn static u32 ce_gw_tx_prio_key(struct sk_buff *can_skb)
+ * @brief Returns a key of the CAN ID which is ordered like CAN arbitration
+ * @param can_skb The CAN frame
+ * @return 30 bit key, the lower the key the higher the priority on the bus
+ * @details An SFF ID competes with the 11 most significant bits of an EFF ID
+ *          and wins if they are equal.
+ * @ingroup tx
+ */
+static u32 ce_gw_tx_prio_key(struct sk_buff *can_skb)
+{
+	canid_t id = ((struct can_frame *) can_skb->data)->can_id;
+
+	if (id & CAN_EFF_FLAG)
+		return ((id & CAN_EFF_MASK) << 1) | 1;
+
+	return (id & CAN_SFF_MASK) << 19;
+}
+
+/**
+ * @fn static u8 ce_gw_tx_band(struct ce_gw_tx *tx, struct sk_buff *can_skb)
+ * @brief Returns the band of a frame depending on the scheduler
+ * @param tx The transmission state of the CAN device
+ * @param can_skb The CAN frame. The key in its control buffer must be set.
+ * @return band index, 0 is sent first
+ * @ingroup tx
+ */
+static u8 ce_gw_tx_band(struct ce_gw_tx *tx, struct sk_buff *can_skb)
+{
+	switch (tx->sched) {
+	case CE_GW_TX_SCHED_PRIO_ID:
+		/* the 4 most significant bits of the 30 bit key */
+		return CE_GW_TX_CB(can_skb)->key >> 26;
+	case CE_GW_TX_SCHED_PRIO_SKB:
+		return CE_GW_TX_BANDS - 1 -
+		       min_t(u32, can_skb->priority, CE_GW_TX_BANDS - 1);
+	case CE_GW_TX_SCHED_DRR:
+		return CE_GW_TX_BAND_ROUTE;
+	case CE_GW_TX_SCHED_FIFO:
+	default:
+		return 0;
+	}
+}
+
+/**
+ * @fn static void __ce_gw_tx_link(struct ce_gw_tx *tx, struct sk_buff *skb)
+ * @brief Inserts a frame into its band
+ * @param tx The transmission state of the CAN device
+ * @param skb The CAN frame. job and key in its control buffer must be set.
+ * @details With #CE_GW_TX_SCHED_PRIO_ID the band is kept sorted by key. Frames
+ *          with the same key are kept in arrival order. With
+ *          #CE_GW_TX_SCHED_DRR the frame is added to the queue of its route
+ *          and the route becomes active.
+ * @pre tx->lock must be held
+ * @ingroup tx
+ */
+static void __ce_gw_tx_link(struct ce_gw_tx *tx, struct sk_buff *skb)
+{
+	struct ce_gw_tx_route *txr = &CE_GW_TX_CB(skb)->job->txr;
+	struct sk_buff_head *band;
+	struct sk_buff *pos;
+	u8 b = ce_gw_tx_band(tx, skb);
+
+	CE_GW_TX_CB(skb)->band = b;
+
+	if (b == CE_GW_TX_BAND_ROUTE) {
+		if (list_empty(&txr->active)) {
+			txr->deficit = 0;
+			list_add_tail(&txr->active, &tx->active);
+		}
+		__skb_queue_tail(&txr->queue, skb);
+		goto ce_gw_tx_link_accounted;
+	}
+
+	band = &tx->bands[b];
+
+	if (tx->sched != CE_GW_TX_SCHED_PRIO_ID) {
+		__skb_queue_tail(band, skb);
+		goto ce_gw_tx_link_done;
+	}
+
+	skb_queue_reverse_walk(band, pos) {
+		if (CE_GW_TX_CB(pos)->key <= CE_GW_TX_CB(skb)->key) {
+			__skb_queue_after(band, pos, skb);
+			goto ce_gw_tx_link_done;
+		}
+	}
+	__skb_queue_head(band, skb);
+
+ce_gw_tx_link_done:
+	__set_bit(b, &tx->bands_used);
+ce_gw_tx_link_accounted:
+	tx->queue_frames++;
+	tx->queue_bytes += skb->truesize;
+	if (++txr->queue_frames > txr->queue_frames_max)
+		txr->queue_frames_max = txr->queue_frames;
+}
+
+/**
+ * @fn static void __ce_gw_tx_unlink(struct ce_gw_tx *tx, struct sk_buff *skb)
+ * @brief Removes a frame from its band
+ * @param tx The transmission state of the CAN device
+ * @param skb The queued CAN frame
+ * @pre tx->lock must be held
+ * @ingroup tx
+ */
+static void __ce_gw_tx_unlink(struct ce_gw_tx *tx, struct sk_buff *skb)
+{
+	struct ce_gw_tx_route *txr = &CE_GW_TX_CB(skb)->job->txr;
+	u8 b = CE_GW_TX_CB(skb)->band;
+
+	if (b == CE_GW_TX_BAND_ROUTE) {
+		__skb_unlink(skb, &txr->queue);
+		if (skb_queue_empty(&txr->queue))
+			list_del_init(&txr->active);
+	} else {
+		__skb_unlink(skb, &tx->bands[b]);
+		if (skb_queue_empty(&tx->bands[b]))
+			__clear_bit(b, &tx->bands_used);
+	}
+	tx->queue_frames--;
+	tx->queue_bytes -= skb->truesize;
+	txr->queue_frames--;
+}
+
+/**
+ * @fn static void __ce_gw_tx_requeue(struct ce_gw_tx *tx, struct sk_buff *skb,
+ *                                   struct ce_gw_job *job, u64 tstamp)
+ * @brief Puts a frame back at the head of its band after a failed can_send()
+ * @param tx The transmission state of the CAN device
+ * @param skb The CAN frame which was returned by ce_gw_tx_peek() before
+ * @param job The route of the frame
+ * @param tstamp The enqueue time of the frame
+ * @details can_send() has overwritten the control buffer, so it is set again.
+ *          With #CE_GW_TX_SCHED_DRR the route gets back the deficit charged
+ *          by ce_gw_tx_drain() and stays first in the round.
+ * @pre tx->lock must be held
+ * @ingroup tx
+ */
+static void __ce_gw_tx_requeue(struct ce_gw_tx *tx, struct sk_buff *skb,
+                               struct ce_gw_job *job, u64 tstamp)
+{
+	struct ce_gw_tx_route *txr = &job->txr;
+	u8 b;
+
+	CE_GW_TX_CB(skb)->job = job;
+	CE_GW_TX_CB(skb)->tstamp = tstamp;
+	CE_GW_TX_CB(skb)->key = ce_gw_tx_prio_key(skb);
+	b = ce_gw_tx_band(tx, skb);
+	CE_GW_TX_CB(skb)->band = b;
+
+	if (b == CE_GW_TX_BAND_ROUTE) {
+		txr->deficit += skb->len;
+		list_move(&txr->active, &tx->active);
+		__skb_queue_head(&txr->queue, skb);
+	} else {
+		__skb_queue_head(&tx->bands[b], skb);
+		__set_bit(b, &tx->bands_used);
+	}
+	tx->queue_frames++;
+	tx->queue_bytes += skb->truesize;
+	txr->queue_frames++;
+}
+
+/**
+ * @fn static struct sk_buff *ce_gw_tx_peek(struct ce_gw_tx *tx)
+ * @brief Returns the frame which has to be sent next
+ * @param tx The transmission state of the CAN device
+ * @retval NULL if no frame is queued
+ * @details With #CE_GW_TX_SCHED_DRR this runs the round: a route whose
+ *          deficit is too small for its next frame gets quantum * weight
+ *          bytes more and goes to the end of the round.
+ * @pre tx->lock must be held
+ * @ingroup tx
+ */
+static struct sk_buff *ce_gw_tx_peek(struct ce_gw_tx *tx)
+{
+	struct ce_gw_tx_route *txr;
+	struct sk_buff *skb;
+
+	if (tx->sched == CE_GW_TX_SCHED_DRR) {
+		while (!list_empty(&tx->active)) {
+			txr = list_first_entry(&tx->active,
+			                       struct ce_gw_tx_route, active);
+			skb = skb_peek(&txr->queue);
+			if (txr->deficit >= skb->len)
+				return skb;
+
+			txr->deficit += tx->quantum * txr->weight;
+			list_move_tail(&txr->active, &tx->active);
+		}
+		return NULL;
+	}
+
+	if (tx->bands_used == 0)
+		return NULL;
+
+	return skb_peek(&tx->bands[__ffs(tx->bands_used)]);
+}
+
+/**
+ * @fn static struct sk_buff *ce_gw_tx_victim(struct ce_gw_tx *tx)
+ * @brief Returns the frame which is dropped first if the queue is full
+ * @param tx The transmission state of the CAN device
+ * @retval NULL if no frame is queued
+ * @details With #CE_GW_TX_SCHED_FIFO this is the oldest frame, with a
+ *          priority scheduler the frame which would be sent last and with
+ *          #CE_GW_TX_SCHED_DRR the newest frame of the longest route queue.
+ * @pre tx->lock must be held
+ * @ingroup tx
+ */
+static struct sk_buff *ce_gw_tx_victim(struct ce_gw_tx *tx)
+{
+	struct ce_gw_tx_route *txr, *longest = NULL;
+
+	if (tx->sched == CE_GW_TX_SCHED_DRR) {
+		list_for_each_entry(txr, &tx->active, active) {
+			if (longest == NULL ||
+			    txr->queue_frames > longest->queue_frames)
+				longest = txr;
+		}
+		return longest ? skb_peek_tail(&longest->queue) : NULL;
+	}
+
+	if (tx->bands_used == 0)
+		return NULL;
+
+	if (tx->sched == CE_GW_TX_SCHED_FIFO)
+		return skb_peek(&tx->bands[0]);
+
+	return skb_peek_tail(&tx->bands[__fls(tx->bands_used)]);
+}
+
+/**
+ * @fn static int ce_gw_tx_loop(struct ce_gw_tx *tx, struct ce_gw_job *job,
+ *                              struct sk_buff *can_skb)
+ * @brief Returns the loop argument of can_send() for a route
+ * @param tx The transmission state of the CAN destination device
+ * @param job The route of the frame
+ * @param can_skb The frame
+ * @retval 0 without #CE_GW_F_LOOPBACK flag or if nobody on this host would
+ *         take the frame
+ * @retval 1 the frame has to be looped back
+ * @details Loopback lets can_send() clone every frame for the local
+ *          receivers, so it is skipped if there are none. The receivers of
+ *          the gateway itself (ce_gw_tx.gw_rcv) only count as long as the
+ *          frame is below the hop limit of their routes, otherwise they would
+ *          drop it anyway. The receiver lists of af_can are read without
+ *          lock, a receiver which registers at the same time may miss a
+ *          frame. Before Linux 5.4 the lists are private to af_can and the
+ *          frame is always looped back if the flag is set.
+ * @ingroup tx
+ */
+static int ce_gw_tx_loop(struct ce_gw_tx *tx, struct ce_gw_job *job,
+                         struct sk_buff *can_skb)
+{
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(5,4,0)
+	struct net_device *dev = tx->dev;
+	struct can_ml_priv *ml_priv;
+	struct can_dev_rcv_lists *alldev;
+	unsigned int entries = 0;
+	unsigned int gw_rcv;
+#	endif
+
+	if ((job->flags & CE_GW_F_LOOPBACK) != CE_GW_F_LOOPBACK)
+		return 0;
+
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(5,4,0)
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(5,11,0)
+	ml_priv = can_get_ml_priv(dev);
+#	else
+	ml_priv = dev->ml_priv;
+#	endif
+	alldev = dev_net(dev)->can.rx_alldev_list;
+
+	if (ml_priv != NULL)
+		entries += READ_ONCE(ml_priv->dev_rcv_lists.entries);
+	if (alldev != NULL)
+		entries += READ_ONCE(alldev->entries);
+
+	/* the gateway's own receivers would drop the frame at the hop limit */
+	gw_rcv = READ_ONCE(tx->gw_rcv);
+	if (gw_rcv != 0 &&
+	    ce_gw_skb_hops(can_skb) >= READ_ONCE(tx->gw_hop_limit))
+		entries -= min(entries, gw_rcv);
+
+	if (entries == 0)
+		return 0;
+#	endif
+
+	return 1;
+}
+
+/**
+ * @fn static int ce_gw_tx_xmit(struct sk_buff *can_skb, int loop)
+ * @brief Passes a frame to can_send() and keeps it if the CAN device is full
+ * @param can_skb The CAN frame
+ * @param loop loop argument of can_send(), see ce_gw_tx_loop()
+ * @retval 0 the frame was sent
+ * @retval -ENOBUFS the frame was NOT sent and NOT freed
+ * @retval <0 the frame was dropped and freed
+ * @ingroup tx
+ */
+static int ce_gw_tx_xmit(struct sk_buff *can_skb, int loop)
+{
+	struct sk_buff *clone;
+	int err;
+
+	/* can_send() frees the frame also on failure and the qdisc and driver
+	 * own what they get, so a clone is sent and can_skb kept for a
+	 * requeue. The clone shares the data, only the sk_buff is new. */
+	clone = skb_clone(can_skb, GFP_ATOMIC);
+	if (clone == NULL) {
+		kfree_skb(can_skb);
+		return -ENOMEM;
+	}
+
+	err = can_send(clone, loop);
+	if (err == -ENOBUFS)
+		return err;
+
+	if (err == 0)
+		consume_skb(can_skb);
+	else
+		kfree_skb(can_skb);
+
+	return err;
+}
+
+/**
+ * @fn static void ce_gw_tx_frame_bits(struct sk_buff *can_skb, u32 *nbits,
+ *                                    u32 *dbits)
+ * @brief Calculates the bits of a frame on the wire
+ * @param can_skb The CAN or CAN FD frame
+ * @param nbits Returns the bits sent with the nominal bitrate
+ * @param dbits Returns the bits sent with the data bitrate (CAN FD with
+ *              CANFD_BRS), 0 otherwise
+ * @details Includes the worst case of dynamic stuff bits, the fixed stuff
+ *          bits of the CAN FD CRC field and the interframe space.
+ * @ingroup tx
+ */
+static void ce_gw_tx_frame_bits(struct sk_buff *can_skb, u32 *nbits,
+                                u32 *dbits)
+{
+	struct canfd_frame *cfd = (struct canfd_frame *) can_skb->data;
+	bool eff = (cfd->can_id & CAN_EFF_FLAG) != 0;
+	u32 len, arb, stuffed, crc, tail;
+
+	if (can_skb->len != CANFD_MTU) {
+		len = (cfd->can_id & CAN_RTR_FLAG) ? 0 : min_t(u8, cfd->len, 8);
+		/* SOF, ID, RTR, IDE, reserved, DLC, data and CRC are stuffed;
+		 * CRC delimiter, ACK, EOF and IFS (13 bits) are not */
+		stuffed = (eff ? 54 : 34) + 8 * len;
+		*nbits = stuffed + (stuffed - 1) / 4 + 13;
+		*dbits = 0;
+		return;
+	}
+
+	/* length padded to the next valid CAN FD DLC */
+	len = min_t(u8, cfd->len, CANFD_MAX_DLEN);
+	if (len > 24)
+		len = round_up(len, 16);
+	else if (len > 8)
+		len = round_up(len, 4);
+	crc = len > 16 ? 21 : 17;
+	/* SOF to BRS in the arbitration phase */
+	arb = eff ? 36 : 17;
+	/* ESI, DLC and data in the data phase, dynamic stuffing up to here */
+	stuffed = arb + 5 + 8 * len;
+	/* stuff count, CRC with fixed stuff bits and CRC delimiter */
+	tail = 4 + crc + (crc + 4) / 4 + 1 + 1;
+
+	if ((cfd->flags & CANFD_BRS) == 0) {
+		*nbits = stuffed + (stuffed - 1) / 4 + tail + 12;
+		*dbits = 0;
+		return;
+	}
+
+	/* ACK, ACK delimiter, EOF and IFS are sent with the nominal bitrate */
+	*nbits = arb + (arb - 1) / 4 + 12;
+	*dbits = stuffed - arb + (stuffed - 1) / 4 - (arb - 1) / 4 + tail;
+}
+
+/**
+ * @fn static u64 ce_gw_tx_bus_ns(struct ce_gw_tx *tx, struct sk_buff *can_skb)
+ * @brief Returns the time a frame occupies the bus of the CAN device
+ * @param tx The transmission state of the CAN device
+ * @param can_skb The CAN or CAN FD frame
+ * @retval 0 if the bitrate of the CAN device is unknown (e.g. vcan)
+ * @return bus time in ns
+ * @details The bitrates set in tx are used, otherwise the bittiming of
+ *          the CAN device. It is read for every frame, because it can be
+ *          changed while the device is down.
+ * @ingroup tx
+ */
+static u64 ce_gw_tx_bus_ns(struct ce_gw_tx *tx, struct sk_buff *can_skb)
+{
+	struct can_priv *priv;
+	u32 bitrate = tx->bitrate;
+	u32 dbitrate = tx->dbitrate;
+	u32 nbits, dbits;
+	u64 ns;
+
+	if (bitrate == 0 && tx->has_bittiming) {
+		priv = netdev_priv(tx->dev);
+		bitrate = priv->bittiming.bitrate;
+#		if LINUX_VERSION_CODE >= KERNEL_VERSION(3,15,0)
+		dbitrate = priv->data_bittiming.bitrate;
+#		endif
+	}
+	if (bitrate == 0)
+		return 0;
+	if (dbitrate == 0)
+		dbitrate = bitrate;
+
+	ce_gw_tx_frame_bits(can_skb, &nbits, &dbits);
+
+	ns = div_u64((u64) nbits * NSEC_PER_SEC, bitrate);
+	if (dbits != 0)
+		ns += div_u64((u64) dbits * NSEC_PER_SEC, dbitrate);
+
+	return ns;
+}
+
+/**
+ * @fn static u64 ce_gw_tx_shape(struct ce_gw_tx *tx, u64 cost)
+ * @brief Token bucket of bus time which limits the bus load to tx->load_max
+ * @param tx The transmission state of the CAN device
+ * @param cost Bus time of the next frame, see ce_gw_tx_bus_ns()
+ * @retval 0 the frame may be sent, its cost was taken from the bucket
+ * @return otherwise time in ns until the frame may be sent
+ * @details The bucket may get negative by one frame, so also frames which
+ *          cost more than the burst size are sent.
+ * @pre tx->lock must be held
+ * @ingroup tx
+ */
+static u64 ce_gw_tx_shape(struct ce_gw_tx *tx, u64 cost)
+{
+	u64 now;
+	s64 burst = (s64) txq_burst_us * NSEC_PER_USEC;
+
+	if (tx->load_max == 0 || cost == 0)
+		return 0;
+
+	now = ktime_to_ns(ktime_get());
+	tx->tokens += min_t(u64, burst,
+	                    div_u64((now - tx->tokens_ts) * tx->load_max, 100));
+	tx->tokens_ts = now;
+	if (tx->tokens > burst)
+		tx->tokens = burst;
+
+	if (tx->tokens <= 0)
+		return div_u64((u64) -tx->tokens * 100, tx->load_max) + 1;
+
+	tx->tokens -= cost;
+	return 0;
+}
+
+/**
+ * @fn static void ce_gw_tx_arm_ns(struct ce_gw_tx *tx, u64 ns)
+ * @brief Schedules ce_gw_tx_drain() after param ns if it is not already done
+ * @param tx The transmission state of the CAN device
+ * @param ns Time in ns until the drain
+ * @ingroup tx
+ */
+static void ce_gw_tx_arm_ns(struct ce_gw_tx *tx, u64 ns)
+{
+	if (!hrtimer_is_queued(&tx->timer))
+		hrtimer_start(&tx->timer, ns_to_ktime(ns), HRTIMER_MODE_REL);
+}
+
+/**
+ * @fn static void ce_gw_tx_arm(struct ce_gw_tx *tx)
+ * @brief Starts polling the CAN device if it is not already done
+ * @param tx The transmission state of the CAN device
+ * @ingroup tx
+ */
+static void ce_gw_tx_arm(struct ce_gw_tx *tx)
+{
+	ce_gw_tx_arm_ns(tx, (u64) txq_poll_us * NSEC_PER_USEC);
+}
+
+/**
+ * @fn static void ce_gw_tx_account_wait(struct ce_gw_tx_route *txr,
+ *                                      u64 tstamp)
+ * @brief Adds the waiting time of a frame which left the queue to the
+ *        statistics of its route
+ * @param txr The transmission state of the route
+ * @param tstamp The enqueue time of the frame
+ * @pre tx->lock must be held
+ * @ingroup tx
+ */
+static void ce_gw_tx_account_wait(struct ce_gw_tx_route *txr, u64 tstamp)
+{
+	u64 wait = ktime_to_ns(ktime_get()) - tstamp;
+
+	txr->wait_ns += wait;
+	txr->wait_frames++;
+	if (wait > txr->wait_max_ns)
+		txr->wait_max_ns = min_t(u64, wait, U32_MAX);
+}
+
+/**
+ * @fn static int ce_gw_tx_enqueue(struct ce_gw_tx *tx, struct ce_gw_job *job,
+ *                                struct sk_buff *can_skb)
+ * @brief Adds a frame to the queue and applies the overflow policy
+ * @param tx The transmission state of the CAN device
+ * @param job The route of the frame
+ * @param can_skb The CAN frame
+ * @details With #CE_GW_TX_SCHED_FIFO tx->policy decides which frame is
+ *          dropped. With a priority scheduler always the frame with the lowest
+ *          priority is dropped, which can also be the new frame. With
+ *          #CE_GW_TX_SCHED_DRR the route with the longest queue loses a frame.
+ * @pre tx->lock must be held
+ * @retval CE_GW_TX_QUEUED the frame was queued
+ * @retval -ENOBUFS the frame was dropped and freed
+ * @ingroup tx
+ */
+static int ce_gw_tx_enqueue(struct ce_gw_tx *tx, struct ce_gw_job *job,
+                            struct sk_buff *can_skb)
+{
+	struct sk_buff *old;
+	bool drop_new;
+	u8 band;
+
+	CE_GW_TX_CB(can_skb)->job = job;
+	CE_GW_TX_CB(can_skb)->tstamp = ktime_to_ns(ktime_get());
+	CE_GW_TX_CB(can_skb)->key = ce_gw_tx_prio_key(can_skb);
+	band = ce_gw_tx_band(tx, can_skb);
+
+	while (tx->queue_frames >= tx->max_frames ||
+	       tx->queue_bytes + can_skb->truesize > tx->max_bytes) {
+		tx->overflow_frames++;
+
+		old = ce_gw_tx_victim(tx);
+		if (old == NULL) {
+			drop_new = true;
+		} else if (tx->sched == CE_GW_TX_SCHED_FIFO) {
+			drop_new = tx->policy == CE_GW_TX_DROP_NEWEST;
+		} else if (tx->sched == CE_GW_TX_SCHED_DRR) {
+			drop_new = job->txr.queue_frames >=
+			           CE_GW_TX_CB(old)->job->txr.queue_frames;
+		} else {
+			drop_new = band > CE_GW_TX_CB(old)->band ||
+			           (band == CE_GW_TX_CB(old)->band &&
+			            (tx->sched != CE_GW_TX_SCHED_PRIO_ID ||
+			             CE_GW_TX_CB(can_skb)->key >=
+			             CE_GW_TX_CB(old)->key));
+		}
+
+		if (drop_new) {
+			kfree_skb(can_skb);
+			return -ENOBUFS;
+		}
+
+		__ce_gw_tx_unlink(tx, old);
+		ce_gw_job_inc(CE_GW_TX_CB(old)->job, dropped_frames);
+		kfree_skb(old);
+	}
+
+	__ce_gw_tx_link(tx, can_skb);
+	tx->queued_frames++;
+
+	ce_gw_tx_arm(tx);
+	return CE_GW_TX_QUEUED;
+}
+
+/**
+ * @fn static void ce_gw_tx_load_add(struct ce_gw_tx *tx, u64 cost)
+ * @brief Adds the bus time of a sent frame to the bus load
+ * @param tx The transmission state of the CAN device
+ * @param cost Bus time of the frame, see ce_gw_tx_bus_ns()
+ * @details The load is measured in fixed windows of #CE_GW_TX_LOAD_NS. The
+ *          first frame after the end of a window closes it and stores its
+ *          load. No lock is taken, the fast path of ce_gw_tx_send() sends
+ *          without tx->lock.
+ * @ingroup tx
+ */
+static void ce_gw_tx_load_add(struct ce_gw_tx *tx, u64 cost)
+{
+	u64 now, ts, busy;
+
+	if (cost == 0)
+		return;
+
+	atomic64_add(cost, &tx->load_busy_ns);
+	now = ktime_to_ns(ktime_get());
+	ts = atomic64_read(&tx->load_ts);
+	if (now - ts < CE_GW_TX_LOAD_NS)
+		return;
+
+	/* only one CPU closes the window */
+	if (atomic64_cmpxchg(&tx->load_ts, ts, now) != ts)
+		return;
+	busy = atomic64_xchg(&tx->load_busy_ns, 0);
+	WRITE_ONCE(tx->load, min_t(u64, 100, div64_u64(busy * 100, now - ts)));
+}
+
+/**
+ * @fn static void ce_gw_tx_drain(unsigned long data)
+ * @brief Tasklet which sends the queued frames in the order of the scheduler
+ *        to the CAN device until the device is busy again.
+ * @param data Pointer to the struct ce_gw_tx
+ * @ingroup tx
+ */
+static void ce_gw_tx_drain(unsigned long data)
+{
+	struct ce_gw_tx *tx = (struct ce_gw_tx *) data;
+	struct ce_gw_job *job;
+	struct sk_buff *skb;
+	int budget = CE_GW_TX_BUDGET;
+	u64 tstamp, cost, wait;
+	int err;
+
+	spin_lock(&tx->lock);
+
+	while ((skb = ce_gw_tx_peek(tx)) != NULL) {
+		if (netif_queue_stopped(tx->dev) || budget-- <= 0)
+			break;
+
+		cost = ce_gw_tx_bus_ns(tx, skb);
+		wait = ce_gw_tx_shape(tx, cost);
+		if (wait != 0) {
+			ce_gw_tx_arm_ns(tx, wait);
+			break;
+		}
+
+		job = CE_GW_TX_CB(skb)->job;
+		tstamp = CE_GW_TX_CB(skb)->tstamp;
+		if (tx->sched == CE_GW_TX_SCHED_DRR)
+			job->txr.deficit -= skb->len;
+		__ce_gw_tx_unlink(tx, skb);
+
+		err = ce_gw_tx_xmit(skb, ce_gw_tx_loop(tx, job, skb));
+		if (err == -ENOBUFS) {
+			if (tx->load_max != 0)
+				tx->tokens += cost;
+			__ce_gw_tx_requeue(tx, skb, job, tstamp);
+			break;
+		}
+
+		ce_gw_tx_account_wait(&job->txr, tstamp);
+		if (err != 0) {
+			ce_gw_job_inc(job, dropped_frames);
+		} else {
+			ce_gw_job_inc(job, handled_frames);
+			ce_gw_tx_load_add(tx, cost);
+		}
+	}
+
+	if (tx->queue_frames != 0) {
+		if (budget < 0)
+			tasklet_schedule(&tx->tasklet);
+		else
+			ce_gw_tx_arm(tx);
+	}
+
+	spin_unlock(&tx->lock);
+}
+
+/**
+ * @fn static enum hrtimer_restart ce_gw_tx_timer(struct hrtimer *timer)
+ * @brief Schedules ce_gw_tx_drain(). can_send() must not be called in hard
+ *        interrupt context of the hrtimer.
+ * @param timer ce_gw_tx.timer
+ * @retval HRTIMER_NORESTART always, ce_gw_tx_drain() restarts it if needed
+ * @ingroup tx
+ */
+static enum hrtimer_restart ce_gw_tx_timer(struct hrtimer *timer)
+{
+	struct ce_gw_tx *tx = container_of(timer, struct ce_gw_tx, timer);
+
+	tasklet_schedule(&tx->tasklet);
+	return HRTIMER_NORESTART;
+}
+
+struct ce_gw_tx *ce_gw_tx_get(struct net_device *can_dev)
+{
+	struct ce_gw_tx *tx;
+	int i;
+
+	tx = ce_gw_tx_find(can_dev);
+	if (tx != NULL) {
+		tx->users++;
+		return tx;
+	}
+
+	tx = kzalloc(sizeof(struct ce_gw_tx), GFP_KERNEL);
+	if (tx == NULL) {
+		pr_err("ce_gw_tx: Allocation failed.\n");
+		return NULL;
+	}
+
+	tx->dev = can_dev;
+	tx->users = 1;
+	spin_lock_init(&tx->lock);
+	for (i = 0; i < CE_GW_TX_BANDS; i++)
+		skb_queue_head_init(&tx->bands[i]);
+	tx->max_frames = txq_len;
+	tx->max_bytes = txq_mem;
+	tx->policy = CE_GW_TX_DROP_NEWEST;
+	tx->sched = CE_GW_TX_SCHED_FIFO;
+	INIT_LIST_HEAD(&tx->active);
+	tx->quantum = CE_GW_TX_QUANTUM;
+
+	/* only real CAN drivers have a struct can_priv, not vcan */
+	tx->has_bittiming = can_dev->rtnl_link_ops != NULL &&
+	                    strcmp(can_dev->rtnl_link_ops->kind, "can") == 0;
+	atomic64_set(&tx->load_busy_ns, 0);
+	atomic64_set(&tx->load_ts, ktime_to_ns(ktime_get()));
+
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+	hrtimer_setup(&tx->timer, ce_gw_tx_timer,
+	              CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#	else
+	hrtimer_init(&tx->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	tx->timer.function = ce_gw_tx_timer;
+#	endif
+	tasklet_init(&tx->tasklet, ce_gw_tx_drain, (unsigned long) tx);
+
+	hlist_add_head_rcu(&tx->list, &ce_gw_tx_list);
+
+	return tx;
+}
+
+void ce_gw_tx_route_init(struct ce_gw_tx_route *txr, u32 weight)
+{
+	skb_queue_head_init(&txr->queue);
+	INIT_LIST_HEAD(&txr->active);
+	txr->weight = weight ? weight : 1;
+	txr->deficit = 0;
+	txr->queue_frames = 0;
+	txr->queue_frames_max = 0;
+	txr->wait_ns = 0;
+	txr->wait_frames = 0;
+	txr->wait_max_ns = 0;
+}
+
+void ce_gw_tx_route_stats(struct ce_gw_job *job, u32 *depth,
+                          u32 *wait_avg_us, u32 *wait_max_us)
+{
+	struct ce_gw_tx_route *txr = &job->txr;
+	u64 avg = 0;
+
+	spin_lock_bh(&job->tx->lock);
+	*depth = txr->queue_frames;
+	if (txr->wait_frames != 0)
+		avg = div_u64(txr->wait_ns, txr->wait_frames);
+	*wait_max_us = txr->wait_max_ns / NSEC_PER_USEC;
+	spin_unlock_bh(&job->tx->lock);
+
+	*wait_avg_us = div_u64(avg, NSEC_PER_USEC);
+}
+
+u32 ce_gw_tx_load(struct ce_gw_tx *tx)
+{
+	u64 now = ktime_to_ns(ktime_get());
+	u64 ts = atomic64_read(&tx->load_ts);
+
+	/* no frame closed the window for a whole window, the gateway sent
+	 * (almost) nothing since then */
+	if (now - ts >= 2 * CE_GW_TX_LOAD_NS)
+		return min_t(u64, 100,
+		             div64_u64(atomic64_read(&tx->load_busy_ns) * 100,
+		                       now - ts));
+
+	return READ_ONCE(tx->load);
+}
+
+void ce_gw_tx_gw_rcv(struct net_device *can_dev, unsigned int rcv,
+                     u8 hop_limit)
+{
+	struct ce_gw_tx *tx = ce_gw_tx_find(can_dev);
+
+	if (tx == NULL)
+		return;
+
+	WRITE_ONCE(tx->gw_rcv, rcv);
+	WRITE_ONCE(tx->gw_hop_limit, hop_limit);
+}
+
+void ce_gw_tx_put(struct ce_gw_tx *tx, struct ce_gw_job *job)
+{
+	struct sk_buff *skb, *tmp;
+	int i;
+
+	spin_lock_bh(&tx->lock);
+	for (i = 0; i < CE_GW_TX_BANDS; i++) {
+		skb_queue_walk_safe(&tx->bands[i], skb, tmp) {
+			if (CE_GW_TX_CB(skb)->job != job)
+				continue;
+
+			__ce_gw_tx_unlink(tx, skb);
+			kfree_skb(skb);
+		}
+	}
+	while ((skb = skb_peek(&job->txr.queue)) != NULL) {
+		__ce_gw_tx_unlink(tx, skb);
+		kfree_skb(skb);
+	}
+	spin_unlock_bh(&tx->lock);
+
+	if (--tx->users > 0)
+		return;
+
+	hlist_del_rcu(&tx->list);
+
+	/* queue is empty now, so the tasklet will not start the timer again */
+	hrtimer_cancel(&tx->timer);
+	tasklet_kill(&tx->tasklet);
+
+	kfree(tx);
+}
+
+int ce_gw_tx_check(const struct ce_gw_tx_cfg *cfg)
+{
+	if ((cfg->valid & CE_GW_TX_CFG_POLICY) &&
+	    cfg->policy > CE_GW_TX_DROP_MAX)
+		return -EINVAL;
+	if ((cfg->valid & CE_GW_TX_CFG_SCHED) &&
+	    cfg->sched > CE_GW_TX_SCHED_MAX)
+		return -EINVAL;
+	if (((cfg->valid & CE_GW_TX_CFG_LEN) && cfg->max_frames == 0) ||
+	    ((cfg->valid & CE_GW_TX_CFG_MEM) && cfg->max_bytes == 0) ||
+	    ((cfg->valid & CE_GW_TX_CFG_QUANTUM) && cfg->quantum == 0) ||
+	    ((cfg->valid & CE_GW_TX_CFG_LOAD) && cfg->load_max > 100))
+		return -EINVAL;
+
+	return 0;
+}
+
+int ce_gw_tx_configure(int ifindex, const struct ce_gw_tx_cfg *cfg)
+{
+	struct ce_gw_tx *tx = NULL;
+	struct hlist_node *node;
+	struct sk_buff_head requeue;
+	struct sk_buff *skb;
+	int err;
+
+	err = ce_gw_tx_check(cfg);
+	if (err != 0)
+		return err;
+
+#	if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	hlist_for_each_entry_safe(tx, node, &ce_gw_tx_list, list) {
+#	else
+	struct hlist_node *pos;
+	hlist_for_each_entry_safe(tx, pos, node, &ce_gw_tx_list, list) {
+#	endif
+		if (tx->dev->ifindex == ifindex)
+			break;
+	}
+
+	if (tx == NULL || tx->dev->ifindex != ifindex)
+		return -ENODEV;
+
+	spin_lock_bh(&tx->lock);
+	if (cfg->valid & CE_GW_TX_CFG_LEN)
+		tx->max_frames = cfg->max_frames;
+	if (cfg->valid & CE_GW_TX_CFG_MEM)
+		tx->max_bytes = cfg->max_bytes;
+	if (cfg->valid & CE_GW_TX_CFG_POLICY)
+		tx->policy = cfg->policy;
+	if (cfg->valid & CE_GW_TX_CFG_QUANTUM)
+		tx->quantum = cfg->quantum;
+	if (cfg->valid & CE_GW_TX_CFG_BITRATE)
+		tx->bitrate = cfg->bitrate;
+	if (cfg->valid & CE_GW_TX_CFG_DBITRATE)
+		tx->dbitrate = cfg->dbitrate;
+	if (cfg->valid & CE_GW_TX_CFG_LOAD) {
+		/* start with a full bucket */
+		tx->load_max = cfg->load_max;
+		tx->tokens = (s64) txq_burst_us * NSEC_PER_USEC;
+		tx->tokens_ts = ktime_to_ns(ktime_get());
+	}
+
+	if ((cfg->valid & CE_GW_TX_CFG_SCHED) && tx->sched != cfg->sched) {
+		/* sort all queued frames into the bands of the new scheduler */
+		__skb_queue_head_init(&requeue);
+		while ((skb = ce_gw_tx_peek(tx)) != NULL) {
+			__ce_gw_tx_unlink(tx, skb);
+			__skb_queue_tail(&requeue, skb);
+		}
+
+		tx->sched = cfg->sched;
+		while ((skb = __skb_dequeue(&requeue)) != NULL)
+			__ce_gw_tx_link(tx, skb);
+	}
+	spin_unlock_bh(&tx->lock);
+
+	return 0;
+}
+
+int ce_gw_tx_send(struct ce_gw_job *job, struct sk_buff *can_skb)
+{
+	struct ce_gw_tx *tx = job->tx;
+	u64 cost = ce_gw_tx_bus_ns(tx, can_skb);
+	int err;
+
+	/* send to CAN netdevice */
+	if ((job->flags & CE_GW_F_TX_QUEUE) != CE_GW_F_TX_QUEUE &&
+	    tx->sched == CE_GW_TX_SCHED_FIFO && tx->load_max == 0) {
+		err = can_send(can_skb, ce_gw_tx_loop(tx, job, can_skb));
+		if (err == 0)
+			ce_gw_tx_load_add(tx, cost);
+		return err;
+	}
+
+	/* can_send() is called under the lock, so no frame can overtake the
+	 * frames which are already queued */
+	spin_lock_bh(&tx->lock);
+
+	if (tx->queue_frames == 0 && !netif_queue_stopped(tx->dev) &&
+	    ce_gw_tx_shape(tx, cost) == 0) {
+		err = ce_gw_tx_xmit(can_skb, ce_gw_tx_loop(tx, job, can_skb));
+		if (err == 0)
+			ce_gw_tx_load_add(tx, cost);
+		if (err != -ENOBUFS)
+			goto ce_gw_tx_send_unlock;
+		if (tx->load_max != 0)
+			tx->tokens += cost;
+	}
+
+	err = ce_gw_tx_enqueue(tx, job, can_skb);
+
+ce_gw_tx_send_unlock:
+	spin_unlock_bh(&tx->lock);
+	return err;
+}
+
+/**@}*/